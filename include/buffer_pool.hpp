@@ -0,0 +1,92 @@
+#pragma once
+#include "common.hpp"
+
+#include <array>
+#include <utility>
+
+// Bytes taken off a socket per recv; the buffer is loop-owned or lent, never per connection.
+inline constexpr size_t kReadChunk = 16 * 1024;
+
+struct BufferPoolStats {
+    size_t bytes_in_use = 0;    // handed out to connections (or lent to the kernel)
+    size_t bytes_cached = 0;    // free, kept in thread caches and the shared depot
+};
+
+// Power-of-two I/O buffers from 1KB to 1MB. Each thread frees into and
+// allocates from its own cache without locking; a cache that grows past its
+// per-class limit hands half of it to a shared depot, and the depot returns
+// memory to the system beyond its own limit. Larger requests bypass the pool.
+class BufferPool {
+public:
+    static constexpr size_t kMinShift = 10;
+    static constexpr size_t kMaxShift = 20;
+
+    // returns at least `size` bytes; `capacity` receives the real size
+    static char* acquire(size_t size, size_t& capacity);
+    static void release(char* data, size_t capacity);
+    static BufferPoolStats stats();
+
+private:
+    static constexpr size_t kClasses = kMaxShift - kMinShift + 1;
+    static constexpr size_t kThreadCacheBytesPerClass = 256 * 1024;
+    static constexpr size_t kDepotBytesPerClass = 4 * 1024 * 1024;
+
+    struct FreeNode { FreeNode* next; };
+    struct FreeList {
+        FreeNode* head = nullptr;
+        size_t count = 0;
+    };
+    struct ThreadCache {
+        std::array<FreeList, kClasses> lists;
+        ~ThreadCache();     // a finished thread's buffers move to the depot
+    };
+
+    static thread_local ThreadCache cache_;
+    static std::mutex depot_mutex_;
+    static std::array<FreeList, kClasses> depot_;
+    static std::atomic<size_t> bytes_in_use_;
+    static std::atomic<size_t> bytes_cached_;
+
+    static size_t class_index(size_t size);
+    static size_t limit(size_t index, size_t bytes_per_class);
+    static void spill(size_t index, FreeList& list, size_t keep);
+};
+
+// Growable byte buffer backed by BufferPool. It owns memory only while it
+// holds bytes: draining it with consume() or clear() returns the buffer to
+// the pool, so an idle connection costs nothing here.
+class PooledBuffer {
+public:
+    PooledBuffer() = default;
+    ~PooledBuffer() { clear(); }
+    PooledBuffer(PooledBuffer&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)),
+          size_(std::exchange(other.size_, 0)),
+          capacity_(std::exchange(other.capacity_, 0)) {}
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept {
+        if (this != &other) {
+            clear();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+            capacity_ = std::exchange(other.capacity_, 0);
+        }
+        return *this;
+    }
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    std::string_view view() const { return {data_, size_}; }
+
+    void append(std::string_view bytes);
+    // drops `n` bytes from the front
+    void consume(size_t n);
+    void clear();
+
+private:
+    char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+};
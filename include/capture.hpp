@@ -0,0 +1,53 @@
+#pragma once
+#include "utils.hpp"
+#include "capture_format.hpp"
+
+#include <condition_variable>
+
+
+// Records every framed message with its connection and arrival time into a
+// capture file (capture_format.hpp) for benchmark-client --replay. Loop
+// threads only append to an in-memory buffer under a short lock; a writer
+// thread moves it to the file, so the loops never wait on the disk. If the
+// writer falls more than the buffer limit behind, records are dropped and
+// counted rather than stalling the server.
+class TrafficCapture {
+public:
+    explicit TrafficCapture(size_t buffer_limit = 64 * 1024 * 1024);
+    ~TrafficCapture();  // writes out what is buffered, then closes the file
+    TrafficCapture(const TrafficCapture&) = delete;
+    TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+    bool open(const std::string& path);
+
+    // An accepted connection on `fd`; its messages get a fresh connection number.
+    void open_connection(int fd);
+    // A run of complete '\n'-terminated messages just read from `fd`.
+    void record(int fd, std::string_view messages);
+
+    uint64_t records() const { return records_.load(std::memory_order_relaxed); }
+    uint64_t bytes_written() const { return bytes_written_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    // the writer is woken early once this much is buffered, otherwise every kFlushInterval
+    static constexpr size_t kFlushBytes = 256 * 1024;
+    static constexpr auto kFlushInterval = std::chrono::milliseconds(100);
+
+    size_t buffer_limit_;
+    SocketRAII fd_;
+    std::chrono::steady_clock::time_point start_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::string pending_;                           // records not yet handed to the writer
+    std::unordered_map<int, uint32_t> connections_; // fd -> connection number
+    uint32_t next_connection_ = 0;
+    bool stopping_ = false;
+    std::thread writer_;
+    std::atomic<uint64_t> records_{0};
+    std::atomic<uint64_t> bytes_written_{0};
+    std::atomic<uint64_t> dropped_{0};
+
+    void write_loop();
+    bool write_out(std::string_view data);
+};
@@ -0,0 +1,42 @@
+#pragma once
+// On-disk layout of a traffic capture (server --capture, client --replay).
+// Plain structs on standard headers only, so the benchmark client can map a
+// capture without pulling in the server.
+//
+// A file is one CaptureFileHeader followed by records, each a
+// CaptureRecordHeader and `length` bytes of one '\n'-terminated message.
+// Records are in the order the server framed them; a truncated last record
+// (the server was killed mid-write) ends the capture.
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+inline constexpr char kCaptureMagic[8] = {'C', 'I', 'O', 'C', 'A', 'P', '1', '\n'};
+
+struct CaptureFileHeader {
+    char magic[8];
+    uint64_t start_unix_ns;     // wall clock when the capture started, for reference
+};
+
+struct CaptureRecordHeader {
+    uint64_t offset_ns;         // when the read that framed the message returned, since the start
+    uint32_t connection;        // numbered from 1 in accept order, never reused
+    uint32_t length;            // message bytes that follow
+};
+
+static_assert(sizeof(CaptureFileHeader) == 16 && sizeof(CaptureRecordHeader) == 16);
+
+// Walks the records of a mapped capture; false once the data is used up or truncated.
+inline bool next_capture_record(std::string_view& rest, CaptureRecordHeader& header, std::string_view& message) {
+    if (rest.size() < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, rest.data(), sizeof(header));
+    if (rest.size() - sizeof(header) < header.length) {
+        return false;
+    }
+    message = rest.substr(sizeof(header), header.length);
+    rest.remove_prefix(sizeof(header) + header.length);
+    return true;
+}
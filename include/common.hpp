@@ -14,19 +14,29 @@
 #include <thread>
 #include <chrono>
 #include <sstream>
+#include <iomanip>
 #include <csignal>
 #include <optional>
 #include <vector>
+#include <unordered_map>
+#include <deque>
 #include <ranges>
 #include <sys/epoll.h>
 #include <sys/poll.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <unistd.h>
 #include <algorithm>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <fcntl.h>
+#include <linux/errqueue.h>
 #include <liburing.h>
-#include <cstring>
\ No newline at end of file
+#include <cstring>
+#include <charconv>
+#include <cctype>
\ No newline at end of file
@@ -0,0 +1,232 @@
+#pragma once
+#include "utils.hpp"
+#include "buffer_pool.hpp"
+#include "loop_stats.hpp"
+
+#include <array>
+#include <coroutine>
+#include <queue>
+
+
+// Thread-local free lists of coroutine frames in 64-byte size classes. Frames
+// are recycled instead of returned to malloc, so spawning a handler per
+// connection costs a pop from a list once the pool is warm.
+class FramePool {
+public:
+    static void* allocate(size_t size);
+    static void deallocate(void* frame, size_t size);
+
+private:
+    static constexpr size_t kGranularity = 64;
+    static constexpr size_t kMaxPooled = 32 * 1024;
+    struct FreeNode { FreeNode* next; };
+    static thread_local std::array<FreeNode*, kMaxPooled / kGranularity + 1> free_lists_;
+};
+
+
+// Fire-and-forget coroutine: starts eagerly and frees its own frame when it
+// returns. Handlers report errors through return codes, not exceptions.
+struct Task {
+    struct promise_type {
+        Task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+
+        static void* operator new(size_t size) { return FramePool::allocate(size); }
+        static void operator delete(void* frame, size_t size) { FramePool::deallocate(frame, size); }
+    };
+};
+
+
+// One outstanding operation. It lives inside the awaiter, i.e. inside the
+// suspended coroutine frame, so awaiting never allocates.
+struct IoOp {
+    enum class Kind : uint8_t { Accept, Read, Write, Sleep, Readable };
+
+    Kind kind;
+    int fd = -1;
+    char* buffer = nullptr;     // Read: nullptr borrows a reactor buffer, see CoSocket::read()
+    size_t length = 0;
+    size_t done = 0;            // Write: bytes already sent
+    ssize_t result = 0;         // bytes, accepted fd, poll mask, or -errno
+    std::coroutine_handle<> handle;
+    std::chrono::steady_clock::time_point deadline;   // Sleep on epoll
+    __kernel_timespec timeout{};                      // Sleep on io_uring
+};
+
+template<typename Reactor>
+struct IoAwaiter {
+    Reactor& reactor;
+    IoOp op;
+
+    bool await_ready() const noexcept { return false; }
+    // the reactor may finish the op inline (epoll fast path), then we don't suspend
+    bool await_suspend(std::coroutine_handle<> handle) {
+        op.handle = handle;
+        return reactor.start(&op);
+    }
+    ssize_t await_resume() const noexcept { return op.result; }
+};
+
+template<typename Reactor>
+struct LentReadAwaiter : IoAwaiter<Reactor> {
+    std::string_view await_resume() const noexcept {
+        return this->op.result > 0 ? std::string_view(this->op.buffer, this->op.result) : std::string_view();
+    }
+};
+
+
+// Readiness reactor: ops are tried right away and parked on their fd only when
+// the socket would block; an edge-triggered EPOLLIN/EPOLLOUT retries them.
+class EpollReactor {
+public:
+    static constexpr const char* kName = "CoEpollServer";
+
+    EpollReactor() = default;
+    ~EpollReactor();
+    EpollReactor(const EpollReactor&) = delete;
+    EpollReactor& operator=(const EpollReactor&) = delete;
+
+    bool init();
+    bool add(int fd);
+    void remove(int fd);
+    bool start(IoOp* op);       // true: parked, the coroutine suspends
+    void cancel(IoOp* op);      // resumes a parked op with -ECANCELED
+    void run_once();
+    void set_probe(LoopProbe* probe) { probe_ = probe; }
+
+private:
+    struct Waiters {
+        IoOp* reader = nullptr;
+        IoOp* writer = nullptr;
+    };
+    struct TimerEntry {
+        std::chrono::steady_clock::time_point deadline;
+        IoOp* op;
+        bool operator>(const TimerEntry& other) const { return deadline > other.deadline; }
+    };
+
+    int epoll_fd_ = -1;
+    char* read_buffer_ = nullptr;           // shared by every lent read
+    std::vector<Waiters> waiters_;          // indexed by fd
+    std::vector<epoll_event> events_;
+    std::priority_queue<TimerEntry, std::vector<TimerEntry>, std::greater<>> timers_;
+    LoopProbe* probe_ = nullptr;
+
+    bool perform(IoOp* op);                 // false: would block
+};
+
+
+// Completion reactor: every op becomes one SQE whose user_data is the IoOp.
+class IOUringReactor {
+public:
+    static constexpr const char* kName = "CoIOUringServer";
+
+    IOUringReactor() = default;
+    ~IOUringReactor();
+    IOUringReactor(const IOUringReactor&) = delete;
+    IOUringReactor& operator=(const IOUringReactor&) = delete;
+
+    bool init();
+    bool add(int) { return true; }
+    void remove(int) {}
+    bool start(IoOp* op);
+    void cancel(IoOp* op);      // its completion resumes the op, with -ECANCELED if it was still pending
+    void run_once();
+    void set_probe(LoopProbe* probe) { probe_ = probe; }
+
+private:
+    // user_data of IORING_OP_ASYNC_CANCEL; IoOps are aligned, so it is never one of them
+    static constexpr uint64_t kCancelMarker = 1;
+    // lent reads pick one of these when data arrives (IOSQE_BUFFER_SELECT)
+    static constexpr unsigned kLentBufferCount = 64;
+    static constexpr uint16_t kLentBufferGroup = 1;
+
+    struct io_uring ring_;
+    bool initialized_ = false;
+    std::vector<struct io_uring_cqe*> cqes_;
+    std::vector<char*> lent_buffers_;       // indexed by buffer id
+    std::vector<uint16_t> returned_;        // lent last round, provided again next round
+    LoopProbe* probe_ = nullptr;
+
+    bool submit(IoOp* op);      // false: no SQE available
+    bool provide(uint16_t buffer_id);
+};
+
+
+// Socket owned by a handler coroutine; registered with the reactor for its lifetime.
+template<typename Reactor>
+class CoSocket {
+public:
+    CoSocket(Reactor& reactor, int fd) : reactor_(reactor), fd_(fd) {}
+    ~CoSocket() { reactor_.remove(fd_.get()); }
+    CoSocket(const CoSocket&) = delete;
+    CoSocket& operator=(const CoSocket&) = delete;
+
+    int fd() const { return fd_.get(); }
+
+    // co_await -> the bytes read into a reactor-owned buffer, empty on EOF or
+    // error. The view is valid until this coroutine's next co_await, so an idle
+    // connection holds no read buffer.
+    LentReadAwaiter<Reactor> read() {
+        LentReadAwaiter<Reactor> awaiter{{reactor_, {}}};
+        awaiter.op.kind = IoOp::Kind::Read;
+        awaiter.op.fd = fd_.get();
+        awaiter.op.length = kReadChunk;
+        return awaiter;
+    }
+
+    // co_await -> bytes read into `buffer`, 0 on EOF, -errno on error
+    IoAwaiter<Reactor> read(char* buffer, size_t length) {
+        IoAwaiter<Reactor> awaiter{reactor_, {}};
+        awaiter.op.kind = IoOp::Kind::Read;
+        awaiter.op.fd = fd_.get();
+        awaiter.op.buffer = buffer;
+        awaiter.op.length = length;
+        return awaiter;
+    }
+
+    // co_await -> data.size() once everything is sent, -errno on error
+    IoAwaiter<Reactor> write(std::string_view data) {
+        IoAwaiter<Reactor> awaiter{reactor_, {}};
+        awaiter.op.kind = IoOp::Kind::Write;
+        awaiter.op.fd = fd_.get();
+        awaiter.op.buffer = const_cast<char*>(data.data());
+        awaiter.op.length = data.size();
+        return awaiter;
+    }
+
+private:
+    Reactor& reactor_;
+    SocketRAII fd_;
+};
+
+// co_await -> a new non-blocking client fd, or -errno
+template<typename Reactor>
+IoAwaiter<Reactor> accept_on(Reactor& reactor, int server_fd) {
+    IoAwaiter<Reactor> awaiter{reactor, {}};
+    awaiter.op.kind = IoOp::Kind::Accept;
+    awaiter.op.fd = server_fd;
+    return awaiter;
+}
+
+// co_await -> once `fd` is readable, without reading it; the fd must be add()ed
+template<typename Reactor>
+IoAwaiter<Reactor> readable_on(Reactor& reactor, int fd) {
+    IoAwaiter<Reactor> awaiter{reactor, {}};
+    awaiter.op.kind = IoOp::Kind::Readable;
+    awaiter.op.fd = fd;
+    return awaiter;
+}
+
+template<typename Reactor>
+IoAwaiter<Reactor> sleep_for(Reactor& reactor, std::chrono::nanoseconds duration) {
+    IoAwaiter<Reactor> awaiter{reactor, {}};
+    awaiter.op.kind = IoOp::Kind::Sleep;
+    awaiter.op.deadline = std::chrono::steady_clock::now() + duration;
+    awaiter.op.timeout.tv_sec = duration.count() / 1000000000;
+    awaiter.op.timeout.tv_nsec = duration.count() % 1000000000;
+    return awaiter;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "utils.hpp"
+
+#include <functional>
+
+
+// Hot restart: a running server passes its listening socket to its successor
+// over an AF_UNIX socket (SCM_RIGHTS), then drains its own connections while
+// the successor accepts new ones.
+//
+//   old: cpp-io-learning epoll 8080 --handoff /run/cpp-io.sock
+//   new: cpp-io-learning epoll 8080 --takeover /run/cpp-io.sock --handoff /run/cpp-io.sock
+//
+// The listening socket is never closed, so nothing is refused mid-restart:
+// connections waiting in its backlog, or arriving while both processes run,
+// are accepted by whichever process takes them first.
+//
+// Exchange: the successor connects, receives one byte with the listener
+// attached, and answers one byte once it serves the listener. Only that
+// answer makes the old process drain; a successor that dies first changes
+// nothing, and the next one can try again.
+
+// Old side: waits for a successor on `path` on a thread of its own.
+class HandoffServer {
+public:
+    HandoffServer();
+    ~HandoffServer();   // stops waiting
+    HandoffServer(const HandoffServer&) = delete;
+    HandoffServer& operator=(const HandoffServer&) = delete;
+
+    // `handed_over` runs on the handoff thread once a successor confirmed.
+    bool start(const std::string& path, int listener, std::function<void()> handed_over);
+
+private:
+    SocketRAII socket_;
+    SocketRAII stop_fd_;    // eventfd that ends the thread
+    int listener_ = -1;
+    std::function<void()> handed_over_;
+    std::thread thread_;
+
+    void serve();
+    bool hand_over(int channel);
+    // false once stop_fd_ fired or `timeout_ms` passed without `fd` turning readable
+    bool wait_readable(int fd, int timeout_ms);
+};
+
+// New side: the predecessor's listener, with `channel` left open for
+// confirm_takeover. std::nullopt if there is nobody to take over from.
+std::optional<int> take_over_listener(const std::string& path, SocketRAII& channel);
+// Tells the predecessor this process serves the listener now.
+bool confirm_takeover(SocketRAII& channel);
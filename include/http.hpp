@@ -0,0 +1,74 @@
+#pragma once
+#include "common.hpp"
+
+#include <array>
+
+
+struct HttpHeader {
+    std::string_view name;
+    std::string_view value;
+};
+
+// One parsed request. Every view points into the connection's input, so it is
+// only valid until that input is consumed.
+struct HttpRequest {
+    static constexpr size_t kMaxHeaders = 32;
+
+    std::string_view method;
+    std::string_view target;
+    int minor_version = 1;          // HTTP/1.<minor_version>
+    bool keep_alive = true;
+    std::string_view body;
+    size_t size = 0;                // request line, headers and body
+    std::array<HttpHeader, kMaxHeaders> headers;
+    size_t header_count = 0;
+};
+
+enum class HttpParse { Complete, Incomplete, Invalid };
+
+// Parses the request at the start of `data` without copying. Incomplete
+// leaves nothing behind: the caller keeps the bytes and calls again once more
+// arrived, and since the search for the end of the headers stops at the first
+// blank line, a retry costs at most one header block whatever the body size.
+// Bodies need Content-Length; chunked requests are Invalid.
+HttpParse parse_http_request(std::string_view data, HttpRequest& request);
+
+// "Date: <IMF-fixdate>\r\n" for the current second. Formatted at most once a
+// second per thread, every other call is a clock read and a compare.
+std::string_view http_date_header();
+
+// Writes responses from header blocks built once at startup: the status line
+// and fixed headers, then the cached Date header, then (for a fixed body) the
+// Content-Length and body. Only the Connection header and, when echoing, the
+// length vary per request.
+class HttpResponder {
+public:
+    // echo: the body is the request's body, or its target if it has none;
+    // otherwise a fixed body of `fixed_body` bytes, or "Hello, World!" for 0
+    HttpResponder(bool echo, size_t fixed_body);
+
+    void respond(const HttpRequest& request, std::string& out) const;
+    // 503 for requests shed under overload
+    void respond_busy(const HttpRequest& request, std::string& out) const;
+    // 200 head of a static file, up to the blank line; `file_headers` holds
+    // its Content-Length and Last-Modified lines, the caller adds the body
+    void respond_file(const HttpRequest& request, std::string_view file_headers, std::string& out) const;
+    void respond_not_found(const HttpRequest& request, std::string& out) const;
+
+private:
+    bool echo_;
+    std::string ok_head_;       // status line and fixed headers, up to the Date header
+    std::string fixed_length_;  // Content-Length and blank line of the fixed response
+    std::string fixed_body_;
+    std::string busy_head_;
+    std::string busy_length_;
+    std::string busy_body_;
+    std::string file_head_;
+    std::string not_found_head_;
+    std::string not_found_length_;
+    std::string not_found_body_;
+
+    static void append_connection(const HttpRequest& request, std::string& out);
+    // a HEAD response ends at the blank line, its Content-Length still that of GET
+    static void append_body(const HttpRequest& request, std::string_view body, std::string& out);
+};
@@ -0,0 +1,131 @@
+#pragma once
+#include "common.hpp"
+
+// Slab arena: page-aligned 1MB pages carved into chunks of one size class each.
+// Classes grow by 1.25x so a value wastes at most ~20% of its chunk. A page
+// whose chunks are all free can be handed to another class, so a class that
+// starts late is not locked out once the memory limit is reached.
+class SlabArena {
+public:
+    static constexpr size_t kPageSize = 1024 * 1024;
+    static constexpr size_t kMinChunk = 64;
+    static constexpr uint8_t kNoClass = 0xFF;
+
+    explicit SlabArena(size_t memory_limit);
+    ~SlabArena();
+    SlabArena(const SlabArena&) = delete;
+    SlabArena& operator=(const SlabArena&) = delete;
+
+    // size class able to hold `size` bytes, or kNoClass if larger than a page
+    uint8_t class_for(size_t size) const;
+
+    // nullptr when the class has no free chunk, the memory limit is reached
+    // and no page is completely free
+    char* allocate(uint8_t size_class);
+    void release(char* chunk, uint8_t size_class);
+
+    size_t bytes_reserved() const { return pages_.size() * kPageSize; }
+    size_t bytes_in_use() const { return bytes_in_use_; }
+
+private:
+    struct Page {
+        char* memory;
+        uint8_t size_class;
+        uint32_t live = 0;     // chunks handed out
+    };
+
+    std::vector<size_t> chunk_sizes_;
+    std::vector<char*> free_lists_;   // intrusive: a free chunk stores the next pointer
+    std::vector<Page> pages_;
+    std::unordered_map<uintptr_t, uint32_t> page_index_;  // page address -> pages_ slot
+    size_t max_pages_;
+    size_t bytes_in_use_ = 0;
+
+    Page& page_of(char* chunk);
+    void carve(Page& page, uint8_t size_class);
+    bool reassign_empty_page(uint8_t size_class);
+};
+
+
+struct KvStats {
+    long long hits = 0;
+    long long misses = 0;
+    long long evictions = 0;
+    long long items = 0;
+    size_t bytes_in_use = 0;
+    size_t bytes_reserved = 0;
+};
+
+
+// One single-threaded cache partition: an open-addressing table with linear
+// probing and backward-shift deletion, values in a SlabArena, CLOCK eviction
+// once the arena hits its memory limit.
+class KvShard {
+public:
+    explicit KvShard(size_t memory_limit);
+
+    std::optional<std::string_view> get(std::string_view key, uint64_t hash, int64_t now);
+    // ttl_seconds == 0 never expires; false when the item cannot be stored
+    bool set(std::string_view key, std::string_view value, uint64_t hash, int64_t now, int64_t ttl_seconds);
+    bool del(std::string_view key, uint64_t hash);
+
+    void collect(KvStats& stats) const;
+
+private:
+    struct Slot {
+        uint64_t hash = 0;          // 0 marks an empty slot
+        char* item = nullptr;       // key bytes followed by value bytes
+        uint32_t key_len = 0;
+        uint32_t value_len = 0;
+        int64_t expires_at = 0;     // steady-clock seconds, 0 = never
+        uint8_t size_class = 0;
+        bool referenced = false;    // CLOCK bit, set on every hit
+    };
+
+    std::vector<Slot> slots_;
+    size_t mask_;
+    size_t size_ = 0;
+    size_t clock_hand_ = 0;
+    SlabArena arena_;
+    // written under the shard's owner or lock, read by the stats thread without
+    // it: relaxed atomics, with the sizes republished after each change
+    std::atomic<long long> hits_{0};
+    std::atomic<long long> misses_{0};
+    std::atomic<long long> evictions_{0};
+    std::atomic<long long> published_items_{0};
+    std::atomic<size_t> published_in_use_{0};
+    std::atomic<size_t> published_reserved_{0};
+
+    size_t find(std::string_view key, uint64_t hash) const;
+    void erase_at(size_t index);
+    char* allocate_evicting(uint8_t size_class, int64_t now);
+    bool evict_one(uint8_t size_class, int64_t now, bool any_class);
+    void grow();
+    void publish_sizes();
+};
+
+
+// Sharded cache. Event-loop backends own one unlocked shard per reactor;
+// the thread-per-connection backend stripes keys over mutex-guarded shards.
+class KvStore {
+public:
+    KvStore(size_t memory_limit, size_t lock_stripes);
+
+    // executes one protocol line and appends the reply (always '\n'-terminated)
+    void execute(std::string_view line, std::string& reply);
+
+    KvStats stats();
+
+private:
+    struct Shard {
+        std::mutex mtx;
+        KvShard data;
+        explicit Shard(size_t memory_limit) : data(memory_limit) {}
+    };
+    std::vector<std::unique_ptr<Shard>> shards_;
+    bool locked_;
+
+    Shard& shard_for(uint64_t hash) {
+        return *shards_[(hash >> 48) % shards_.size()];
+    }
+};
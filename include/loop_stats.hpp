@@ -0,0 +1,98 @@
+#pragma once
+#include "common.hpp"
+
+#include <array>
+#include <bit>
+
+// Log2 histogram shared by loop threads: bucket i counts values in
+// [2^(i-1), 2^i), bucket 0 counts zeros. Readers drain it per stats interval.
+class Log2Histogram {
+public:
+    static constexpr size_t kBuckets = 40;
+    using Snapshot = std::array<uint64_t, kBuckets>;
+
+    void record(uint64_t value) {
+        buckets_[std::min<size_t>(std::bit_width(value), kBuckets - 1)].fetch_add(1, std::memory_order_relaxed);
+    }
+    // returns the counts since the last drain and starts over
+    Snapshot drain();
+
+    static uint64_t count(const Snapshot& snapshot);
+    // upper bound of the bucket holding the given fraction of the values
+    static uint64_t percentile(const Snapshot& snapshot, double fraction);
+    // "p50<=a p99<=b max<=c"
+    static std::string summary(const Snapshot& snapshot);
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+};
+
+// How a backend's loops spend their time, filled by a LoopProbe per loop thread.
+struct LoopStats {
+    Log2Histogram events_per_wakeup;    // ready fds, CQEs reaped, or bytes-bearing recvs for bio
+    Log2Histogram iteration_us;         // wakeup until the loop waits again
+    Log2Histogram sqes_per_submit;      // io_uring only
+    std::atomic<uint64_t> blocked_ns{0};
+    std::atomic<uint64_t> busy_ns{0};
+    std::atomic<uint64_t> waits{0};     // wait syscalls: epoll_wait, poll, select, io_uring_enter
+    std::atomic<uint64_t> submits{0};   // io_uring_submit calls outside of a wait
+};
+
+// Brackets the blocking call of one loop thread. Costs two clock reads and a
+// few relaxed atomic adds per iteration.
+class LoopProbe {
+public:
+    // wait_is_syscall = false when the wait is the recv itself (bio), already counted as one
+    explicit LoopProbe(LoopStats& stats, bool wait_is_syscall = true)
+        : stats_(stats), wait_is_syscall_(wait_is_syscall) {}
+
+    void before_wait() {
+        int64_t now = now_ns();
+        if (woke_ns_ != 0) {
+            uint64_t busy = static_cast<uint64_t>(now - woke_ns_);
+            stats_.busy_ns.fetch_add(busy, std::memory_order_relaxed);
+            stats_.iteration_us.record(busy / 1000);
+            last_busy_ns_ = static_cast<int64_t>(busy);
+        }
+        wait_ns_ = now;
+    }
+
+    void after_wait(size_t events) {
+        woke_ns_ = now_ns();
+        stats_.blocked_ns.fetch_add(static_cast<uint64_t>(woke_ns_ - wait_ns_), std::memory_order_relaxed);
+        stats_.events_per_wakeup.record(events);
+        if (wait_is_syscall_) {
+            stats_.waits.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // separate_syscall = false for io_uring_submit_and_wait, counted as the wait
+    void submitted(size_t sqes, bool separate_syscall = true) {
+        stats_.sqes_per_submit.record(sqes);
+        if (separate_syscall) {
+            stats_.submits.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Upper bound on how long the events being handled now have waited: they
+    // may have become ready just after the previous iteration started, and
+    // this one has been running since the wakeup. Costs a clock read.
+    uint64_t lag_us() const {
+        if (woke_ns_ == 0) {
+            return 0;
+        }
+        return static_cast<uint64_t>(last_busy_ns_ + now_ns() - woke_ns_) / 1000;
+    }
+
+private:
+    LoopStats& stats_;
+    bool wait_is_syscall_;
+    int64_t wait_ns_ = 0;
+    int64_t woke_ns_ = 0;
+    int64_t last_busy_ns_ = 0;
+
+    static int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
@@ -0,0 +1,116 @@
+#pragma once
+#include "utils.hpp"
+
+#include <condition_variable>
+#include <functional>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+// One preallocated log file, mapped for its whole size. Records are
+// [u32 length][u32 crc32c of the payload][payload], back to back; the
+// first zero length (or a bad checksum, from a torn write) ends the segment.
+struct LogSegment {
+    static constexpr size_t kHeaderSize = 8;
+
+    std::string path;
+    uint64_t first_seq = 0;     // sequence number of its first record, also its file name
+    int fd = -1;
+    char* data = nullptr;
+    size_t size = 0;
+    size_t used = 0;            // bytes holding valid records
+
+    LogSegment() = default;
+    ~LogSegment();
+    LogSegment(const LogSegment&) = delete;
+    LogSegment& operator=(const LogSegment&) = delete;
+
+    // new file of `size` bytes, blocks allocated up front so appends never grow it
+    static std::shared_ptr<LogSegment> create(const std::string& dir, uint64_t first_seq, size_t size);
+    static std::shared_ptr<LogSegment> open(const std::string& path, uint64_t first_seq);
+
+    // walks the records from the start, sets `used`, returns how many are valid
+    uint64_t scan(const std::function<void(std::string_view)>& visit);
+    bool fits(size_t payload) const { return used + kHeaderSize + payload <= size; }
+    void append(std::string_view payload);
+};
+
+// Durable append-only log of every accepted message. The loop thread appends
+// into the mapped segment without a syscall; durability comes in batches
+// (group commit): one fdatasync per segment written since the last one covers
+// every message appended before it, across all connections. Replies wait for
+// durable() to reach the sequence number of their messages.
+//
+// The fsync is driven either by a syncer thread that signals an eventfd
+// (readiness backends) or by the caller itself, e.g. as IORING_OP_FSYNC, with
+// take_batch()/finish_batch().
+//
+// A failed fdatasync is final: the kernel may have dropped the dirty pages,
+// and a later fdatasync of the same file succeeds without them. durable()
+// stops where it is, append() refuses every further message, and the
+// backends close the connections whose replies wait for the log.
+class MessageLog {
+public:
+    MessageLog(std::string dir, size_t segment_size);
+    ~MessageLog();
+    MessageLog(const MessageLog&) = delete;
+    MessageLog& operator=(const MessageLog&) = delete;
+
+    // Maps the existing segments in order, hands every valid record to
+    // `replay` and positions the log after the last one. false on I/O errors.
+    bool open(const std::function<void(std::string_view)>& replay);
+    uint64_t recovered() const { return recovered_; }
+
+    // loop thread: false if a new segment could not be created, or once a sync failed
+    bool append(std::string_view message);
+    uint64_t appended() const { return appended_; }
+    uint64_t durable() const { return durable_.load(std::memory_order_acquire); }
+
+    // What one group commit has to sync: every segment written since the last batch.
+    struct SyncBatch {
+        uint64_t target = 0;    // durable() once the segments are synced
+        std::vector<std::shared_ptr<LogSegment>> segments;
+    };
+    // loop thread: false when nothing was appended since the last batch
+    bool take_batch(SyncBatch& batch);
+    // any thread, after fdatasync succeeded on every segment of the batch
+    void finish_batch(const SyncBatch& batch);
+    // any thread, after fdatasync failed on a segment of the batch
+    void fail_batch(const SyncBatch& batch);
+    // loop thread: a batch some of whose segments were never synced; they go
+    // into the next one, whose target covers this one's
+    void retry_batch(SyncBatch& batch);
+    bool failed() const { return failed_.load(std::memory_order_acquire); }
+
+    // Syncer thread for backends without an async fsync. request_sync() hands
+    // it everything appended so far; batches that pile up while a sync runs
+    // are merged into the next one. sync_event_fd() turns readable whenever
+    // durable() advances, and when a sync fails.
+    bool start_syncer();
+    void request_sync();
+    int sync_event_fd() const { return event_fd_.get(); }
+
+    uint64_t syncs() const { return syncs_.load(std::memory_order_relaxed); }
+
+private:
+    std::string dir_;
+    size_t segment_size_;
+    std::shared_ptr<LogSegment> current_;
+    std::vector<std::shared_ptr<LogSegment>> dirty_;   // rolled over with unsynced records
+    bool current_dirty_ = false;
+    uint64_t appended_ = 0;
+    uint64_t recovered_ = 0;
+    std::atomic<uint64_t> durable_{0};
+    std::atomic<uint64_t> syncs_{0};
+    std::atomic<bool> failed_{false};
+
+    // syncer thread state
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::vector<SyncBatch> requested_;
+    bool stopping_ = false;
+    std::thread syncer_;
+    SocketRAII event_fd_;
+
+    bool roll();
+    void sync_loop();
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include "utils.hpp"
+
+#include <functional>
+#include <semaphore>
+#include <sys/eventfd.h>
+
+// Intrusive multi-producer single-consumer queue (Vyukov). push is one atomic
+// exchange and never waits; pop belongs to the single consumer and may return
+// nullptr for a moment while a producer is between its two stores. Items from
+// one producer come out in the order they went in.
+template<typename Node>
+class MpscQueue {
+public:
+    MpscQueue() : head_(&stub_), tail_(&stub_) {}
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(Node* node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    Node* pop() {
+        Node* tail = tail_;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (next == nullptr) {
+                return nullptr;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next != nullptr) {
+            tail_ = next;
+            return tail;
+        }
+        if (tail != head_.load(std::memory_order_acquire)) {
+            return nullptr;     // a push is half done, its node shows up shortly
+        }
+        // tail is the last node: park the stub behind it so it can be handed out
+        push(&stub_);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next != nullptr) {
+            tail_ = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+private:
+    std::atomic<Node*> head_;   // producers
+    Node* tail_;                // consumer
+    Node stub_;
+};
+
+class OffloadCompletions;
+
+// The complete messages of one read, handled off the loop thread. The loop
+// fills `input` and the worker fills `output`; ownership moves with the job.
+struct OffloadJob {
+    std::atomic<OffloadJob*> next{nullptr};
+    int fd = -1;
+    uint64_t connection_id = 0;     // the fd may be reused by the time the job returns
+    bool shed = false;              // answer kBusyReply, decided by the loop at submit time
+    std::string input;
+    std::string output;
+    OffloadCompletions* completions = nullptr;
+};
+
+// One loop's return path: workers push finished jobs and the loop drains them
+// when its eventfd turns readable. The eventfd is written only when the queue
+// goes from drained to non-empty, so a burst of completions costs one wakeup.
+class OffloadCompletions {
+public:
+    OffloadCompletions();
+    OffloadCompletions(const OffloadCompletions&) = delete;
+    OffloadCompletions& operator=(const OffloadCompletions&) = delete;
+
+    // -1 if the eventfd could not be created
+    int event_fd() const { return event_fd_.get(); }
+
+    // loop thread: a job to fill, recycled from the ones that came back,
+    // and back with one that turned out to have nothing to submit
+    OffloadJob* acquire();
+    void release(OffloadJob* job);
+    // worker threads
+    void complete(OffloadJob* job);
+
+    // Loop thread, once event_fd() is readable (or its read completed on
+    // io_uring, with `counter_read` = true). Hands every finished job to
+    // `finish`, in completion order, then recycles it.
+    template<typename F>
+    void drain(F&& finish, bool counter_read = false) {
+        if (!counter_read) {
+            uint64_t count;
+            [[maybe_unused]] ssize_t n = ::read(event_fd_.get(), &count, sizeof(count));
+        }
+        // cleared before draining: a job completed from here on signals again
+        signalled_.exchange(false, std::memory_order_acq_rel);
+        while (OffloadJob* job = done_.pop()) {
+            finish(*job);
+            release(job);
+        }
+    }
+
+private:
+    MpscQueue<OffloadJob> done_;
+    std::atomic<bool> signalled_{false};
+    SocketRAII event_fd_;
+    std::vector<OffloadJob*> free_;                 // loop thread only
+    std::vector<std::unique_ptr<OffloadJob>> jobs_; // every job ever handed out
+};
+
+// Fixed set of worker threads, each fed through its own MPSC queue. A job goes
+// to the worker picked by its fd, so the jobs of one connection are handled
+// in order by one thread and come back in that order.
+class OffloadPool {
+public:
+    using Handler = std::function<void(OffloadJob& job)>;
+
+    OffloadPool(size_t workers, Handler handler);
+    ~OffloadPool();     // stops and joins the workers; queued jobs are dropped
+    OffloadPool(const OffloadPool&) = delete;
+    OffloadPool& operator=(const OffloadPool&) = delete;
+
+    void submit(OffloadJob* job);
+    size_t size() const { return workers_.size(); }
+
+private:
+    struct Worker {
+        MpscQueue<OffloadJob> queue;
+        std::counting_semaphore<> ready{0};  // one release per queued job
+        std::thread thread;
+    };
+
+    Handler handler_;
+    std::atomic<bool> stopping_{false};
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    void work(Worker& worker);
+};
@@ -0,0 +1,25 @@
+#pragma once
+#include "common.hpp"
+
+#include <sys/resource.h>
+
+// Ring size of the io_uring backends; the probe sets up a ring of the same size.
+inline constexpr unsigned kIOUringEntries = 2048;
+
+// What this kernel and process can do, found out by trying it.
+struct PlatformFeatures {
+    bool io_uring = false;          // a ring could be set up at all
+    bool sqpoll = false;            // ... with IORING_SETUP_SQPOLL (unprivileged since 5.11)
+    bool native_workers = false;    // IORING_FEAT_NATIVE_WORKERS: rings charged to memcg, not RLIMIT_MEMLOCK
+    bool core_ops = false;          // ACCEPT, RECV, SENDMSG, PROVIDE_BUFFERS: what IOUringServer needs
+    bool send_zc = false;
+    bool splice = false;
+    bool so_zerocopy = false;       // MSG_ZEROCOPY on TCP sockets
+    rlim_t nofile = 0;              // soft limits after raise_limits()
+    rlim_t memlock = 0;
+};
+
+// Raises the soft RLIMIT_NOFILE and RLIMIT_MEMLOCK to their hard limits, then
+// probes io_uring (setup flags and opcodes) and socket features.
+PlatformFeatures probe_platform();
+std::string describe(const PlatformFeatures& features);
@@ -0,0 +1,52 @@
+#pragma once
+#include "common.hpp"
+
+#include <functional>
+
+// A published message is formatted once and shared, immutable, by every
+// subscriber queue it lands on; the last queue to send it frees it.
+using SharedBuffer = std::shared_ptr<const std::string>;
+
+enum class Delivery {
+    Queued,     // appended to the subscriber's output queue
+    Dropped,    // subscriber queue full, message skipped for this subscriber
+    Overflow    // subscriber queue full, subscriber will be disconnected
+};
+
+struct PubSubStats {
+    long long published = 0;
+    long long delivered = 0;
+    long long dropped = 0;
+    long long disconnected = 0;
+};
+
+// Topic registry for the single-threaded event-loop backends. Delivery to a
+// subscriber is left to the backend, which owns the connection queues.
+class PubSubHub {
+public:
+    using Deliver = std::function<Delivery(int client_fd, const SharedBuffer& message)>;
+
+    explicit PubSubHub(Deliver deliver) : deliver_(std::move(deliver)) {}
+
+    // SUBSCRIBE <topic> | UNSUBSCRIBE <topic> | PUBLISH <topic> <payload>
+    void execute(int client_fd, std::string_view line, std::string& reply);
+    void remove_client(int client_fd);
+
+    // safe from the stats thread: the counters are relaxed atomics
+    PubSubStats stats() const {
+        return {published_.load(std::memory_order_relaxed), delivered_.load(std::memory_order_relaxed),
+                dropped_.load(std::memory_order_relaxed), disconnected_.load(std::memory_order_relaxed)};
+    }
+
+private:
+    Deliver deliver_;
+    std::unordered_map<std::string, std::vector<int>> subscribers_;   // topic -> fds
+    std::unordered_map<int, std::vector<std::string>> topics_;        // fd -> topics
+    // written only by the loop thread
+    std::atomic<long long> published_{0};
+    std::atomic<long long> delivered_{0};
+    std::atomic<long long> dropped_{0};
+    std::atomic<long long> disconnected_{0};
+
+    void unsubscribe(int client_fd, const std::string& topic);
+};
@@ -1,14 +1,190 @@
 #pragma once
 #include "utils.hpp"
+#include "buffer_pool.hpp"
+#include "kv_store.hpp"
+#include "pubsub.hpp"
+#include "coro.hpp"
+#include "udp.hpp"
+#include "trace.hpp"
+#include "loop_stats.hpp"
+#include "probe.hpp"
+#include "offload.hpp"
+#include "message_log.hpp"
+#include "capture.hpp"
+#include "http.hpp"
+#include "handoff.hpp"
+#include "static_files.hpp"
 
 #include <map>
 
 
+enum class Protocol { Echo, Kv, PubSub, Http };
+
+enum class Transport { Tcp, Udp };
+
+// What happens to a subscriber whose output queue is full when a message arrives.
+enum class SlowSubscriberPolicy { Drop, Disconnect };
+
+// Runtime knobs shared by every backend; filled in from the command line.
+struct ServerConfig {
+    // replies at least this large are sent with MSG_ZEROCOPY (epoll) or
+    // IORING_OP_SEND_ZC (io_uring); 0 keeps the plain copying send path
+    size_t zerocopy_threshold = 0;
+    // io_uring: ask for IORING_SETUP_SQPOLL first; auto clears it when the
+    // probe found it refused, so the server does not try it again
+    bool io_uring_sqpoll = true;
+    // a connection buffering more than this without a '\n' is dropped
+    size_t max_message_size = 16 * 1024 * 1024;
+    // bulk-stream mode: echo raw bytes through a per-connection pipe with
+    // splice(2) / IORING_OP_SPLICE instead of framing messages in user space
+    bool splice_echo = false;
+    // what each '\n'-terminated message means: echo it back, or a GET/SET/DEL cache
+    // command; Http frames HTTP/1.1 requests instead
+    Protocol protocol = Protocol::Echo;
+    // HTTP: answer with the request body (or target) instead of a fixed body
+    bool http_echo = false;
+    // HTTP: bytes of the fixed body, 0 for "Hello, World!"
+    size_t http_body = 0;
+    // HTTP: GET /<name> serves the file <name> of this directory (empty: off)
+    std::string static_dir;
+    // HTTP: copy static files into the reply with pread instead of sendfile/splice
+    bool static_copy = false;
+    size_t kv_memory_limit = 64 * 1024 * 1024;
+    // pub/sub: bytes a subscriber may have queued before the policy kicks in
+    size_t subscriber_queue_limit = 4 * 1024 * 1024;
+    SlowSubscriberPolicy slow_subscriber_policy = SlowSubscriberPolicy::Drop;
+    // UDP: one datagram in, one reply datagram out (epoll, io_uring)
+    Transport transport = Transport::Tcp;
+    // SO_REUSEPORT sockets, each served by its own loop thread
+    size_t udp_sockets = 1;
+    // receive coalesced with UDP_GRO, send equal-sized replies to a peer with UDP_SEGMENT
+    bool udp_gso = false;
+    // listen on this AF_UNIX path instead of a TCP port
+    std::string unix_path;
+    bool unix_seqpacket = false;
+    // listening socket passed in by a supervisor (TCP or AF_UNIX); overrides port and unix_path
+    int listen_fd = -1;
+    // SOCK_SEQPACKET: every send is one record, so replies leave in records of
+    // at most this many bytes, the size a receiver reads at once; 0 on streams
+    size_t max_record_size = 0;
+    // admission control: connections beyond this many are refused (0: no limit)
+    size_t max_connections = 0;
+    // while the loop runs more than this behind its events, new connections are
+    // refused and, with busy_reply, messages are answered kBusyReply (0: off)
+    uint64_t max_lag_us = 0;
+    // refused connections and shed messages get kBusyReply instead of silence
+    bool busy_reply = false;
+    // epoll: bytes read from one connection per loop iteration before the other
+    // ready connections get their turn; 0 reads until EAGAIN
+    size_t read_budget = 64 * 1024;
+    // epoll, io_uring: handle messages on this many worker threads instead of
+    // the loop thread (0: on the loop); one job per connection is out at a time
+    size_t offload_workers = 0;
+    // CPU every message burns before it is answered, a stand-in for compression,
+    // hashing or a slow lookup in a real handler
+    uint32_t handler_cost_us = 0;
+    // epoll, io_uring: every message is appended to a log in this directory and
+    // answered only once it is on disk (empty: no log)
+    std::string log_dir;
+    // bytes preallocated per log file; a full one is continued in a new file
+    size_t log_segment_size = 64 * 1024 * 1024;
+    // record every framed message, with its connection and arrival time, to
+    // this file for benchmark-client --replay (empty: no capture)
+    std::string capture_path;
+    // on stop, connections that are idle are closed spread over this long, and
+    // whatever is still open at the end is closed regardless
+    uint64_t drain_ms = 5000;
+    // pass the listener to a successor that connects to this AF_UNIX path, then drain
+    std::string handoff_path;
+    // take the listener over from the server waiting on this path
+    std::string takeover_path;
+};
+
+// Bytes moved per splice call, one default-sized pipe worth.
+inline constexpr size_t kSpliceChunk = 64 * 1024;
+
+// Cache shards guarded by their own mutex, for backends running several threads.
+inline constexpr size_t kKvLockStripes = 16;
+
+// Answer to work shed under overload, one line so pipelined clients stay in step.
+inline constexpr std::string_view kBusyReply = "BUSY\n";
+
+// Below this the page pinning and completion bookkeeping cost more than the memcpy.
+inline constexpr size_t kMinZerocopyThreshold = 4096;
+
+// How often a draining loop wakes to close another share of its idle connections.
+inline constexpr auto kDrainTick = std::chrono::milliseconds(100);
+
+// One loop's drain. Idle connections are closed one batch per tick, however
+// often the loop wakes, spread evenly up to the deadline so their clients
+// reconnect to the successor in a trickle rather than all at once. The first
+// batch waits a tick: a connection accepted just before the stop gets to send
+// its request first.
+struct DrainTimer {
+    std::chrono::steady_clock::time_point deadline;
+    std::chrono::steady_clock::time_point next_tick;
+
+    // how many of `idle` connections to close now
+    size_t quota(size_t idle){
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            return idle;
+        }
+        if (now < next_tick) {
+            return 0;
+        }
+        next_tick = now + kDrainTick;
+        size_t ticks = std::max<size_t>(1, static_cast<size_t>((deadline - now) / kDrainTick));
+        return (idle + ticks - 1) / ticks;
+    }
+
+    bool expired() const {
+        return std::chrono::steady_clock::now() >= deadline;
+    }
+};
+
 struct ServerStats {
     std::atomic<int> active_connections_{0};
     std::atomic<long long> total_messages_{0};
     std::atomic<bool> running_{false};
+    // set by the first stop(); loops then stop accepting and drain
+    std::atomic<bool> draining_{false};
+    // readable from the first stop() on, never reset: every loop watches it
+    SocketRAII stop_fd_{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)};
+    std::atomic<long long> zerocopy_sends_{0};
+    std::atomic<long long> zerocopy_copied_{0};
+    std::atomic<long long> spliced_bytes_{0};
+    std::atomic<long long> recv_calls_{0};
+    std::atomic<long long> send_calls_{0};
+    std::atomic<long long> datagrams_in_{0};
+    std::atomic<long long> datagrams_out_{0};
+    std::atomic<long long> shed_connections_{0};
+    std::atomic<long long> shed_messages_{0};
+    std::atomic<long long> budget_exhausted_{0};    // reads cut short by read_budget
+    std::atomic<long long> offloaded_jobs_{0};
+    LoopStats loop_stats_;
+    // probe of the single loop thread, whose lag admission control watches;
+    // null on backends with many loops (bio, udp), which only cap connections
+    const LoopProbe* loop_probe_ = nullptr;
+    // recv/send calls are SQEs, not syscalls (io_uring backends)
+    bool completion_io_ = false;
     std::thread stats_thread_;
+    std::mutex stats_mutex_;
+    std::condition_variable stats_wake_;    // ends the stats thread's wait at shutdown
+    ServerConfig config_;
+    std::unique_ptr<KvStore> kv_store_;
+    std::unique_ptr<PubSubHub> pubsub_;   // created by the backends that support fan-out
+    std::unique_ptr<OffloadPool> offload_; // created by the backends that support offload
+    std::unique_ptr<MessageLog> log_;       // opened by the backends that hold replies for it
+    std::unique_ptr<TrafficCapture> capture_;
+    std::unique_ptr<HttpResponder> http_;
+    std::unique_ptr<StaticFileCache> static_files_;
+    std::unique_ptr<HandoffServer> handoff_;
+    SocketRAII takeover_channel_;           // open until the predecessor is told we serve
+
+    void configure(const ServerConfig& config) {
+        config_ = config;
+    }
 
     std::atomic<int>& get_active_connections() {
         return active_connections_;
@@ -18,7 +194,319 @@ struct ServerStats {
         return total_messages_;
     }
 
-    std::optional<SocketRAII> init_socket(uint16_t port, std::string server_name){
+    void handle_message(std::string_view message, std::string& out, int client_fd){
+        if (config_.handler_cost_us > 0) [[unlikely]] {
+            burn_cpu(config_.handler_cost_us);
+        }
+        if (config_.protocol == Protocol::Kv) {
+            kv_store_->execute(message, out);
+        } else if (config_.protocol == Protocol::PubSub) {
+            pubsub_->execute(client_fd, message, out);
+        } else {
+            out += "Echo[";
+            out += std::to_string(total_messages_.load(std::memory_order_relaxed));
+            out += "]:";
+            out += message;
+        }
+        total_messages_++;
+    }
+
+    // Shared message path: frames the bytes just read behind the partial message
+    // held in `in` and appends the reply of every complete '\n'-terminated
+    // message to `out`. Only an unterminated tail is copied into `in`, so
+    // between messages a connection holds no input buffer. Returns false once
+    // `in` holds more than max_message_size bytes without a newline, or on a
+    // malformed HTTP request.
+    // Backends that pass `files` send static file bodies from the file itself:
+    // each entry belongs between the bytes of `out` before and after its `at`.
+    // `close_after` is set once `out` ends with a response that closes the
+    // connection; nothing more is read, and the backend closes it once sent.
+    bool process_input(PooledBuffer& in, std::string_view data, std::string& out, int client_fd,
+                       std::vector<FileSend>* files = nullptr, bool* close_after = nullptr){
+        bool shed = config_.busy_reply && overloaded();
+        if (config_.protocol == Protocol::Http) {
+            return process_http(in, data, out, client_fd, shed, files, close_after);
+        }
+        return frame_input(in, data, client_fd, [&](std::string_view messages) {
+            handle_messages(messages, out, client_fd, shed);
+        });
+    }
+
+    // The framing half of process_input: `complete` gets the run of complete
+    // messages, left for a worker to handle (or handed to it from process_input).
+    template<typename F>
+    bool frame_input(PooledBuffer& in, std::string_view data, int client_fd, F&& complete){
+        std::string_view pending = data;
+        if (!in.empty()) {
+            in.append(data);
+            pending = in.view();
+        }
+        size_t start = pending.rfind('\n') + 1;   // 0 when there is no newline
+        if (start > 0) {
+            if (log_ && !append_to_log(pending.substr(0, start))) {
+                return false;
+            }
+            if (capture_) [[unlikely]] {
+                capture_->record(client_fd, pending.substr(0, start));
+            }
+            complete(pending.substr(0, start));
+        }
+        if (in.empty()) {
+            in.append(pending.substr(start));
+        } else {
+            in.consume(start);
+        }
+        return in.size() <= config_.max_message_size;
+    }
+
+    // Answers a run of complete '\n'-terminated messages; with `shed` set each
+    // gets kBusyReply instead. Runs on the loop thread or an offload worker.
+    void handle_messages(std::string_view messages, std::string& out, int client_fd, bool shed){
+        size_t start = 0;
+        size_t end;
+        while ((end = messages.find('\n', start)) != std::string_view::npos) {
+            std::string_view message = messages.substr(start, end + 1 - start);
+            if (shed) [[unlikely]] {
+                out += kBusyReply;
+                shed_messages_.fetch_add(1, std::memory_order_relaxed);
+            } else if (Tracer::enabled()) [[unlikely]] {
+                uint64_t trace_id = Tracer::begin_message(client_fd);
+                handle_message(message, out, client_fd);
+                Tracer::end_message(trace_id, client_fd);
+            } else {
+                handle_message(message, out, client_fd);
+            }
+            start = end + 1;
+        }
+    }
+
+    // HTTP/1.1 framing: a request ends after its header block and Content-Length
+    // bytes of body rather than at '\n'. Pipelined requests are answered in
+    // order, and a partial one is held in `in` like a partial message. A
+    // request without keep-alive gets "Connection: close" and is the last one
+    // answered: whatever follows it is dropped and `close_after` set. Returns
+    // false on a malformed request.
+    bool process_http(PooledBuffer& in, std::string_view data, std::string& out, int client_fd, bool shed,
+                      std::vector<FileSend>* files, bool* close_after){
+        std::string_view pending = data;
+        if (!in.empty()) {
+            in.append(data);
+            pending = in.view();
+        }
+        size_t start = 0;
+        HttpRequest request;
+        while (start < pending.size()) {
+            HttpParse parsed = parse_http_request(pending.substr(start), request);
+            if (parsed == HttpParse::Invalid) {
+                return false;
+            }
+            if (parsed == HttpParse::Incomplete) {
+                break;
+            }
+            if (stop_requested()) {
+                // a draining server answers one more request per connection
+                request.keep_alive = false;
+            }
+            if (!handle_http_request(request, out, client_fd, shed, files)) {
+                return false;
+            }
+            start += request.size;
+            if (!request.keep_alive) {
+                if (close_after) {
+                    *close_after = true;
+                }
+                in.clear();
+                return true;
+            }
+        }
+        if (in.empty()) {
+            in.append(pending.substr(start));
+        } else {
+            in.consume(start);
+        }
+        return in.size() <= config_.max_message_size;
+    }
+
+    bool handle_http_request(const HttpRequest& request, std::string& out, int client_fd, bool shed,
+                             std::vector<FileSend>* files){
+        if (shed) [[unlikely]] {
+            http_->respond_busy(request, out);
+            shed_messages_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        if (Tracer::enabled()) [[unlikely]] {
+            uint64_t trace_id = Tracer::begin_message(client_fd);
+            bool answered = answer_http_request(request, out, files);
+            Tracer::end_message(trace_id, client_fd);
+            return answered;
+        }
+        return answer_http_request(request, out, files);
+    }
+
+    bool answer_http_request(const HttpRequest& request, std::string& out, std::vector<FileSend>* files){
+        if (config_.handler_cost_us > 0) [[unlikely]] {
+            burn_cpu(config_.handler_cost_us);
+        }
+        total_messages_++;
+        if (static_files_) {
+            return serve_static(request, out, files);
+        }
+        http_->respond(request, out);
+        return true;
+    }
+
+    // GET and HEAD of a file from the static directory. Its body is left to
+    // the backend as a FileSend, or copied in with pread when the backend
+    // passed no `files` or static_copy is set. False if the file came up
+    // short, i.e. was truncated since it was opened.
+    bool serve_static(const HttpRequest& request, std::string& out, std::vector<FileSend>* files){
+        auto file = static_files_->lookup(request.target);
+        if (!file) {
+            http_->respond_not_found(request, out);
+            return true;
+        }
+        http_->respond_file(request, file->headers, out);
+        if (request.method == "HEAD" || file->size == 0) {
+            return true;
+        }
+        if (files && !config_.static_copy) {
+            files->push_back({out.size(), std::move(file)});
+            return true;
+        }
+        size_t body = out.size();
+        out.resize(body + file->size);
+        size_t copied = 0;
+        while (copied < file->size) {
+            ssize_t n = ::pread(file->fd.get(), out.data() + body + copied, file->size - copied,
+                                static_cast<off_t>(copied));
+            if (n <= 0) {
+                if (n == -1 && errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            copied += n;
+        }
+        return true;
+    }
+
+    // Bytes per sendfile(2) call: a pipe's worth, as sendfile sends all but the
+    // end of a call with MSG_MORE, and a call cut short by a full socket
+    // buffer leaves that tail corked until the peer's delayed ACK.
+    size_t sendfile_chunk() const {
+        return config_.max_record_size > 0 ? std::min(config_.max_record_size, kSpliceChunk) : kSpliceChunk;
+    }
+
+    // Blocking sends of a reply with static file bodies in between (bio, select,
+    // poll): bytes with send, each body with sendfile straight from its file.
+    // The bytes ahead of a body carry MSG_MORE, or Nagle holds the body back
+    // until the peer's delayed ACK of the headers.
+    bool send_reply(int fd, std::string_view reply, std::vector<FileSend>& files){
+        size_t sent = 0;
+        for (const FileSend& file : files) {
+            if (!send_all(fd, reply.substr(sent, file.at - sent), config_.max_record_size, MSG_MORE) ||
+                !sendfile_all(fd, file.file->fd.get(), file.file->size, sendfile_chunk())) {
+                return false;
+            }
+            spliced_bytes_ += file.file->size;
+            sent = file.at;
+        }
+        return send_all(fd, reply.substr(sent), config_.max_record_size);
+    }
+
+    // Logs each message of a run of complete ones, on the loop thread.
+    bool append_to_log(std::string_view messages){
+        size_t start = 0;
+        size_t end;
+        while ((end = messages.find('\n', start)) != std::string_view::npos) {
+            if (!log_->append(messages.substr(start, end + 1 - start))) {
+                return false;
+            }
+            start = end + 1;
+        }
+        return true;
+    }
+
+    // Opens the log in config_.log_dir and replays it: the cache gets every
+    // logged write again, and the message count carries on where it stopped.
+    bool open_log(){
+        log_ = std::make_unique<MessageLog>(config_.log_dir, config_.log_segment_size);
+        std::string ignored;
+        bool opened = log_->open([this, &ignored](std::string_view message) {
+            std::string_view rest = message;
+            if (kv_store_ && !equals_ignore_case(next_token(rest), "GET")) {
+                kv_store_->execute(message, ignored);
+                ignored.clear();
+            }
+        });
+        if (!opened) {
+            Logger::error("Failed to open the message log in ", config_.log_dir);
+            log_.reset();
+            return false;
+        }
+        total_messages_ = static_cast<long long>(log_->recovered());
+        Logger::info("Message log in ", config_.log_dir, ", ", log_->recovered(), " messages recovered");
+        return true;
+    }
+
+    // Worker threads that run handle_messages for offloaded jobs.
+    void start_offload(){
+        offload_ = std::make_unique<OffloadPool>(config_.offload_workers, [this](OffloadJob& job) {
+            handle_messages(job.input, job.output, job.fd, job.shed);
+        });
+        Logger::info("Handling messages on ", config_.offload_workers, " offload workers");
+    }
+
+    // True while the loop lags further behind its events than max_lag_us.
+    bool overloaded() const {
+        return config_.max_lag_us > 0 && loop_probe_ && loop_probe_->lag_us() > config_.max_lag_us;
+    }
+
+    // Admission control for a freshly accepted socket. Past max_connections,
+    // or while the loop is overloaded, the socket is closed right away (after
+    // kBusyReply if asked for), which keeps the queued work it would add away
+    // from the connections already being served. Returns false if it was refused.
+    bool admit_connection(int client_fd){
+        bool full = config_.max_connections > 0 &&
+                    static_cast<size_t>(active_connections_.load(std::memory_order_relaxed)) >= config_.max_connections;
+        if (!full && !overloaded()) {
+            if (capture_) {
+                capture_->open_connection(client_fd);
+            }
+            return true;
+        }
+        if (config_.busy_reply) {
+            ::send(client_fd, kBusyReply.data(), kBusyReply.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+        ::close(client_fd);
+        shed_connections_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // kv_lock_stripes == 0: one unlocked shard owned by the event loop,
+    // otherwise that many mutex-guarded shards for thread-per-connection
+    std::optional<SocketRAII> init_socket(uint16_t port, std::string server_name, size_t kv_lock_stripes = 0){
+        std::string endpoint;
+        if (!config_.takeover_path.empty()) {
+            auto listener = take_over_listener(config_.takeover_path, takeover_channel_);
+            if (!listener.has_value()) {
+                return std::nullopt;
+            }
+            config_.listen_fd = *listener;
+            endpoint = "listener taken over from " + config_.takeover_path;
+        } else if (config_.listen_fd >= 0) {
+            endpoint = "inherited fd " + std::to_string(config_.listen_fd);
+        } else if (!config_.unix_path.empty()) {
+            endpoint = "unix:" + config_.unix_path;
+        }
+        if (!endpoint.empty()) {
+            auto server_fd = config_.listen_fd >= 0 ? adopt_listener(config_.listen_fd) : open_unix_listener();
+            if (!server_fd.has_value() || !start_service(endpoint, server_name, kv_lock_stripes, server_fd->get())) {
+                return std::nullopt;
+            }
+            return server_fd;
+        }
+
         SocketRAII server_fd(socket(AF_INET, SOCK_STREAM, 0));
         if (server_fd.get() == -1) {
                 Logger::error("Failed to create socket");
@@ -44,21 +532,320 @@ struct ServerStats {
             return std::nullopt;
         }
 
-        Logger::info(server_name, " started on port ", port);
+        if (!start_service("port " + std::to_string(port), server_name, kv_lock_stripes, server_fd.get())) {
+            return std::nullopt;
+        }
+        return server_fd;
+    }
+
+    std::optional<SocketRAII> open_unix_listener(){
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (config_.unix_path.size() >= sizeof(addr.sun_path)) {
+            Logger::error("Unix socket path too long: ", config_.unix_path);
+            return std::nullopt;
+        }
+        std::memcpy(addr.sun_path, config_.unix_path.c_str(), config_.unix_path.size() + 1);
+
+        int type = config_.unix_seqpacket ? SOCK_SEQPACKET : SOCK_STREAM;
+        SocketRAII server_fd(socket(AF_UNIX, type | SOCK_CLOEXEC, 0));
+        if (server_fd.get() == -1) {
+            Logger::error("Failed to create unix socket");
+            return std::nullopt;
+        }
+        // a socket file left behind by a previous run would make bind fail
+        struct stat st;
+        if (::stat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            ::unlink(addr.sun_path);
+        }
+        if (::bind(server_fd.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+            Logger::error("Failed to bind unix socket ", config_.unix_path, ": ", strerror(errno));
+            return std::nullopt;
+        }
+        if (::listen(server_fd.get(), SOMAXCONN) == -1) {
+            Logger::error("Failed to listen");
+            return std::nullopt;
+        }
+        adapt_to_listener(AF_UNIX, type);
+        return server_fd;
+    }
+
+    // A supervisor bound (and maybe already listened on) the socket; we only
+    // learn its family and type to pick the matching send path.
+    std::optional<SocketRAII> adopt_listener(int fd){
+        int domain = 0;
+        int type = 0;
+        int listening = 0;
+        socklen_t len = sizeof(int);
+        if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len) == -1 ||
+            getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == -1 ||
+            getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) == -1) {
+            Logger::error("Inherited fd ", fd, " is not a socket");
+            return std::nullopt;
+        }
+        if (type != SOCK_STREAM && type != SOCK_SEQPACKET) {
+            Logger::error("Inherited fd ", fd, " is not a stream or seqpacket socket");
+            return std::nullopt;
+        }
+        if (!listening && ::listen(fd, SOMAXCONN) == -1) {
+            Logger::error("Failed to listen on inherited fd ", fd);
+            return std::nullopt;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        adapt_to_listener(domain, type);
+        return SocketRAII(fd);
+    }
+
+    // Features that only exist on TCP are switched off for AF_UNIX listeners.
+    void adapt_to_listener(int domain, int type){
+        if (domain == AF_UNIX && config_.zerocopy_threshold > 0) {
+            Logger::info("MSG_ZEROCOPY is not available on unix sockets, using plain sends");
+            config_.zerocopy_threshold = 0;
+        }
+        if (type == SOCK_SEQPACKET) {
+            config_.max_record_size = kReadChunk;
+            if (config_.splice_echo) {
+                Logger::info("--splice needs a byte stream, using the message path");
+                config_.splice_echo = false;
+            }
+        }
+    }
+
+    // Datagram socket bound with SO_REUSEPORT: every loop thread owns one and
+    // the kernel spreads peers across them by address hash.
+    std::optional<SocketRAII> open_udp_socket(uint16_t port){
+        SocketRAII socket_fd(socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+        if (socket_fd.get() == -1) {
+            Logger::error("Failed to create UDP socket");
+            return std::nullopt;
+        }
+        int one = 1;
+        if (setsockopt(socket_fd.get(), SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) {
+            Logger::error("Failed to set reuseport");
+            return std::nullopt;
+        }
+        if (config_.udp_gso && setsockopt(socket_fd.get(), SOL_UDP, UDP_GRO, &one, sizeof(one)) == -1) {
+            Logger::info("UDP_GRO not supported, receiving datagrams one by one");
+        }
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = INADDR_ANY;
+        if (::bind(socket_fd.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+            Logger::error("Failed to bind UDP socket");
+            return std::nullopt;
+        }
+        return socket_fd;
+    }
+
+    // Shared by every transport once the sockets are bound: cache, message log,
+    // running flag, stats thread, and the handoff of `listener` (-1: none) to a
+    // successor. Returns false if the log could not be opened.
+    bool start_service(const std::string& endpoint, const std::string& server_name, size_t kv_lock_stripes,
+                       int listener = -1){
+        if (config_.protocol == Protocol::Kv) {
+            kv_store_ = std::make_unique<KvStore>(config_.kv_memory_limit, kv_lock_stripes);
+        } else if (config_.protocol == Protocol::Http) {
+            http_ = std::make_unique<HttpResponder>(config_.http_echo, config_.http_body);
+            if (!config_.static_dir.empty()) {
+                static_files_ = std::make_unique<StaticFileCache>(config_.static_dir);
+                if (!static_files_->open()) {
+                    static_files_.reset();
+                    return false;
+                }
+                Logger::info("Serving static files from ", config_.static_dir,
+                             config_.static_copy ? " with pread+send" : "");
+            }
+        }
+        if (!config_.log_dir.empty() && !open_log()) {
+            return false;
+        }
+        if (!config_.capture_path.empty()) {
+            capture_ = std::make_unique<TrafficCapture>();
+            if (!capture_->open(config_.capture_path)) {
+                capture_.reset();
+                return false;
+            }
+            Logger::info("Capturing messages to ", config_.capture_path);
+        }
+
+        Logger::info(server_name, " started on ", endpoint);
         running_ = true;
+        // the listener is already accepting here, and the loop picks it up next
+        if (takeover_channel_.get() != -1 && confirm_takeover(takeover_channel_)) {
+            Logger::info("Took over from the server on ", config_.takeover_path);
+        }
+        if (!config_.handoff_path.empty() && listener != -1) {
+            handoff_ = std::make_unique<HandoffServer>();
+            if (!handoff_->start(config_.handoff_path, listener, [this] { stop(); })) {
+                handoff_.reset();
+            }
+        }
 
         // statstics
         stats_thread_ = std::thread([this, server_name]() {
+            long long last_messages = 0;
+            long long last_io_calls = 0;
+            std::unique_lock<std::mutex> lock(stats_mutex_);
             while(running_) {
-                std::this_thread::sleep_for(std::chrono::seconds(5));
+                if (stats_wake_.wait_for(lock, std::chrono::seconds(5), [this] { return !running_; })) {
+                    break;
+                }
                 print_stats(server_name, active_connections_, total_messages_);
+                print_loop_stats(server_name, last_messages, last_io_calls);
+                if (long long messages = total_messages_.load(); messages > 0) {
+                    Logger::info(server_name, " - calls per message - recv: ",
+                                 static_cast<double>(recv_calls_.load()) / messages,
+                                 " - send: ", static_cast<double>(send_calls_.load()) / messages);
+                }
+                if (config_.zerocopy_threshold > 0) {
+                    Logger::info(server_name, " - zerocopy sends: ", zerocopy_sends_.load(),
+                                 " - copied by kernel: ", zerocopy_copied_.load());
+                }
+                if (config_.splice_echo) {
+                    Logger::info(server_name, " - spliced bytes: ", spliced_bytes_.load());
+                }
+                if (static_files_) {
+                    StaticFileStats files = static_files_->stats();
+                    Logger::info(server_name, " - static files open: ", files.files, " - hits: ", files.hits,
+                                 " - opens: ", files.opens, " - invalidations: ", files.invalidations,
+                                 " - bytes sent without copying: ", spliced_bytes_.load());
+                }
+                if (kv_store_) {
+                    KvStats kv = kv_store_->stats();
+                    Logger::info(server_name, " - kv items: ", kv.items, " - hits: ", kv.hits,
+                                 " - misses: ", kv.misses, " - evictions: ", kv.evictions,
+                                 " - arena bytes in use/reserved: ", kv.bytes_in_use, "/", kv.bytes_reserved);
+                }
+                BufferPoolStats pool = BufferPool::stats();
+                Logger::info(server_name, " - buffer pool bytes in use: ", pool.bytes_in_use,
+                             " - cached: ", pool.bytes_cached);
+                if (pubsub_) {
+                    PubSubStats ps = pubsub_->stats();
+                    Logger::info(server_name, " - published: ", ps.published, " - delivered: ", ps.delivered,
+                                 " - dropped: ", ps.dropped, " - slow subscribers disconnected: ", ps.disconnected);
+                }
+                if (log_) {
+                    uint64_t syncs = log_->syncs();
+                    uint64_t synced = log_->durable() - log_->recovered();
+                    Logger::info(server_name, " - logged messages durable: ", log_->durable(),
+                                 " - syncs: ", syncs, " - messages per sync: ", std::fixed, std::setprecision(1),
+                                 syncs > 0 ? static_cast<double>(synced) / syncs : 0.0);
+                }
+                if (capture_) {
+                    Logger::info(server_name, " - captured messages: ", capture_->records(),
+                                 " - bytes written: ", capture_->bytes_written(), " - dropped: ", capture_->dropped());
+                }
+                // not offload_: the loop may still be creating it
+                if (config_.offload_workers > 0 && !config_.splice_echo) {
+                    Logger::info(server_name, " - offloaded jobs: ", offloaded_jobs_.load());
+                }
+                if (long long exhausted = budget_exhausted_.load(); exhausted > 0) {
+                    Logger::info(server_name, " - reads cut short by the read budget: ", exhausted);
+                }
+                if (config_.max_connections > 0 || config_.max_lag_us > 0) {
+                    Logger::info(server_name, " - shed connections: ", shed_connections_.load(),
+                                 " - shed messages: ", shed_messages_.load());
+                }
+                if (config_.transport == Transport::Udp) {
+                    Logger::info(server_name, " - datagrams in: ", datagrams_in_.load(),
+                                 " - out: ", datagrams_out_.load());
+                }
             }
         });
-        return server_fd;
+        return true;
+    }
+
+    // Undoes start_service once the loops returned: wakes the stats thread
+    // instead of letting it finish its sleep, and stops waiting for a successor.
+    void stop_service(){
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            running_ = false;
+        }
+        stats_wake_.notify_all();
+        if (stats_thread_.joinable()) {
+            stats_thread_.join();
+        }
+        handoff_.reset();
     }
 
+    // Loop behaviour over the last stats interval. Syscalls count waits, explicit
+    // submits and, on readiness backends, every recv and send.
+    void print_loop_stats(const std::string& server_name, long long& last_messages, long long& last_io_calls){
+        auto events = loop_stats_.events_per_wakeup.drain();
+        auto iterations = loop_stats_.iteration_us.drain();
+        auto sqes = loop_stats_.sqes_per_submit.drain();
+        uint64_t blocked = loop_stats_.blocked_ns.exchange(0, std::memory_order_relaxed);
+        uint64_t busy = loop_stats_.busy_ns.exchange(0, std::memory_order_relaxed);
+        uint64_t syscalls = loop_stats_.waits.exchange(0, std::memory_order_relaxed) +
+                            loop_stats_.submits.exchange(0, std::memory_order_relaxed);
+        long long io_calls = recv_calls_.load() + send_calls_.load();
+        if (!completion_io_) {
+            syscalls += io_calls - last_io_calls;
+        }
+        last_io_calls = io_calls;
+        long long messages = total_messages_.load() - last_messages;
+        last_messages += messages;
+        if (Log2Histogram::count(events) == 0) {
+            return;
+        }
+        Logger::info(server_name, " - events/wakeup: ", Log2Histogram::summary(events),
+                     " - iteration us: ", Log2Histogram::summary(iterations),
+                     " - busy: ", std::fixed, std::setprecision(1),
+                     blocked + busy > 0 ? busy * 100.0 / (blocked + busy) : 0.0, "%",
+                     " - syscalls/message: ", std::setprecision(3),
+                     messages > 0 ? static_cast<double>(syscalls) / messages : 0.0);
+        if (Log2Histogram::count(sqes) > 0) {
+            Logger::info(server_name, " - sqes/submit: ", Log2Histogram::summary(sqes));
+        }
+    }
+
+    // A datagram is a self-contained batch of messages; its last message may
+    // omit the '\n'. Nothing carries over to the next datagram.
+    void process_datagram(std::string_view data, std::string& out, int socket_fd){
+        PooledBuffer tail;
+        process_input(tail, data, out, socket_fd);
+        if (!tail.empty()) {
+            process_input(tail, "\n", out, socket_fd);
+        }
+        datagrams_in_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Every datagram in a received slot (several when UDP_GRO coalesced them),
+    // each reply queued for the peer it came from.
+    void process_datagrams(const UdpRecvBatch& batch, size_t slot, size_t length, UdpReplies& replies, int socket_fd){
+        std::string_view data = batch.data(slot, length);
+        size_t segment = batch.gro_size(slot);
+        if (segment == 0) {
+            segment = data.size();
+        }
+        for (size_t offset = 0; offset < data.size(); offset += segment) {
+            size_t start = replies.buffer().size();
+            process_datagram(data.substr(offset, segment), replies.buffer(), socket_fd);
+            replies.add(batch.peer(slot), batch.peer_length(slot), start);
+        }
+    }
+
+    // Called from the signal thread or the handoff thread, never from a signal
+    // handler. The first call makes every loop stop accepting and drain for up
+    // to drain_ms; another one (a second Ctrl-C) ends them at their next wakeup.
     void stop(){
-        running_ = false;
+        if (draining_.exchange(true)) {
+            running_ = false;
+        }
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t n = ::write(stop_fd_.get(), &one, sizeof(one));
+    }
+
+    bool stop_requested() const {
+        return draining_.load(std::memory_order_relaxed);
+    }
+
+    DrainTimer start_drain() const {
+        auto now = std::chrono::steady_clock::now();
+        return {now + std::chrono::milliseconds(config_.drain_ms), now + kDrainTick};
     }
 };
 
@@ -70,7 +857,16 @@ public:
 
     void run(uint16_t port);
 private:
+    // what drain() needs to know of a connection's thread
+    struct ClientState {
+        int fd;
+        std::atomic<bool> idle{false};  // blocked in recv with no partial message
+    };
+    std::mutex clients_mutex_;
+    std::unordered_map<int, ClientState*> clients_;
+
     void handle_client(int client_fd);
+    void drain();
 };
 
 class SelectServer: public ServerStats{
@@ -81,6 +877,9 @@ public:
 
     void run(uint16_t port);
 private:
+    std::map<int, PooledBuffer> pending_input_; // partial messages per client
+    std::string reply_;                         // replies of the current read, reused
+    std::vector<FileSend> file_sends_;          // static file bodies between its bytes
     bool handle_client_data(int client_fd);
 };
 
@@ -92,6 +891,9 @@ public:
 
     void run(uint16_t port);
 private:
+    std::map<int, PooledBuffer> pending_input_; // partial messages per client
+    std::string reply_;                         // replies of the current read, reused
+    std::vector<FileSend> file_sends_;          // static file bodies between its bytes
     bool handle_client_data(int client_fd);
 };
 
@@ -106,8 +908,83 @@ public:
     void run(uint16_t port);
 
 private:
-    bool handle_client_data(int client_fd);
+    struct OutChunk {
+        PooledBuffer data;      // unsent reply owned by this connection
+        SharedBuffer shared;    // or a fan-out message shared with other subscribers
+        std::shared_ptr<const StaticFile> file; // or a static file body, sent with sendfile
+        size_t offset = 0;
+        bool zerocopy = false;
+        uint64_t log_seq = 0;   // sent once the message log is durable up to here
+
+        std::string_view bytes() const {
+            return shared ? std::string_view(*shared) : data.view();
+        }
+    };
+
+    struct Connection {
+        int fd;
+        uint64_t id = 0;            // tells an offload job's connection from a later one on the same fd
+        bool zerocopy;              // SO_ZEROCOPY was accepted for this socket
+        uint32_t zc_next_seq = 0;   // id the kernel gives the next MSG_ZEROCOPY send
+        PooledBuffer in;            // received bytes not yet terminated by '\n'
+        std::deque<OutChunk> out;   // replies waiting for the socket to drain
+        size_t out_bytes = 0;       // unsent bytes in `out`
+        bool flush_pending = false; // output queued, listed in pending_flush_
+        bool ready_listed = false;  // unread input left by the budget, listed in ready_
+        bool offloading = false;    // a job with this connection's messages is with the workers
+        bool read_paused = false;   // input left unread until that job is back
+        bool read_closed = false;   // peer closed meanwhile, closed once the job is back
+        bool held_listed = false;   // a reply waits for the log, listed in held_
+        bool overflowed = false;    // slow subscriber, closed after this event
+        bool closing = false;       // closed, the socket kept until zc_pinned drains
+        bool last_reply = false;    // answered a Connection: close request, closed once `out` is sent
+        // fully sent MSG_ZEROCOPY replies, tagged with the id of their last send;
+        // released once the error queue reports that id as completed
+        std::deque<std::pair<uint32_t, OutChunk>> zc_pinned;
+        // splice mode: socket -> pipe -> socket, pipe_bytes not yet written back
+        SocketRAII pipe_rd;
+        SocketRAII pipe_wr;
+        size_t pipe_bytes = 0;
+
+        Connection(int fd, bool zerocopy) : fd(fd), zerocopy(zerocopy) {}
+    };
+
+    std::map<int, std::unique_ptr<Connection>> connections_;
+    // bytes gathered into one sendmsg; more chunks than this take another call
+    static constexpr size_t kMaxIov = 64;
+
+    std::vector<int> pending_flush_;    // connections with output queued this batch
+    std::vector<int> flushing_;
+    // connections that used up their read budget with input still queued; the
+    // edge was consumed, so they get another turn each iteration until EAGAIN
+    std::vector<int> ready_;
+    std::vector<int> serving_;
+    std::string reply_;                 // replies of the current read, reused
+    std::vector<FileSend> file_sends_;  // static file bodies between its bytes
+    std::unique_ptr<OffloadCompletions> completions_;
+    uint64_t next_connection_id_ = 0;
+    std::vector<int> held_;             // connections with replies waiting for a log sync
+
+    bool handle_client_data(Connection* conn);
+    void queue_reply(Connection* conn, std::string_view reply, const std::vector<FileSend>* files = nullptr);
+    void pin_partial_zerocopy(Connection* conn, bool keep_rest);
+    void submit_offload(Connection* conn, OffloadJob* job);
+    void finish_offload(int epoll_fd, OffloadJob& job);
+    void serve_ready(int epoll_fd);
+    bool drain_idle(int epoll_fd, DrainTimer& drain);
+    void release_held();
+    Delivery deliver_fanout(int client_fd, const SharedBuffer& message);
+    void schedule_flush(Connection* conn);
+    void flush_pending(int epoll_fd);
+    bool relay_spliced(Connection* conn);
+    bool flush_output(Connection* conn);
+    bool send_file_chunk(Connection* conn);
+    void handle_zerocopy_completions(Connection* conn);
     void handle_new_connection(int epoll_fd, int server_fd);
+    void close_connection(int epoll_fd, int client_fd);
+    void run_udp(uint16_t port);
+    void udp_loop(int socket_fd);
+    void send_udp_replies(int socket_fd, UdpReplies& replies);
 };
 
 
@@ -119,33 +996,128 @@ public:
 
     void run(uint16_t port);
 private:
+    // recvs pick one of these buffers when data arrives (IOSQE_BUFFER_SELECT),
+    // so an idle connection waiting in recv holds no memory of its own
+    static constexpr unsigned kRecvBufferCount = 256;
+    static constexpr uint16_t kRecvBufferGroup = 1;
+    // buffers gathered into one sendmsg; kept small, the iovecs live in every context
+    static constexpr size_t kMaxIov = 16;
+
     struct ClientContext{
         int client_fd;
-        char buffer[1024];
-        size_t buffer_size;
+        uint64_t id = 0;            // tells an offload job's connection from a later one on the same fd
+        bool offloading = false;    // a job with its messages is with the workers, recv not armed
         bool is_writing;
         bool is_reading;
+        bool is_closing = false;    // waiting for outstanding zerocopy notifications
+        bool last_reply = false;    // answered a Connection: close request, closed instead of read again
+        PooledBuffer in;            // received bytes not yet terminated by '\n'
+        PooledBuffer out;           // replies of the current batch
+        size_t out_offset = 0;      // sent bytes of zc_out / out
+        size_t fanout_offset = 0;   // sent bytes of fanout.front()
+        // scatter list of the in-flight IORING_OP_SENDMSG
+        msghdr send_msg{};
+        iovec send_iov[kMaxIov];
+        // reply handed to IORING_OP_SEND_ZC; it must outlive every notification
+        SharedBuffer zc_out;
+        // one entry per SEND_ZC that still owes an IORING_CQE_F_NOTIF completion
+        std::deque<SharedBuffer> zc_pinned;
+        // pub/sub messages queued behind `out`, shared with other subscribers
+        std::deque<SharedBuffer> fanout;
+        size_t fanout_bytes = 0;
+        bool sending_fanout = false; // the in-flight send has no own replies, only fan-out
+        bool flush_pending = false;  // output queued, listed in pending_flush_
+        bool held_listed = false;    // own replies wait for the log, listed in held_
+        uint64_t out_seq = 0;        // `out` is sent once the message log is durable up to here
+        bool overflowed = false;     // slow subscriber, closed after this completion
+        // splice mode: socket -> pipe -> socket, pipe_bytes not yet written back
+        SocketRAII pipe_rd;
+        SocketRAII pipe_wr;
+        size_t pipe_bytes = 0;
+        bool wait_writable = false; // last splice to the socket hit EAGAIN
+        // static file bodies inside `out` (`at` counts from its start); each goes
+        // file -> pipe -> socket through the same pipe once `out` is sent up to it
+        std::deque<FileSend> files;
+        bool sending_file = false;  // the in-flight write is a file's pipe -> socket splice
 
         ClientContext(int fd) : client_fd(fd), is_writing(false), is_reading(false) {}
     };
     
     SocketRAII server_fd_;  
     struct io_uring ring_;
+    bool zerocopy_supported_ = true;
+    std::vector<char*> recv_buffers_;   // indexed by buffer id, kReadChunk bytes each
+    std::string reply_;                 // replies of the current completion, reused
+    std::vector<FileSend> file_sends_;  // static file bodies between its bytes
+    std::vector<int> pending_flush_;    // connections with output queued this batch
+    std::vector<int> flushing_;
     std::map<int, std::unique_ptr<ClientContext>> clients_;
     std::vector<struct io_uring_cqe*> cqes_;
+    std::unique_ptr<OffloadCompletions> completions_;
+    uint64_t offload_counter_ = 0;      // target of the read armed on the completion eventfd
+    uint64_t next_connection_id_ = 0;
+    MessageLog::SyncBatch log_batch_;   // segments of the fsyncs in flight
+    size_t log_syncs_inflight_ = 0;
+    bool log_sync_failed_ = false;
+    bool log_sync_incomplete_ = false;  // an fsync of the batch could not be submitted
+    std::vector<int> held_;             // connections with replies waiting for a log sync
     void setup_server_socket(uint16_t port);
     void handle_client_read(ClientContext* ctx);
     void handle_client_write(ClientContext* ctx);
+    void handle_file_write(ClientContext* ctx);
+    void handle_file_completion(ClientContext* ctx, struct io_uring_cqe* cqe);
+    void handle_splice_read(ClientContext* ctx);
+    void handle_splice_write(ClientContext* ctx);
+    void handle_splice_completion(ClientContext* ctx, struct io_uring_cqe* cqe);
+    struct io_uring_sqe* get_sqe();
+    bool provide_recv_buffer(uint16_t buffer_id);
+    void handle_client_completion(ClientContext* ctx, struct io_uring_cqe* cqe);
+    Delivery deliver_fanout(int client_fd, const SharedBuffer& message);
+    void queue_reply(ClientContext* ctx, std::string& reply, const std::vector<FileSend>* files = nullptr);
+    bool arm_offload_read();
+    void submit_offload(ClientContext* ctx, OffloadJob* job);
+    void finish_offload(OffloadJob& job);
+    void sync_log();
+    void finish_log_sync(int res);
+    void schedule_flush(ClientContext* ctx);
+    void flush_pending();
     void cleanup_client(ClientContext* ctx);
+    bool drain_idle(DrainTimer& drain);
     void process_completions();
+    void run_udp(uint16_t port);
+    void udp_loop(int socket_fd);
     
     
 };
 
 
-enum class ServerKind { Bio, Select, Poll, Epoll, IOUring };
+// Handlers written as straight-line coroutines (read, process, write) on top of
+// an EpollReactor or IOUringReactor; see coro.hpp.
+template<typename Reactor>
+class CoroServer: public ServerStats{
+public:
+    std::string get_name() const {
+        return Reactor::kName;
+    }
+
+    void run(uint16_t port);
+private:
+    Reactor reactor_;
+    SocketRAII server_fd_;
+    std::string reply_;     // replies of the current read, reused
+    IoOp* accepting_ = nullptr;             // accept_loop's pending accept
+    std::unordered_map<int, bool> idle_;    // fd of every handler -> waiting in read with nothing buffered
+    bool drained_ = false;
+    Task accept_loop();
+    Task handle_client(int client_fd);
+    Task drain();
+};
+
+
+enum class ServerKind { Bio, Select, Poll, Epoll, IOUring, CoEpoll, CoIOUring };
 class Server{
-    using V = std::variant<BioServer, SelectServer, PollServer, EpollServer, IOUringServer>;
+    using V = std::variant<BioServer, SelectServer, PollServer, EpollServer, IOUringServer,
+                           CoroServer<EpollReactor>, CoroServer<IOUringReactor>>;
     V impl_;
 public:
     template<typename T, typename... Args>
@@ -165,10 +1137,20 @@ public:
                 return Server{std::in_place_type<EpollServer>};
             case ServerKind::IOUring:
                 return Server{std::in_place_type<IOUringServer>};
+            case ServerKind::CoEpoll:
+                return Server{std::in_place_type<CoroServer<EpollReactor>>};
+            case ServerKind::CoIOUring:
+                return Server{std::in_place_type<CoroServer<IOUringReactor>>};
         }
         std::terminate();
     }
 
+    void configure(const ServerConfig& config){
+        std::visit([&config](auto& server){
+            server.configure(config);
+        }, impl_);
+    }
+
     void run(uint16_t port){
         std::visit([port](auto& server){
             server.run(port);
@@ -0,0 +1,73 @@
+#pragma once
+#include "utils.hpp"
+
+#include <sys/inotify.h>
+
+
+// A regular file of the static directory, open for as long as the cache or a
+// reply still sending it holds a reference. A file replaced by rename keeps
+// serving its old contents to those replies; one truncated in place makes
+// their sends come up short, and those connections are closed.
+struct StaticFile {
+    SocketRAII fd;
+    size_t size = 0;
+    timespec mtime{};
+    std::string headers;    // its Content-Length and Last-Modified lines, built once
+};
+
+// The body of a static file, to be sent by the backend with sendfile(2) or
+// IORING_OP_SPLICE right after the first `at` bytes of a reply string.
+struct FileSend {
+    size_t at = 0;
+    std::shared_ptr<const StaticFile> file;
+    size_t offset = 0;      // file bytes already sent (or, on io_uring, moved into the pipe)
+};
+
+struct StaticFileStats {
+    size_t files = 0;           // open in the cache
+    uint64_t hits = 0;
+    uint64_t opens = 0;         // misses that found a file
+    uint64_t invalidations = 0;
+};
+
+// Open fds of the files served from one directory, with their size and mtime,
+// so a request costs a hash lookup instead of open+fstat+close. An inotify
+// watcher thread drops the entry of every file that is written, replaced or
+// removed; the next request opens it again. Only files directly in the
+// directory are served, and names are taken as they are (no %-decoding).
+// Lookups may come from any thread.
+class StaticFileCache {
+public:
+    explicit StaticFileCache(std::string dir);
+    ~StaticFileCache();     // stops the watcher
+    StaticFileCache(const StaticFileCache&) = delete;
+    StaticFileCache& operator=(const StaticFileCache&) = delete;
+
+    // Opens the directory and starts watching it. false if either fails.
+    bool open();
+
+    // The file an HTTP target ("/name", a query is ignored) names, nullptr if
+    // that is no regular file directly in the directory.
+    std::shared_ptr<const StaticFile> lookup(std::string_view target);
+
+    StaticFileStats stats();
+
+private:
+    std::string dir_;
+    SocketRAII dir_fd_;
+    SocketRAII inotify_fd_;
+    SocketRAII stop_fd_;    // eventfd that ends the watcher
+    std::thread watcher_;
+
+    // looked up by the string_view of the request target, without a copy
+    struct NameHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+    };
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<const StaticFile>, NameHash, std::equal_to<>> files_;
+    StaticFileStats stats_;
+
+    void watch();
+    std::shared_ptr<const StaticFile> open_file(std::string_view name);
+};
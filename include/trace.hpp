@@ -0,0 +1,106 @@
+#pragma once
+#include "common.hpp"
+
+#include <array>
+
+// Points on a message's way through a loop, recorded for sampled messages.
+enum class TracePhase : uint8_t {
+    Ready,          // the loop woke up with the connection ready (or the CQE was reaped)
+    Recv,           // the recv carrying the message completed
+    HandlerBegin,
+    HandlerEnd,
+    SendDone        // the next send on that connection completed
+};
+
+struct TraceEvent {
+    uint64_t id;        // message id, shared by the events of one message
+    int64_t ts_ns;      // steady clock
+    int32_t fd;
+    TracePhase phase;
+};
+
+// One per thread. Only the owning thread writes; the dumper copies behind the
+// published head and discards whatever the writer lapped while it copied.
+class TraceRing {
+public:
+    static constexpr size_t kCapacity = 16 * 1024;
+
+    explicit TraceRing(uint32_t tid) : tid_(tid) {}
+
+    void push(const TraceEvent& event) {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        events_[head & (kCapacity - 1)] = event;
+        head_.store(head + 1, std::memory_order_release);
+    }
+    void snapshot(std::vector<TraceEvent>& out) const;
+    uint32_t tid() const { return tid_; }
+
+private:
+    uint32_t tid_;
+    std::atomic<uint64_t> head_{0};
+    std::array<TraceEvent, kCapacity> events_;
+};
+
+// Sampled request tracing. Every hook in the hot paths is guarded by
+// enabled(), a relaxed load of a flag set once at start-up, so with tracing
+// off a hook costs one predictable branch. SIGUSR1 asks for a dump, which a
+// background thread writes as Chrome trace JSON (chrome://tracing, Perfetto).
+class Tracer {
+public:
+    // trace one of every `sample_every` messages, 0 leaves tracing off
+    static void configure(uint32_t sample_every, std::string file_prefix);
+    static bool enabled() { return sample_every_.load(std::memory_order_relaxed) != 0; }
+
+    // only sets a flag the dump thread polls
+    static void request_dump() { dump_requested_.store(true, std::memory_order_relaxed); }
+
+    // the calls below are made only when enabled()
+    static void mark_ready();
+    static void mark_recv();
+    // 0 when this message is not sampled
+    static uint64_t begin_message(int fd);
+    static void end_message(uint64_t id, int fd);
+    static void sent(int fd);
+    // drops messages still waiting for a send, so a reused fd does not get them
+    static void closed(int fd);
+
+private:
+    struct ThreadState;
+
+    static std::atomic<uint32_t> sample_every_;
+    static std::atomic<bool> dump_requested_;
+    static std::string file_prefix_;
+    static std::mutex rings_mutex_;
+    static std::vector<std::shared_ptr<TraceRing>> rings_;  // every ring, dumped even after its thread exits
+    static std::vector<std::shared_ptr<TraceRing>> free_rings_;   // of exited threads, reused by new ones
+    static thread_local ThreadState state_;
+
+    static ThreadState& thread_state();
+    static void dump_loop();
+    static bool dump(const std::string& path);
+};
+
+// Hot-path hooks: a single branch when tracing is off.
+inline void trace_ready() {
+    if (Tracer::enabled()) [[unlikely]] {
+        Tracer::mark_ready();
+    }
+}
+
+inline void trace_recv() {
+    if (Tracer::enabled()) [[unlikely]] {
+        Tracer::mark_recv();
+    }
+}
+
+inline void trace_sent(int fd) {
+    if (Tracer::enabled()) [[unlikely]] {
+        Tracer::sent(fd);
+    }
+}
+
+inline void trace_closed(int fd) {
+    if (Tracer::enabled()) [[unlikely]] {
+        Tracer::closed(fd);
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "buffer_pool.hpp"
+
+#include <netinet/udp.h>
+
+
+// Datagrams moved per recvmmsg/sendmmsg call, and recvmsg SQEs kept armed on io_uring.
+inline constexpr size_t kUdpBatch = 32;
+// Receive buffer per slot: the largest datagram, or GRO super-packet, we accept.
+inline constexpr size_t kUdpMaxDatagram = 64 * 1024;
+// Largest IPv4 UDP payload; a reply (or a UDP_SEGMENT train) must fit in it.
+inline constexpr size_t kUdpMaxPayload = 65507;
+// Kernel cap on segments in one UDP_SEGMENT send (UDP_MAX_SEGMENTS).
+inline constexpr size_t kUdpMaxSegments = 64;
+
+// Receive side of one batch: kUdpBatch slots, each with a pooled buffer, room
+// for the peer address and for a UDP_GRO control message. The headers are
+// passed as-is to recvmmsg, or one per IORING_OP_RECVMSG.
+class UdpRecvBatch {
+public:
+    UdpRecvBatch();
+    ~UdpRecvBatch();
+    UdpRecvBatch(const UdpRecvBatch&) = delete;
+    UdpRecvBatch& operator=(const UdpRecvBatch&) = delete;
+
+    mmsghdr* headers() { return headers_.data(); }
+    msghdr* header(size_t slot) { return &headers_[slot].msg_hdr; }
+    // restore the lengths the kernel overwrote before slot is received into again
+    void reset(size_t slot);
+
+    std::string_view data(size_t slot, size_t length) const { return {buffers_[slot], length}; }
+    const sockaddr_storage& peer(size_t slot) const { return peers_[slot]; }
+    socklen_t peer_length(size_t slot) const { return headers_[slot].msg_hdr.msg_namelen; }
+    // size of each datagram the kernel coalesced into slot, 0 for a single datagram
+    size_t gro_size(size_t slot) const;
+
+private:
+    struct alignas(cmsghdr) Control {
+        char bytes[CMSG_SPACE(sizeof(int))];
+    };
+
+    std::array<mmsghdr, kUdpBatch> headers_{};
+    std::array<iovec, kUdpBatch> iov_{};
+    std::array<sockaddr_storage, kUdpBatch> peers_{};
+    std::array<Control, kUdpBatch> control_{};
+    std::array<char*, kUdpBatch> buffers_{};
+    size_t capacity_ = 0;
+};
+
+// Send side of one batch: replies laid out back to back in one string, each
+// with a copy of its peer address, turned into mmsghdrs by build(). With GSO
+// on, consecutive replies to the same peer with the same size (the last one
+// may be shorter) leave as one UDP_SEGMENT send and the kernel splits them.
+class UdpReplies {
+public:
+    explicit UdpReplies(bool gso) : gso_(gso) {}
+
+    // replies are appended here, then registered with add()
+    std::string& buffer() { return data_; }
+    // the reply is buffer()[offset, end); empty and oversized ones are dropped (UDP is lossy)
+    void add(const sockaddr_storage& peer, socklen_t peer_length, size_t offset);
+    bool empty() const { return replies_.empty(); }
+
+    // lays out the sends; headers() stay valid until clear()
+    size_t build();
+    mmsghdr* headers() { return headers_.data(); }
+    msghdr* header(size_t index) { return &headers_[index].msg_hdr; }
+    size_t datagrams(size_t index) const { return segments_[index]; }
+    void clear();
+
+private:
+    struct Reply {
+        size_t offset;
+        size_t length;
+        sockaddr_storage peer;
+        socklen_t peer_length;
+    };
+    struct alignas(cmsghdr) Control {
+        char bytes[CMSG_SPACE(sizeof(uint16_t))];
+    };
+
+    bool gso_;
+    std::string data_;
+    std::vector<Reply> replies_;
+    std::vector<mmsghdr> headers_;
+    std::vector<iovec> iov_;
+    std::vector<Control> control_;
+    std::vector<size_t> segments_;
+};
@@ -3,23 +3,32 @@
 
 class Logger{
 public:
+    // Each line is formatted in a stream of its own, so manipulators such as
+    // std::fixed or std::setprecision apply to that line only.
     template <typename ... Args>
     static void info(Args&& ... args) {
+        std::string line = format(std::forward<Args>(args)...);
         std::lock_guard<std::mutex> lock(mtx_);
-        std::cout << "[info]:";
-        (std::cout << ... << std::forward<Args>(args)) << "\n";
+        std::cout << "[info]:" << line << "\n";
     }
 
 
     template <typename ... Args>
     static void error(Args&& ... args) {
+        std::string line = format(std::forward<Args>(args)...);
         std::lock_guard<std::mutex> lock(mtx_);
-        std::cerr << "[error]:";
-        (std::cerr << ... << std::forward<Args>(args)) << std::endl;
+        std::cerr << "[error]:" << line << std::endl;
     }
 
 private:
     inline static std::mutex mtx_;
+
+    template <typename ... Args>
+    static std::string format(Args&& ... args) {
+        std::ostringstream line;
+        (line << ... << std::forward<Args>(args));
+        return std::move(line).str();
+    }
 };
 
 
@@ -72,5 +81,17 @@ private:
 
 bool set_reuseaddr(int fd);
 bool set_non_blocking(int fd);
+// max_chunk > 0: at most that many bytes per send (one seqpacket record each)
+bool send_all(int fd, std::string_view data, size_t max_chunk = 0, int flags = 0);
+// sendfile(2) of the first `count` bytes of `file_fd`; false on errors or if the file is shorter
+bool sendfile_all(int fd, int file_fd, size_t count, size_t max_chunk = 0);
+// trims a scatter list to at most `limit` bytes (0: no limit), returns the entries kept
+size_t clamp_iov(iovec* iov, size_t count, size_t limit);
+bool make_pipe(SocketRAII& read_end, SocketRAII& write_end);
+std::string_view trim_line(std::string_view line);
+std::string_view next_token(std::string_view& rest);
+bool equals_ignore_case(std::string_view word, std::string_view upper);
 std::string get_current_time();
+// keeps the calling thread's CPU busy for `us` microseconds
+void burn_cpu(uint32_t us);
 void print_stats(std::string_view server_name, int active_connections, long long total_messages);
\ No newline at end of file
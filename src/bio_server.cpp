@@ -3,24 +3,39 @@
 
 
 void BioServer::run(uint16_t port) {
-    auto server_fd_opt = init_socket(port, get_name());
+    auto server_fd_opt = init_socket(port, get_name(), kKvLockStripes);
     if (!server_fd_opt.has_value()) {
         Logger::error("Failed to create socket");
         return;
     }
     auto server_fd = std::move(server_fd_opt.value());
+    // a blocked accept would not notice a stop, so the listener is polled together
+    // with the stop eventfd; non-blocking, since a successor may take the connection first
+    set_non_blocking(server_fd.get());
+    pollfd fds[2] = {{server_fd.get(), POLLIN, 0}, {stop_fd_.get(), POLLIN, 0}};
 
    
     while(running_) {
+        if (::poll(fds, 2, -1) == -1) {
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            break;
+        }
         sockaddr_in client_addr{};
         socklen_t client_addr_len = sizeof(client_addr);
         int client_fd = ::accept(server_fd.get(), reinterpret_cast<sockaddr*>(&client_addr), &client_addr_len);
         if (client_fd == -1) {
-            if (running_){
+            if (running_ && errno != EAGAIN && errno != EWOULDBLOCK){
                 Logger::error("Failed to accept connection");
             }
             continue;
         }
+        // the only limit that applies here: every admitted connection is a thread
+        if (!admit_connection(client_fd)) {
+            continue;
+        }
+        active_connections_++;
 
         // handle connection in new thread
         std::thread client_thread([this, client_fd]() {
@@ -29,37 +44,101 @@ void BioServer::run(uint16_t port) {
         client_thread.detach();
     }
 
-    if (stats_thread_.joinable()) {
-        stats_thread_.join();
-    }
+    // with a successor, it takes the connections still queued
+    server_fd = SocketRAII();
+    drain();
+    stop_service();
     Logger::info(get_name(), " stopped");
 }
 
+// Runs on the accept thread after a stop. Every tick a share of the idle
+// connections is shut down for reading, which ends their threads; one that
+// just read a message still sends its reply first. At the deadline (or on a
+// second stop) all are shut down, and the connection threads, which use this
+// object, are waited for.
+void BioServer::drain() {
+    DrainTimer drain = start_drain();
+    Logger::info(get_name(), " draining ", active_connections_.load(), " connections");
+    while (active_connections_.load() > 0 && running_ && !drain.expired()) {
+        {
+            std::lock_guard<std::mutex> lock(clients_mutex_);
+            size_t idle = std::ranges::count_if(clients_, [](const auto& entry) {
+                return entry.second->idle.load(std::memory_order_relaxed);
+            });
+            size_t quota = drain.quota(idle);
+            for (auto it = clients_.begin(); it != clients_.end() && quota > 0; ++it) {
+                if (it->second->idle.exchange(false, std::memory_order_relaxed)) {
+                    ::shutdown(it->first, SHUT_RD);
+                    quota--;
+                }
+            }
+        }
+        std::this_thread::sleep_for(kDrainTick);
+    }
+    // repeated, for threads that had not registered yet
+    while (active_connections_.load() > 0) {
+        {
+            std::lock_guard<std::mutex> lock(clients_mutex_);
+            for (const auto& entry : clients_) {
+                ::shutdown(entry.first, SHUT_RDWR);
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
 
 void BioServer::handle_client(int client_fd) {
     SocketRAII client_socket(client_fd);
-    active_connections_++;
+    ClientState state{client_fd};
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        clients_[client_fd] = &state;
+    }
 
-    char buffer[1024];
+    char buffer[kReadChunk];
+    PooledBuffer input;
+    std::string output;
+    std::vector<FileSend> files;    // static file bodies between the bytes of output
     std::string clinet_info = "Client-" + std::to_string(client_fd);
     // Logger::info(clinet_info, " connected(", active_connections_.load(std::memory_order_relaxed), ")");
 
+    // the blocking recv is this thread's wait
+    LoopProbe probe(loop_stats_, false);
     while(running_) {
-        ssize_t bytes_read = ::recv(client_socket.get(), buffer, sizeof(buffer)-1, 0);
+        state.idle.store(input.empty(), std::memory_order_relaxed);
+        probe.before_wait();
+        ssize_t bytes_read = ::recv(client_socket.get(), buffer, sizeof(buffer), 0);
+        probe.after_wait(bytes_read > 0 ? 1 : 0);
+        state.idle.store(false, std::memory_order_relaxed);
+        recv_calls_++;
         if (bytes_read <= 0) {
             break;
         }
-        buffer[bytes_read] = '\0';
-        std::string response = "Echo[" + std::to_string(total_messages_.load(std::memory_order_relaxed)) + "]:" + std::string(buffer);
-        if (buffer[bytes_read] == '\n'){
-            response.pop_back(); 
+        trace_recv();
+        bool close_after = false;
+        if (!process_input(input, std::string_view(buffer, bytes_read), output, client_fd, &files, &close_after)) {
+            Logger::error(clinet_info, " sent an oversized or malformed message");
+            break;
         }
-        if (::send(client_socket.get(), response.c_str(), response.size(), 0) == -1) {
-            Logger::error(clinet_info, " failed to send response");
+        if (!output.empty()) {
+            send_calls_ += 1 + files.size();
+            if (!send_reply(client_socket.get(), output, files)) {
+                Logger::error(clinet_info, " failed to send response");
+                break;
+            }
+            trace_sent(client_fd);
+            output.clear();
+            files.clear();
+        }
+        if (close_after) {
             break;
         }
-        total_messages_++;
     }
-
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        clients_.erase(client_fd);
+    }
+    active_connections_--;
+    trace_closed(client_fd);
 }
-
@@ -0,0 +1,142 @@
+#include "buffer_pool.hpp"
+
+
+thread_local BufferPool::ThreadCache BufferPool::cache_;
+std::mutex BufferPool::depot_mutex_;
+std::array<BufferPool::FreeList, BufferPool::kClasses> BufferPool::depot_;
+std::atomic<size_t> BufferPool::bytes_in_use_{0};
+std::atomic<size_t> BufferPool::bytes_cached_{0};
+
+size_t BufferPool::class_index(size_t size) {
+    size_t shift = kMinShift;
+    while ((size_t{1} << shift) < size) {
+        shift++;
+    }
+    return shift - kMinShift;
+}
+
+// how many buffers of class `index` fit in `bytes_per_class`, at least two
+size_t BufferPool::limit(size_t index, size_t bytes_per_class) {
+    return std::max<size_t>(2, bytes_per_class >> (index + kMinShift));
+}
+
+char* BufferPool::acquire(size_t size, size_t& capacity) {
+    if (size > (size_t{1} << kMaxShift)) {
+        capacity = size;
+        bytes_in_use_.fetch_add(capacity, std::memory_order_relaxed);
+        return static_cast<char*>(::operator new(size));
+    }
+
+    size_t index = class_index(size);
+    capacity = size_t{1} << (index + kMinShift);
+    bytes_in_use_.fetch_add(capacity, std::memory_order_relaxed);
+
+    FreeList& list = cache_.lists[index];
+    if (!list.head) {
+        // refill half a cache's worth from the depot in one lock round trip
+        std::lock_guard<std::mutex> lock(depot_mutex_);
+        FreeList& shared = depot_[index];
+        size_t want = limit(index, kThreadCacheBytesPerClass) / 2;
+        while (shared.head && list.count < want) {
+            FreeNode* node = shared.head;
+            shared.head = node->next;
+            shared.count--;
+            node->next = list.head;
+            list.head = node;
+            list.count++;
+        }
+    }
+    if (list.head) {
+        FreeNode* node = list.head;
+        list.head = node->next;
+        list.count--;
+        bytes_cached_.fetch_sub(capacity, std::memory_order_relaxed);
+        return reinterpret_cast<char*>(node);
+    }
+    return static_cast<char*>(::operator new(capacity));
+}
+
+void BufferPool::release(char* data, size_t capacity) {
+    if (!data) return;
+    bytes_in_use_.fetch_sub(capacity, std::memory_order_relaxed);
+    if (capacity > (size_t{1} << kMaxShift)) {
+        ::operator delete(data);
+        return;
+    }
+
+    size_t index = class_index(capacity);
+    FreeList& list = cache_.lists[index];
+    FreeNode* node = reinterpret_cast<FreeNode*>(data);
+    node->next = list.head;
+    list.head = node;
+    list.count++;
+    bytes_cached_.fetch_add(capacity, std::memory_order_relaxed);
+    if (list.count > limit(index, kThreadCacheBytesPerClass)) {
+        spill(index, list, list.count / 2);
+    }
+}
+
+// Moves a thread's buffers beyond `keep` to the depot, freeing what the depot can't hold.
+void BufferPool::spill(size_t index, FreeList& list, size_t keep) {
+    size_t capacity = size_t{1} << (index + kMinShift);
+    size_t depot_limit = limit(index, kDepotBytesPerClass);
+
+    std::lock_guard<std::mutex> lock(depot_mutex_);
+    FreeList& shared = depot_[index];
+    while (list.count > keep) {
+        FreeNode* node = list.head;
+        list.head = node->next;
+        list.count--;
+        if (shared.count < depot_limit) {
+            node->next = shared.head;
+            shared.head = node;
+            shared.count++;
+        } else {
+            ::operator delete(node);
+            bytes_cached_.fetch_sub(capacity, std::memory_order_relaxed);
+        }
+    }
+}
+
+BufferPool::ThreadCache::~ThreadCache() {
+    for (size_t index = 0; index < kClasses; ++index) {
+        spill(index, lists[index], 0);
+    }
+}
+
+BufferPoolStats BufferPool::stats() {
+    return {bytes_in_use_.load(std::memory_order_relaxed), bytes_cached_.load(std::memory_order_relaxed)};
+}
+
+
+void PooledBuffer::append(std::string_view bytes) {
+    if (bytes.empty()) return;
+    if (size_ + bytes.size() > capacity_) {
+        size_t capacity = 0;
+        char* grown = BufferPool::acquire(std::max(size_ + bytes.size(), capacity_ * 2), capacity);
+        if (size_ > 0) {
+            std::memcpy(grown, data_, size_);
+        }
+        BufferPool::release(data_, capacity_);
+        data_ = grown;
+        capacity_ = capacity;
+    }
+    std::memcpy(data_ + size_, bytes.data(), bytes.size());
+    size_ += bytes.size();
+}
+
+void PooledBuffer::consume(size_t n) {
+    if (n >= size_) {
+        clear();
+        return;
+    }
+    std::memmove(data_, data_ + n, size_ - n);
+    size_ -= n;
+}
+
+void PooledBuffer::clear() {
+    BufferPool::release(data_, capacity_);
+    data_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+}
@@ -0,0 +1,107 @@
+#include "capture.hpp"
+
+
+TrafficCapture::TrafficCapture(size_t buffer_limit) : buffer_limit_(buffer_limit) {}
+
+TrafficCapture::~TrafficCapture() {
+    if (writer_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        writer_.join();
+    }
+}
+
+bool TrafficCapture::open(const std::string& path) {
+    fd_ = SocketRAII(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if (fd_.get() == -1) {
+        Logger::error("Failed to create capture file ", path, ": ", strerror(errno));
+        return false;
+    }
+    CaptureFileHeader header{};
+    std::memcpy(header.magic, kCaptureMagic, sizeof(header.magic));
+    header.start_unix_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    if (!write_out(std::string_view(reinterpret_cast<const char*>(&header), sizeof(header)))) {
+        return false;
+    }
+    start_ = std::chrono::steady_clock::now();
+    writer_ = std::thread([this] { write_loop(); });
+    return true;
+}
+
+void TrafficCapture::open_connection(int fd) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    connections_[fd] = ++next_connection_;
+}
+
+void TrafficCapture::record(int fd, std::string_view messages) {
+    CaptureRecordHeader header{};
+    header.offset_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_).count());
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto [it, inserted] = connections_.try_emplace(fd, 0);
+        if (inserted) {
+            it->second = ++next_connection_;    // accepted before the capture started
+        }
+        header.connection = it->second;
+        size_t start = 0;
+        size_t end;
+        while ((end = messages.find('\n', start)) != std::string_view::npos) {
+            std::string_view message = messages.substr(start, end + 1 - start);
+            start = end + 1;
+            if (pending_.size() + sizeof(header) + message.size() > buffer_limit_) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            header.length = static_cast<uint32_t>(message.size());
+            pending_.append(reinterpret_cast<const char*>(&header), sizeof(header));
+            pending_.append(message);
+            records_.fetch_add(1, std::memory_order_relaxed);
+        }
+        wake = pending_.size() >= kFlushBytes;
+    }
+    if (wake) {
+        wake_.notify_one();
+    }
+}
+
+void TrafficCapture::write_loop() {
+    std::string writing;
+    bool stopping = false;
+    while (!stopping) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait_for(lock, kFlushInterval, [this] {
+                return stopping_ || pending_.size() >= kFlushBytes;
+            });
+            stopping = stopping_;
+            // swapped, so both buffers keep their capacity
+            writing.swap(pending_);
+        }
+        if (!writing.empty() && !write_out(writing)) {
+            return;
+        }
+        writing.clear();
+    }
+}
+
+bool TrafficCapture::write_out(std::string_view data) {
+    while (!data.empty()) {
+        ssize_t written = ::write(fd_.get(), data.data(), data.size());
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Logger::error("Failed to write capture file: ", strerror(errno));
+            return false;
+        }
+        data.remove_prefix(static_cast<size_t>(written));
+        bytes_written_.fetch_add(static_cast<uint64_t>(written), std::memory_order_relaxed);
+    }
+    return true;
+}
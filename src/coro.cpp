@@ -0,0 +1,350 @@
+#include "coro.hpp"
+#include "trace.hpp"
+#include "probe.hpp"
+
+
+thread_local std::array<FramePool::FreeNode*, FramePool::kMaxPooled / FramePool::kGranularity + 1>
+    FramePool::free_lists_{};
+
+void* FramePool::allocate(size_t size) {
+    size_t index = (size + kGranularity - 1) / kGranularity;
+    if (index >= free_lists_.size()) {
+        return ::operator new(size);
+    }
+    FreeNode*& head = free_lists_[index];
+    if (head) {
+        FreeNode* node = head;
+        head = node->next;
+        return node;
+    }
+    return ::operator new(index * kGranularity);
+}
+
+void FramePool::deallocate(void* frame, size_t size) {
+    size_t index = (size + kGranularity - 1) / kGranularity;
+    if (index >= free_lists_.size()) {
+        ::operator delete(frame);
+        return;
+    }
+    FreeNode* node = static_cast<FreeNode*>(frame);
+    node->next = free_lists_[index];
+    free_lists_[index] = node;
+}
+
+
+EpollReactor::~EpollReactor() {
+    if (epoll_fd_ != -1) {
+        close(epoll_fd_);
+    }
+    BufferPool::release(read_buffer_, kReadChunk);
+}
+
+bool EpollReactor::init() {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    events_.resize(1024);
+    size_t capacity = 0;
+    read_buffer_ = BufferPool::acquire(kReadChunk, capacity);
+    return epoll_fd_ != -1;
+}
+
+bool EpollReactor::add(int fd) {
+    if (static_cast<size_t>(fd) >= waiters_.size()) {
+        waiters_.resize(fd + 1);
+    }
+    // both directions once, edge-triggered: parked ops are retried on the next edge
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.fd = fd;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+void EpollReactor::remove(int fd) {
+    if (fd < 0 || static_cast<size_t>(fd) >= waiters_.size()) return;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    waiters_[fd] = {};
+}
+
+bool EpollReactor::perform(IoOp* op) {
+    for (;;) {
+        ssize_t n = 0;
+        switch (op->kind) {
+            case IoOp::Kind::Accept:
+                n = accept4(op->fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                break;
+            case IoOp::Kind::Read:
+                // a lent read lands in the shared buffer; its reader consumes it
+                // before awaiting again, i.e. before anyone else can overwrite it
+                if (!op->buffer) {
+                    n = recv(op->fd, read_buffer_, op->length, 0);
+                    if (n >= 0) {
+                        op->buffer = read_buffer_;
+                    }
+                } else {
+                    n = recv(op->fd, op->buffer, op->length, 0);
+                }
+                break;
+            case IoOp::Kind::Write:
+                while (op->done < op->length) {
+                    n = send(op->fd, op->buffer + op->done, op->length - op->done, MSG_NOSIGNAL);
+                    if (n < 0) break;
+                    op->done += n;
+                }
+                if (op->done == op->length) {
+                    n = static_cast<ssize_t>(op->length);
+                }
+                break;
+            case IoOp::Kind::Sleep:
+                return false;
+            case IoOp::Kind::Readable: {
+                pollfd pfd{op->fd, POLLIN, 0};
+                n = ::poll(&pfd, 1, 0);
+                if (n == 0) return false;
+                if (n > 0) n = pfd.revents;
+                break;
+            }
+        }
+        if (n >= 0) {
+            op->result = n;
+            return true;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+        op->result = -errno;
+        return true;
+    }
+}
+
+bool EpollReactor::start(IoOp* op) {
+    if (op->kind == IoOp::Kind::Sleep) {
+        timers_.push({op->deadline, op});
+        return true;
+    }
+    if (perform(op)) {
+        return false;
+    }
+    Waiters& waiters = waiters_[op->fd];
+    (op->kind == IoOp::Kind::Write ? waiters.writer : waiters.reader) = op;
+    return true;
+}
+
+void EpollReactor::cancel(IoOp* op) {
+    Waiters& waiters = waiters_[op->fd];
+    IoOp*& parked = op->kind == IoOp::Kind::Write ? waiters.writer : waiters.reader;
+    if (parked != op) {
+        return;
+    }
+    parked = nullptr;
+    op->result = -ECANCELED;
+    op->handle.resume();
+}
+
+void EpollReactor::run_once() {
+    int timeout_ms = -1;
+    if (!timers_.empty()) {
+        auto wait = timers_.top().deadline - std::chrono::steady_clock::now();
+        auto ms = std::chrono::ceil<std::chrono::milliseconds>(wait).count();
+        timeout_ms = static_cast<int>(std::max<long long>(ms, 0));
+    }
+
+    if (probe_) {
+        probe_->before_wait();
+    }
+    int nfds = epoll_wait(epoll_fd_, events_.data(), static_cast<int>(events_.size()), timeout_ms);
+    if (probe_) {
+        probe_->after_wait(std::max(nfds, 0));
+    }
+    trace_ready();
+    if (nfds < 0 && errno != EINTR) {
+        Logger::error("Failed to wait for epoll events: ", strerror(errno));
+    }
+
+    for (int i = 0; i < nfds; ++i) {
+        int fd = events_[i].data.fd;
+        uint32_t events = events_[i].events;
+        // a resumed handler may close its fd or register new ones, so index afresh each time
+        if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            IoOp* op = static_cast<size_t>(fd) < waiters_.size() ? waiters_[fd].reader : nullptr;
+            if (op && perform(op)) {
+                waiters_[fd].reader = nullptr;
+                op->handle.resume();
+            }
+        }
+        if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+            IoOp* op = static_cast<size_t>(fd) < waiters_.size() ? waiters_[fd].writer : nullptr;
+            if (op && perform(op)) {
+                waiters_[fd].writer = nullptr;
+                op->handle.resume();
+            }
+        }
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    while (!timers_.empty() && timers_.top().deadline <= now) {
+        IoOp* op = timers_.top().op;
+        timers_.pop();
+        op->result = 0;
+        op->handle.resume();
+    }
+}
+
+
+IOUringReactor::~IOUringReactor() {
+    if (initialized_) {
+        io_uring_queue_exit(&ring_);
+    }
+    for (char* buffer : lent_buffers_) {
+        BufferPool::release(buffer, kReadChunk);
+    }
+}
+
+bool IOUringReactor::init() {
+    if (io_uring_queue_init(kIOUringEntries, &ring_, IORING_SETUP_SQPOLL) < 0 &&
+        io_uring_queue_init(kIOUringEntries, &ring_, 0) < 0) {
+        return false;
+    }
+    initialized_ = true;
+    cqes_.resize(kIOUringEntries);
+    lent_buffers_.resize(kLentBufferCount);
+    for (unsigned id = 0; id < kLentBufferCount; ++id) {
+        size_t capacity = 0;
+        lent_buffers_[id] = BufferPool::acquire(kReadChunk, capacity);
+        if (!provide(static_cast<uint16_t>(id))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// user_data 0 marks a provide; every other SQE carries its IoOp
+bool IOUringReactor::provide(uint16_t buffer_id) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+    if (!sqe) {
+        io_uring_submit(&ring_);
+        sqe = io_uring_get_sqe(&ring_);
+        if (!sqe) {
+            return false;
+        }
+    }
+    io_uring_prep_provide_buffers(sqe, lent_buffers_[buffer_id], kReadChunk, 1, kLentBufferGroup, buffer_id);
+    sqe->user_data = 0;
+    return true;
+}
+
+bool IOUringReactor::submit(IoOp* op) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+    if (!sqe) {
+        io_uring_submit(&ring_);
+        sqe = io_uring_get_sqe(&ring_);
+        if (!sqe) {
+            return false;
+        }
+    }
+    switch (op->kind) {
+        case IoOp::Kind::Accept:
+            io_uring_prep_accept(sqe, op->fd, nullptr, nullptr, SOCK_CLOEXEC);
+            break;
+        case IoOp::Kind::Read:
+            io_uring_prep_recv(sqe, op->fd, op->buffer, op->length, 0);
+            if (!op->buffer) {
+                io_uring_sqe_set_flags(sqe, IOSQE_BUFFER_SELECT);
+                sqe->buf_group = kLentBufferGroup;
+            }
+            break;
+        case IoOp::Kind::Write:
+            io_uring_prep_send(sqe, op->fd, op->buffer + op->done, op->length - op->done, MSG_NOSIGNAL);
+            break;
+        case IoOp::Kind::Sleep:
+            io_uring_prep_timeout(sqe, &op->timeout, 0, 0);
+            break;
+        case IoOp::Kind::Readable:
+            io_uring_prep_poll_add(sqe, op->fd, POLLIN);
+            break;
+    }
+    sqe->user_data = reinterpret_cast<uint64_t>(op);
+    return true;
+}
+
+bool IOUringReactor::start(IoOp* op) {
+    if (submit(op)) {
+        return true;
+    }
+    op->result = -EBUSY;
+    return false;
+}
+
+void IOUringReactor::cancel(IoOp* op) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+    if (!sqe) {
+        io_uring_submit(&ring_);
+        sqe = io_uring_get_sqe(&ring_);
+        if (!sqe) {
+            Logger::error("Failed to get sqe for cancel");
+            return;
+        }
+    }
+    io_uring_prep_cancel(sqe, op, 0);
+    sqe->user_data = kCancelMarker;
+}
+
+void IOUringReactor::run_once() {
+    // every coroutine resumed last round has suspended again, so it is done
+    // with the buffer it was lent
+    for (uint16_t buffer_id : returned_) {
+        if (!provide(buffer_id)) {
+            Logger::error("Failed to provide lent buffer ", buffer_id);
+        }
+    }
+    returned_.clear();
+
+    if (probe_) {
+        probe_->before_wait();
+    }
+    int ret = io_uring_submit_and_wait(&ring_, 1);
+    if (ret < 0 && ret != -EINTR) {
+        Logger::error("Failed to wait for io_uring completions: ", strerror(-ret));
+        return;
+    }
+
+    unsigned count = io_uring_peek_batch_cqe(&ring_, cqes_.data(), cqes_.size());
+    if (probe_) {
+        probe_->submitted(std::max(ret, 0), false);
+        probe_->after_wait(count);
+    }
+    trace_ready();
+    for (unsigned i = 0; i < count; ++i) {
+        IoOp* op = reinterpret_cast<IoOp*>(cqes_[i]->user_data);
+        ssize_t res = cqes_[i]->res;
+        uint32_t flags = cqes_[i]->flags;
+        // release the slot first: the resumed coroutine may queue its next op right away
+        io_uring_cqe_seen(&ring_, cqes_[i]);
+        if (reinterpret_cast<uint64_t>(op) == kCancelMarker) {
+            continue;   // the cancelled op reports in its own completion
+        }
+        if (!op) {
+            if (res < 0) {
+                Logger::error("Failed to provide lent buffer: ", strerror(-res));
+            }
+            continue;
+        }
+
+        if (op->kind == IoOp::Kind::Read && (flags & IORING_CQE_F_BUFFER)) {
+            uint16_t buffer_id = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+            op->buffer = lent_buffers_[buffer_id];
+            returned_.push_back(buffer_id);
+        } else if (op->kind == IoOp::Kind::Read && res == -ENOBUFS && submit(op)) {
+            continue;   // group ran dry; the buffers returned above are queued ahead
+        } else if (op->kind == IoOp::Kind::Write && res > 0) {
+            op->done += res;
+            if (op->done < op->length) {
+                if (submit(op)) continue;   // short send, keep going without waking the handler
+                res = -EBUSY;
+            } else {
+                res = static_cast<ssize_t>(op->length);
+            }
+        } else if (op->kind == IoOp::Kind::Sleep && res == -ETIME) {
+            res = 0;
+        }
+        op->result = res;
+        op->handle.resume();
+    }
+}
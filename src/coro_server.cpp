@@ -0,0 +1,146 @@
+#include "server.hpp"
+
+
+template<typename Reactor>
+void CoroServer<Reactor>::run(uint16_t port){
+    if (!reactor_.init()) {
+        Logger::error("Failed to initialize ", get_name(), " reactor");
+        return;
+    }
+
+    auto server_fd_opt = init_socket(port, get_name());
+    if (!server_fd_opt.has_value()) {
+        Logger::error("Failed to create socket");
+        return;
+    }
+    server_fd_ = std::move(server_fd_opt.value());
+    set_non_blocking(server_fd_.get());
+    if (!reactor_.add(server_fd_.get()) || !reactor_.add(stop_fd_.get())) {
+        Logger::error("Failed to register server socket");
+        return;
+    }
+
+    completion_io_ = std::is_same_v<Reactor, IOUringReactor>;
+    LoopProbe probe(loop_stats_);
+    reactor_.set_probe(&probe);
+    loop_probe_ = &probe;
+    accept_loop();
+    drain();
+    while (running_ && !drained_) {
+        reactor_.run_once();
+    }
+    reactor_.set_probe(nullptr);
+    loop_probe_ = nullptr;
+    Logger::info("Server stopped");
+    stop_service();
+}
+
+template<typename Reactor>
+Task CoroServer<Reactor>::accept_loop(){
+    while (running_ && !stop_requested()) {
+        auto accept = accept_on(reactor_, server_fd_.get());
+        accepting_ = &accept.op;
+        int client_fd = static_cast<int>(co_await accept);
+        accepting_ = nullptr;
+        if (client_fd < 0) {
+            if (client_fd == -EMFILE || client_fd == -ENFILE) {
+                // out of descriptors: back off instead of spinning on the listener
+                Logger::error("Failed to accept connection: ", strerror(-client_fd));
+                co_await sleep_for(reactor_, std::chrono::milliseconds(10));
+            }
+            continue;
+        }
+        if (admit_connection(client_fd)) {
+            handle_client(client_fd);
+        }
+    }
+}
+
+// Waits for the stop, then stops accepting and closes this tick's share of
+// the idle handlers every tick. Past the deadline the rest are cut off.
+template<typename Reactor>
+Task CoroServer<Reactor>::drain(){
+    co_await readable_on(reactor_, stop_fd_.get());
+    // with a successor, it takes the connections still queued
+    if (accepting_) {
+        reactor_.cancel(accepting_);
+    }
+    reactor_.remove(server_fd_.get());
+    server_fd_ = SocketRAII();
+    Logger::info(get_name(), " draining ", idle_.size(), " connections");
+    DrainTimer drain = start_drain();
+    while (running_ && !idle_.empty() && !drain.expired()) {
+        std::vector<int> idle;
+        for (auto [fd, waiting] : idle_) {
+            if (waiting) {
+                idle.push_back(fd);
+            }
+        }
+        size_t quota = drain.quota(idle.size());
+        for (size_t i = 0; i < quota; ++i) {
+            shutdown(idle[i], SHUT_RD);     // its read returns 0 and the handler closes
+        }
+        co_await sleep_for(reactor_, kDrainTick);
+    }
+    for (auto& [fd, waiting] : idle_) {
+        shutdown(fd, SHUT_RDWR);
+    }
+    while (running_ && !idle_.empty()) {
+        co_await sleep_for(reactor_, kDrainTick);
+    }
+    drained_ = true;
+}
+
+template<typename Reactor>
+Task CoroServer<Reactor>::handle_client(int client_fd){
+    CoSocket<Reactor> conn(reactor_, client_fd);
+    if (!reactor_.add(client_fd)) {
+        Logger::error("Failed to register client socket");
+        co_return;
+    }
+    active_connections_++;
+
+    PooledBuffer in;
+    PooledBuffer out;   // borrowed only while a reply is being written
+    while (running_) {
+        idle_[client_fd] = in.empty();
+        std::string_view data = co_await conn.read();
+        idle_[client_fd] = false;
+        recv_calls_++;
+        if (data.empty()) {
+            break;
+        }
+        trace_recv();
+        // reply_ is shared by all handlers, so it is copied out before suspending
+        reply_.clear();
+        bool close_after = false;
+        bool within_limit = process_input(in, data, reply_, client_fd, nullptr, &close_after);
+        if (!reply_.empty()) {
+            out.append(reply_);
+            // a seqpacket peer reads one record of at most max_record_size at a time
+            std::string_view pending = out.view();
+            size_t record = config_.max_record_size > 0 ? config_.max_record_size : pending.size();
+            bool failed = false;
+            while (!pending.empty() && !failed) {
+                std::string_view piece = pending.substr(0, record);
+                send_calls_++;
+                failed = co_await conn.write(piece) < 0;
+                pending.remove_prefix(piece.size());
+            }
+            if (failed) {
+                break;
+            }
+            trace_sent(client_fd);
+            out.clear();
+        }
+        if (!within_limit || close_after) {
+            break;
+        }
+    }
+    idle_.erase(client_fd);
+    active_connections_--;
+    trace_closed(client_fd);
+}
+
+template class CoroServer<EpollReactor>;
+template class CoroServer<IOUringReactor>;
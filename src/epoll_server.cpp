@@ -5,7 +5,18 @@
 
 
 void EpollServer::run(uint16_t port){
-    auto server_fd_opt = init_socket(port, get_name());
+    if (config_.transport == Transport::Udp) {
+        run_udp(port);
+        return;
+    }
+    // before init_socket: the stats thread it starts reads pubsub_
+    if (config_.protocol == Protocol::PubSub) {
+        pubsub_ = std::make_unique<PubSubHub>([this](int client_fd, const SharedBuffer& message) {
+            return deliver_fanout(client_fd, message);
+        });
+    }
+    // offload workers share the cache with each other
+    auto server_fd_opt = init_socket(port, get_name(), config_.offload_workers > 0 ? kKvLockStripes : 0);
     if (!server_fd_opt.has_value()) {
         Logger::error("Failed to create socket");
         return;
@@ -27,9 +38,59 @@ void EpollServer::run(uint16_t port){
         close(epoll_fd);
         return;
     }
+    int completions_fd = -1;
+    if (config_.offload_workers > 0 && !config_.splice_echo) {
+        completions_ = std::make_unique<OffloadCompletions>();
+        completions_fd = completions_->event_fd();
+        event.events = EPOLLIN;
+        event.data.fd = completions_fd;
+        if (completions_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, completions_fd, &event) == -1) {
+            Logger::error("Failed to set up the offload completion eventfd");
+            close(epoll_fd);
+            return;
+        }
+        start_offload();
+    }
+    int log_fd = -1;
+    if (log_) {
+        // fdatasync blocks, so it runs on the log's syncer thread
+        if (!log_->start_syncer()) {
+            Logger::error("Failed to start the message log syncer");
+            close(epoll_fd);
+            return;
+        }
+        log_fd = log_->sync_event_fd();
+        event.events = EPOLLIN;
+        event.data.fd = log_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, log_fd, &event) == -1) {
+            Logger::error("Failed to add the message log eventfd to epoll");
+            close(epoll_fd);
+            return;
+        }
+    }
+    // level-triggered and never reset: deregistered once it has been seen
+    event.events = EPOLLIN;
+    event.data.fd = stop_fd_.get();
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd_.get(), &event) == -1) {
+        Logger::error("Failed to add the stop eventfd to epoll");
+        close(epoll_fd);
+        return;
+    }
+    bool draining = false;
+    DrainTimer drain{};
     std::vector<epoll_event> events(1024);
+    LoopProbe probe(loop_stats_);
+    loop_probe_ = &probe;
     while(running_){
-        int nready = epoll_wait(epoll_fd, events.data(), events.size(), -1);
+        probe.before_wait();
+        // connections left with unread input must not wait for a new edge, and
+        // a draining loop wakes every tick to close idle connections
+        int timeout = !ready_.empty() ? 0 : draining ? static_cast<int>(kDrainTick.count()) : -1;
+        int nready = epoll_wait(epoll_fd, events.data(), events.size(), timeout);
+        probe.after_wait(std::max(nready, 0));
+        trace_ready();
+        // their turn comes after this batch; ones that run out of budget in it wait for the next
+        serving_.swap(ready_);
         if (nready == -1) {
             if (running_) {
                 Logger::error("Failed to wait for events");
@@ -40,20 +101,115 @@ void EpollServer::run(uint16_t port){
 
             if (fd == server_fd.get()) {
                 handle_new_connection(epoll_fd, server_fd.get());
-            } else {
-                if (!handle_client_data(fd)) {
-                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
-                    close(fd);
-                    active_connections_--;
+                continue;
+            }
+            if (fd == completions_fd) {
+                completions_->drain([this, epoll_fd](OffloadJob& job) {
+                    finish_offload(epoll_fd, job);
+                });
+                continue;
+            }
+            if (fd == log_fd) {
+                release_held();
+                continue;
+            }
+            if (fd == stop_fd_.get()) {
+                // no more accepts; with a successor, it takes the connections still queued
+                draining = true;
+                drain = start_drain();
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, stop_fd_.get(), nullptr);
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, server_fd.get(), nullptr);
+                server_fd = SocketRAII();
+                Logger::info(get_name(), " draining ", connections_.size(), " connections");
+                continue;
+            }
+
+            auto it = connections_.find(fd);
+            if (it == connections_.end()) {
+                continue;
+            }
+            Connection* conn = it->second.get();
+            if (conn->closing) {
+                // only its zerocopy completions are still awaited
+                close_connection(epoll_fd, fd);
+                continue;
+            }
+
+            if (events[i].events & EPOLLERR) {
+                // zerocopy completions are reported on the error queue
+                handle_zerocopy_completions(conn);
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+                    close_connection(epoll_fd, fd);
+                    continue;
+                }
+            }
+            if (config_.splice_echo) {
+                if ((events[i].events & (EPOLLIN | EPOLLOUT)) && !relay_spliced(conn)) {
+                    close_connection(epoll_fd, fd);
+                }
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                if (!flush_output(conn)) {
+                    close_connection(epoll_fd, fd);
+                    continue;
+                }
+            }
+            if ((events[i].events & EPOLLIN) && !conn->ready_listed) {
+                if (!handle_client_data(conn)) {
+                    close_connection(epoll_fd, fd);
                 }
             }
         }
+        if (!serving_.empty()) {
+            serve_ready(epoll_fd);
+        }
+        // group commit: one sync covers every message this batch appended
+        if (log_) {
+            log_->request_sync();
+        }
+        // one flush per connection for everything this batch produced
+        if (!pending_flush_.empty()) {
+            flush_pending(epoll_fd);
+        }
+        if (draining && !drain_idle(epoll_fd, drain)) {
+            break;
+        }
+    }
+    loop_probe_ = nullptr;
+    ready_.clear();
+    // workers first: a job they still hold belongs to completions_
+    offload_.reset();
+    completions_.reset();
+    log_.reset();
+    for (auto& [fd, conn] : connections_) {
+        close(fd);
     }
+    connections_.clear();
     close(epoll_fd);
     Logger::info("Server stopped");
-    if (stats_thread_.joinable()) {
-        stats_thread_.join();
+    stop_service();
+}
+
+// After every batch while draining: closes the due share, if any, of the
+// connections with nothing read, queued, held or out with a worker. Those
+// with work pending are served as usual and counted idle once it is done.
+// False once every connection is closed or the deadline has passed.
+bool EpollServer::drain_idle(int epoll_fd, DrainTimer& drain){
+    std::vector<int> idle;
+    for (const auto& [fd, conn] : connections_) {
+        if (conn->in.empty() && conn->out.empty() && conn->zc_pinned.empty() && conn->pipe_bytes == 0 &&
+            !conn->offloading && !conn->ready_listed && !conn->flush_pending && !conn->held_listed) {
+            idle.push_back(fd);
+        }
     }
+    size_t quota = drain.quota(idle.size());
+    for (size_t i = 0; i < quota; ++i) {
+        close_connection(epoll_fd, idle[i]);
+    }
+    return !connections_.empty() && !drain.expired();
 }
 
 void EpollServer::handle_new_connection(int epoll_fd, int server_fd){
@@ -65,11 +221,21 @@ void EpollServer::handle_new_connection(int epoll_fd, int server_fd){
         Logger::error("Failed to accept new connection");
         return;
     }
+    if (!admit_connection(client_fd)) {
+        return;
+    }
 
     set_non_blocking(client_fd);
 
+    bool zerocopy = false;
+    if (config_.zerocopy_threshold > 0) {
+        int one = 1;
+        zerocopy = setsockopt(client_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+    }
+
+    // EPOLLOUT is edge-triggered too, so it only fires when a full send buffer drains
     epoll_event event;
-    event.events = EPOLLIN | EPOLLET;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
     event.data.fd = client_fd;
 
     if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event) == -1) {
@@ -77,17 +243,82 @@ void EpollServer::handle_new_connection(int epoll_fd, int server_fd){
         close(client_fd);
         return;
     }
+    auto conn = std::make_unique<Connection>(client_fd, zerocopy);
+    conn->id = ++next_connection_id_;
+    if (config_.splice_echo && !make_pipe(conn->pipe_rd, conn->pipe_wr)) {
+        Logger::error("Failed to create splice pipe");
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, nullptr);
+        close(client_fd);
+        return;
+    }
+    connections_[client_fd] = std::move(conn);
     active_connections_++;
 }
 
+// A connection with MSG_ZEROCOPY sends the error queue has not reported
+// complete is only shut down: the kernel may still be sending from their
+// buffers, so they stay pinned, and the socket stays open and registered for
+// the EPOLLERR that reports them (as io_uring's cleanup_client waits for
+// its notifications). It is closed once the last one has completed.
+void EpollServer::close_connection(int epoll_fd, int client_fd){
+    auto it = connections_.find(client_fd);
+    if (it == connections_.end()) {
+        return;
+    }
+    Connection* conn = it->second.get();
+    if (!conn->closing) {
+        conn->closing = true;
+        active_connections_--;
+        trace_closed(client_fd);
+        if (pubsub_) {
+            pubsub_->remove_client(client_fd);
+        }
+        pin_partial_zerocopy(conn, false);
+        conn->out.clear();
+        conn->out_bytes = 0;
+        conn->ready_listed = false;
+        conn->held_listed = false;
+    }
+    handle_zerocopy_completions(conn);
+    if (!conn->zc_pinned.empty()) {
+        shutdown(client_fd, SHUT_RDWR);
+        return;
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, nullptr);
+    connections_.erase(it);
+    close(client_fd);
+}
+
 
-bool EpollServer::handle_client_data(int client_fd){
-    char buffer[1024];
-    ssize_t total_read = 0;
+bool EpollServer::handle_client_data(Connection* conn){
+    if (conn->last_reply) {
+        return true; // input after the last request is never read
+    }
+    if (conn->offloading) {
+        // one job per connection at a time keeps its replies in order; the
+        // rest of its input stays in the socket until the job is back
+        conn->read_paused = true;
+        return true;
+    }
+    // offloading: the complete messages of every recv go into one job
+    OffloadJob* job = completions_ ? completions_->acquire() : nullptr;
+    char buffer[kReadChunk];
+    bool peer_closed = false;
+    size_t budget = config_.read_budget > 0 ? config_.read_budget : SIZE_MAX;
+    size_t read_total = 0;
 
+    reply_.clear();
+    file_sends_.clear();
     while(true){
-        ssize_t bytes_read = recv(client_fd, buffer + total_read, 
-            sizeof(buffer) - total_read - 1, 0);
+        if (read_total >= budget) {
+            // a firehose client yields here; serve_ready picks it up again
+            conn->ready_listed = true;
+            ready_.push_back(conn->fd);
+            budget_exhausted_.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        ssize_t bytes_read = recv(conn->fd, buffer, sizeof(buffer), 0);
+        recv_calls_++;
         if (bytes_read == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 break;
@@ -95,25 +326,508 @@ bool EpollServer::handle_client_data(int client_fd){
             return false;
         }
         if (bytes_read == 0) {
-            return true;
+            peer_closed = true;
+            break;
+        }
+        trace_recv();
+        read_total += bytes_read;
+        std::string_view data(buffer, bytes_read);
+        bool within_limit = job ? frame_input(conn->in, data, conn->fd, [job](std::string_view messages) {
+                                      job->input += messages;
+                                  })
+                                : process_input(conn->in, data, reply_, conn->fd, &file_sends_, &conn->last_reply);
+        if (!within_limit) {
+            Logger::error("Client-", conn->fd, " sent an oversized or malformed message");
+            if (job) {
+                completions_->release(job);
+            }
+            return false;
         }
-        total_read += bytes_read;
-        if (total_read > 0 && buffer[total_read - 1] == '\n') {
+        if (conn->last_reply) {
             break;
         }
     }
 
-    if (total_read > 0) {
-        buffer[total_read] = '\0';
-        std::string response = "Echo[" + std::to_string(total_messages_.load(std::memory_order_relaxed)) + "]:" + std::string(buffer);
-        if (buffer[total_read - 1] == '\n') {
-            response.pop_back();
+    if (job) {
+        if (job->input.empty()) {
+            completions_->release(job);
+        } else {
+            submit_offload(conn, job);
+        }
+    }
+    if (!reply_.empty()) {
+        queue_reply(conn, reply_, &file_sends_);
+    }
+    if (peer_closed) {
+        if (conn->offloading) {
+            conn->read_closed = true;   // its replies are still to come
+            return true;
+        }
+        flush_output(conn); // last replies before the close, best effort
+        return false;
+    }
+    return true;
+}
+
+// Held until the end of the batch, then written together with any fan-out.
+// Static file bodies split the reply into chunks of bytes and file chunks.
+void EpollServer::queue_reply(Connection* conn, std::string_view reply, const std::vector<FileSend>* files){
+    auto queue_bytes = [&](std::string_view bytes) {
+        if (bytes.empty()) {
+            return;
+        }
+        OutChunk chunk;
+        chunk.data.append(bytes);
+        chunk.zerocopy = conn->zerocopy && bytes.size() >= config_.zerocopy_threshold;
+        // covers the messages of this reply, they were appended before it was built
+        chunk.log_seq = log_ ? log_->appended() : 0;
+        conn->out_bytes += bytes.size();
+        conn->out.push_back(std::move(chunk));
+    };
+    size_t queued = 0;
+    if (files) {
+        for (const FileSend& file : *files) {
+            queue_bytes(reply.substr(queued, file.at - queued));
+            queued = file.at;
+            OutChunk chunk;
+            chunk.file = file.file;
+            conn->out_bytes += file.file->size;
+            conn->out.push_back(std::move(chunk));
+        }
+    }
+    queue_bytes(reply.substr(queued));
+    schedule_flush(conn);
+}
+
+void EpollServer::submit_offload(Connection* conn, OffloadJob* job){
+    job->fd = conn->fd;
+    job->connection_id = conn->id;
+    job->shed = config_.busy_reply && overloaded();
+    conn->offloading = true;
+    offloaded_jobs_.fetch_add(1, std::memory_order_relaxed);
+    offload_->submit(job);
+}
+
+// A worker finished a job: queue its replies and let the connection read again.
+void EpollServer::finish_offload(int epoll_fd, OffloadJob& job){
+    auto it = connections_.find(job.fd);
+    if (it == connections_.end() || it->second->id != job.connection_id || it->second->closing) {
+        return; // closed while the job was out
+    }
+    Connection* conn = it->second.get();
+    conn->offloading = false;
+    if (!job.output.empty()) {
+        queue_reply(conn, job.output);
+    }
+    if (conn->read_closed) {
+        flush_output(conn);
+        close_connection(epoll_fd, conn->fd);
+        return;
+    }
+    if (conn->read_paused) {
+        // no new edge comes for input that was already there
+        conn->read_paused = false;
+        if (!conn->ready_listed) {
+            conn->ready_listed = true;
+            ready_.push_back(conn->fd);
+        }
+    }
+}
+
+// One more budget's worth of input for every connection that ran out of budget
+// in the previous iteration, round-robin, before the loop waits again.
+void EpollServer::serve_ready(int epoll_fd){
+    for (int fd : serving_) {
+        auto it = connections_.find(fd);
+        // closed meanwhile, or the fd was reused by a connection that is not listed
+        if (it == connections_.end() || !it->second->ready_listed) {
+            continue;
+        }
+        Connection* conn = it->second.get();
+        conn->ready_listed = false;
+        if (!handle_client_data(conn)) {
+            close_connection(epoll_fd, fd);
+        }
+    }
+    serving_.clear();
+}
+
+// Bulk-stream echo: the payload goes socket -> pipe -> socket inside the kernel
+// and never touches a user-space buffer. Called for both EPOLLIN and EPOLLOUT.
+bool EpollServer::relay_spliced(Connection* conn){
+    while (true) {
+        while (conn->pipe_bytes > 0) {
+            ssize_t out = splice(conn->pipe_rd.get(), nullptr, conn->fd, nullptr,
+                conn->pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (out == -1) {
+                // socket buffer full: stop reading and resume on EPOLLOUT
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            conn->pipe_bytes -= out;
+            spliced_bytes_ += out;
+        }
+
+        ssize_t in = splice(conn->fd, nullptr, conn->pipe_wr.get(), nullptr,
+            kSpliceChunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (in == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (in == 0) {
+            return false; // peer closed
+        }
+        conn->pipe_bytes += in;
+    }
+}
+
+// Writes the queue with as few syscalls as possible: runs of copying chunks go
+// out in one sendmsg, each zerocopy chunk in its own. MSG_MORE is set while
+// more of the batch follows, so the kernel does not push a segment per call.
+// Replies to messages the log has not synced yet stay queued until it has.
+// A static file body goes out with sendfile, between the runs before and after it.
+// False when the connection is to be closed: a send failed, or its last reply is out.
+bool EpollServer::flush_output(Connection* conn){
+    uint64_t durable = log_ ? log_->durable() : 0;
+    while (!conn->out.empty()) {
+        if (conn->out.front().file) {
+            if (!send_file_chunk(conn)) {
+                return false;
+            }
+            if (!conn->out.empty() && conn->out.front().file) {
+                return true; // socket buffer full, resumed on EPOLLOUT
+            }
+            continue;
         }
-        if (::send(client_fd, response.c_str(), response.size(), 0) == -1) {
+        iovec iov[kMaxIov];
+        size_t iov_count = 0;
+        size_t batch_bytes = 0;
+        bool held = false;
+        bool zerocopy = conn->out.front().zerocopy;
+        for (const OutChunk& chunk : conn->out) {
+            if (chunk.log_seq > durable) {
+                held = true;
+                break;
+            }
+            if (iov_count == kMaxIov || chunk.file || chunk.zerocopy != zerocopy || (zerocopy && iov_count == 1)) {
+                break;
+            }
+            std::string_view bytes = chunk.bytes();
+            iov[iov_count].iov_base = const_cast<char*>(bytes.data() + chunk.offset);
+            iov[iov_count].iov_len = bytes.size() - chunk.offset;
+            batch_bytes += iov[iov_count].iov_len;
+            iov_count++;
+        }
+        if (held && !conn->held_listed) {
+            conn->held_listed = true;
+            held_.push_back(conn->fd);
+        }
+        if (iov_count == 0) {
+            // sent by release_held once the log caught up; never, after a failed sync
+            return !(log_ && log_->failed());
+        }
+        if (config_.max_record_size > 0 && batch_bytes > config_.max_record_size) {
+            // seqpacket: a send is one record, and the peer reads one record at a time
+            iov_count = clamp_iov(iov, iov_count, config_.max_record_size);
+            batch_bytes = config_.max_record_size;
+        }
+
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+        int flags = MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0);
+        // the held rest does not follow any time soon
+        if (batch_bytes < conn->out_bytes && !held) {
+            flags |= MSG_MORE;
+        }
+        ssize_t sent = ::sendmsg(conn->fd, &msg, flags);
+        send_calls_++;
+        if (sent == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true; // resumed on EPOLLOUT
+            }
+            if (errno == ENOBUFS && zerocopy) {
+                // optmem limit reached for zerocopy notifications, copy this one
+                if (conn->out.front().offset > 0) {
+                    pin_partial_zerocopy(conn, true);
+                } else {
+                    conn->out.front().zerocopy = false;
+                }
+                continue;
+            }
             Logger::error("Failed to send response to client");
             return false;
         }
-        total_messages_++;
+        trace_sent(conn->fd);
+        if (zerocopy) {
+            conn->zc_next_seq++;
+            zerocopy_sends_++;
+        }
+        conn->out_bytes -= sent;
+        size_t left = sent;
+        while (left > 0) {
+            OutChunk& chunk = conn->out.front();
+            size_t remaining = chunk.bytes().size() - chunk.offset;
+            if (left < remaining) {
+                chunk.offset += left;
+                break;
+            }
+            left -= remaining;
+            if (chunk.zerocopy) {
+                conn->zc_pinned.emplace_back(conn->zc_next_seq - 1, std::move(chunk));
+            }
+            conn->out.pop_front();
+        }
+        if (static_cast<size_t>(sent) < batch_bytes) {
+            return true; // socket buffer full, resumed on EPOLLOUT
+        }
+    }
+    return !conn->last_reply;
+}
+
+// Sends the file body at the front of the queue from where the last call
+// stopped. Leaves it at the front when the socket buffer fills up first.
+bool EpollServer::send_file_chunk(Connection* conn){
+    OutChunk& chunk = conn->out.front();
+    while (chunk.offset < chunk.file->size) {
+        size_t count = std::min(chunk.file->size - chunk.offset, sendfile_chunk());
+        off_t offset = static_cast<off_t>(chunk.offset);
+        ssize_t sent = ::sendfile(conn->fd, chunk.file->fd.get(), &offset, count);
+        send_calls_++;
+        if (sent == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            Logger::error("Failed to send a static file to client");
+            return false;
+        }
+        if (sent == 0) {
+            Logger::error("Static file truncated while being sent, closing Client-", conn->fd);
+            return false;
+        }
+        trace_sent(conn->fd);
+        chunk.offset += sent;
+        conn->out_bytes -= sent;
+        spliced_bytes_ += sent;
     }
+    conn->out.pop_front();
     return true;
-}
\ No newline at end of file
+}
+
+// The log synced another batch: the connections holding replies for it get
+// flushed with the rest at the end of this batch. After a failed sync that
+// flush closes them instead.
+void EpollServer::release_held(){
+    uint64_t count;
+    [[maybe_unused]] ssize_t n = ::read(log_->sync_event_fd(), &count, sizeof(count));
+    for (int fd : held_) {
+        auto it = connections_.find(fd);
+        if (it == connections_.end() || !it->second->held_listed) {
+            continue;
+        }
+        it->second->held_listed = false;
+        schedule_flush(it->second.get());
+    }
+    held_.clear();
+}
+
+void EpollServer::schedule_flush(Connection* conn){
+    if (!conn->flush_pending) {
+        conn->flush_pending = true;
+        pending_flush_.push_back(conn->fd);
+    }
+}
+
+// Queues a published message by reference; the actual send happens in
+// flush_pending at the end of the event batch.
+Delivery EpollServer::deliver_fanout(int client_fd, const SharedBuffer& message){
+    auto it = connections_.find(client_fd);
+    if (it == connections_.end() || it->second->overflowed || it->second->closing) {
+        return Delivery::Dropped;
+    }
+    Connection* conn = it->second.get();
+    schedule_flush(conn);
+    if (conn->out_bytes + message->size() > config_.subscriber_queue_limit) {
+        if (config_.slow_subscriber_policy == SlowSubscriberPolicy::Drop) {
+            return Delivery::Dropped;
+        }
+        conn->overflowed = true;
+        return Delivery::Overflow;
+    }
+    OutChunk chunk;
+    chunk.shared = message;
+    chunk.zerocopy = conn->zerocopy && message->size() >= config_.zerocopy_threshold;
+    conn->out_bytes += message->size();
+    conn->out.push_back(std::move(chunk));
+    return Delivery::Queued;
+}
+
+// A zerocopy chunk at the front that went out in part: the kernel may still
+// read the sent part, so the chunk is pinned under the id of its last send.
+// With `keep_rest` its unsent bytes stay queued as a copying chunk.
+void EpollServer::pin_partial_zerocopy(Connection* conn, bool keep_rest){
+    if (conn->out.empty() || !conn->out.front().zerocopy || conn->out.front().offset == 0) {
+        return;
+    }
+    OutChunk& chunk = conn->out.front();
+    OutChunk rest;
+    if (keep_rest) {
+        rest.data.append(chunk.bytes().substr(chunk.offset));
+        rest.log_seq = chunk.log_seq;
+    }
+    conn->zc_pinned.emplace_back(conn->zc_next_seq - 1, std::move(chunk));
+    if (keep_rest) {
+        conn->out.front() = std::move(rest);
+    } else {
+        conn->out.pop_front();
+    }
+}
+
+void EpollServer::flush_pending(int epoll_fd){
+    // swap with a second list, so both keep their capacity across batches
+    flushing_.swap(pending_flush_);
+    for (int fd : flushing_) {
+        auto it = connections_.find(fd);
+        if (it == connections_.end()) continue;
+        Connection* conn = it->second.get();
+        conn->flush_pending = false;
+        if (conn->closing) {
+            continue;
+        }
+        if (conn->overflowed || !flush_output(conn)) {
+            close_connection(epoll_fd, fd);
+        }
+    }
+    flushing_.clear();
+}
+
+void EpollServer::handle_zerocopy_completions(Connection* conn){
+    char control[128];
+    while (true) {
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(conn->fd, &msg, MSG_ERRQUEUE) == -1) {
+            return; // EAGAIN: error queue drained
+        }
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+            auto* serr = reinterpret_cast<sock_extended_err*>(CMSG_DATA(cm));
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // [ee_info, ee_data] is the range of completed send ids; TCP completes
+            // them in order, so everything up to ee_data can be released
+            uint32_t last = serr->ee_data;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                zerocopy_copied_ += last - serr->ee_info + 1;
+            }
+            while (!conn->zc_pinned.empty() &&
+                   static_cast<int32_t>(conn->zc_pinned.front().first - last) <= 0) {
+                conn->zc_pinned.pop_front();
+            }
+        }
+    }
+}
+
+
+// UDP: one loop thread per SO_REUSEPORT socket, nothing shared but the cache.
+void EpollServer::run_udp(uint16_t port){
+    std::vector<SocketRAII> sockets;
+    for (size_t i = 0; i < config_.udp_sockets; ++i) {
+        auto socket_opt = open_udp_socket(port);
+        if (!socket_opt.has_value()) {
+            return;
+        }
+        sockets.push_back(std::move(socket_opt.value()));
+    }
+    if (!start_service("udp port " + std::to_string(port), get_name(), sockets.size() > 1 ? kKvLockStripes : 0)) {
+        return;
+    }
+
+    std::vector<std::thread> loops;
+    for (size_t i = 1; i < sockets.size(); ++i) {
+        loops.emplace_back([this, fd = sockets[i].get()] { udp_loop(fd); });
+    }
+    udp_loop(sockets[0].get());
+    for (auto& loop : loops) {
+        loop.join();
+    }
+    stop_service();
+}
+
+// Datagrams have nothing to drain: a loop returns as soon as a stop is requested.
+void EpollServer::udp_loop(int socket_fd){
+    SocketRAII epoll_fd(epoll_create1(EPOLL_CLOEXEC));
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = socket_fd;
+    if (epoll_fd.get() == -1 || epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, socket_fd, &event) == -1) {
+        Logger::error("Failed to add UDP socket to epoll");
+        return;
+    }
+    event.events = EPOLLIN;
+    event.data.fd = stop_fd_.get();
+    if (epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, stop_fd_.get(), &event) == -1) {
+        Logger::error("Failed to add the stop eventfd to epoll");
+        return;
+    }
+
+    UdpRecvBatch batch;
+    UdpReplies replies(config_.udp_gso);
+    LoopProbe probe(loop_stats_);
+    while (running_) {
+        probe.before_wait();
+        int nready = epoll_wait(epoll_fd.get(), &event, 1, -1);
+        probe.after_wait(std::max(nready, 0));
+        if (nready == -1) {
+            continue;
+        }
+        if (event.data.fd == stop_fd_.get()) {
+            break;
+        }
+        trace_ready();
+        // edge-triggered: drain the socket, a full batch at a time
+        while (true) {
+            int count = recvmmsg(socket_fd, batch.headers(), kUdpBatch, MSG_DONTWAIT, nullptr);
+            recv_calls_++;
+            if (count <= 0) {
+                if (count == -1 && errno != EAGAIN && errno != EINTR) {
+                    Logger::error("recvmmsg failed: ", strerror(errno));
+                }
+                break;
+            }
+            trace_recv();
+            for (int slot = 0; slot < count; ++slot) {
+                process_datagrams(batch, slot, batch.headers()[slot].msg_len, replies, socket_fd);
+                batch.reset(slot);
+            }
+            send_udp_replies(socket_fd, replies);
+            if (static_cast<size_t>(count) < kUdpBatch) {
+                break;
+            }
+        }
+    }
+}
+
+void EpollServer::send_udp_replies(int socket_fd, UdpReplies& replies){
+    size_t count = replies.build();
+    size_t next = 0;
+    while (next < count) {
+        int sent = sendmmsg(socket_fd, replies.headers() + next, count - next, 0);
+        send_calls_++;
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == ENOBUFS) {
+                break;      // socket buffer full: the rest of the batch is lost, as on the wire
+            }
+            ++next;         // this peer or message was refused, carry on with the others
+            continue;
+        }
+        trace_sent(socket_fd);
+        for (int i = 0; i < sent; ++i) {
+            datagrams_out_.fetch_add(replies.datagrams(next + i), std::memory_order_relaxed);
+        }
+        next += sent;
+    }
+    replies.clear();
+}
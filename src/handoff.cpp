@@ -0,0 +1,159 @@
+#include "handoff.hpp"
+
+#include <sys/eventfd.h>
+
+
+namespace {
+
+constexpr char kListenerByte = 'L';
+constexpr char kReadyByte = 'R';
+// a successor that has not confirmed by then is given up on
+constexpr int kConfirmTimeoutMs = 30000;
+
+bool make_address(const std::string& path, sockaddr_un& addr) {
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        Logger::error("Handoff socket path too long: ", path);
+        return false;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+} // namespace
+
+
+HandoffServer::HandoffServer() : stop_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+HandoffServer::~HandoffServer() {
+    if (thread_.joinable()) {
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t n = ::write(stop_fd_.get(), &one, sizeof(one));
+        thread_.join();
+    }
+}
+
+bool HandoffServer::start(const std::string& path, int listener, std::function<void()> handed_over) {
+    sockaddr_un addr;
+    if (stop_fd_.get() == -1 || !make_address(path, addr)) {
+        return false;
+    }
+    socket_ = SocketRAII(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (socket_.get() == -1) {
+        Logger::error("Failed to create handoff socket");
+        return false;
+    }
+    // a predecessor's socket file is replaced; it already handed over, or is about to
+    struct stat st;
+    if (::stat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        ::unlink(addr.sun_path);
+    }
+    if (::bind(socket_.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1 ||
+        ::listen(socket_.get(), 1) == -1) {
+        Logger::error("Failed to listen for a successor on ", path, ": ", strerror(errno));
+        return false;
+    }
+    listener_ = listener;
+    handed_over_ = std::move(handed_over);
+    thread_ = std::thread([this] { serve(); });
+    Logger::info("Waiting for a successor on ", path);
+    return true;
+}
+
+void HandoffServer::serve() {
+    while (wait_readable(socket_.get(), -1)) {
+        SocketRAII channel(::accept4(socket_.get(), nullptr, nullptr, SOCK_CLOEXEC));
+        if (channel.get() == -1) {
+            continue;
+        }
+        if (hand_over(channel.get())) {
+            handed_over_();
+            return;     // one handoff per process: the listener now belongs to the successor
+        }
+    }
+}
+
+bool HandoffServer::hand_over(int channel) {
+    char byte = kListenerByte;
+    iovec iov{&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cm), &listener_, sizeof(int));
+    if (::sendmsg(channel, &msg, MSG_NOSIGNAL) != 1) {
+        Logger::error("Failed to pass the listener to a successor: ", strerror(errno));
+        return false;
+    }
+    Logger::info("Listener passed to a successor, waiting for it to confirm");
+    char answer = 0;
+    if (!wait_readable(channel, kConfirmTimeoutMs) || ::recv(channel, &answer, 1, 0) != 1 || answer != kReadyByte) {
+        Logger::error("Successor went away before confirming, still serving");
+        return false;
+    }
+    Logger::info("Successor confirmed, draining");
+    return true;
+}
+
+bool HandoffServer::wait_readable(int fd, int timeout_ms) {
+    pollfd fds[2] = {{fd, POLLIN, 0}, {stop_fd_.get(), POLLIN, 0}};
+    while (true) {
+        int ready = ::poll(fds, 2, timeout_ms);
+        if (ready == -1 && errno == EINTR) {
+            continue;
+        }
+        return ready > 0 && !(fds[1].revents & POLLIN);
+    }
+}
+
+
+std::optional<int> take_over_listener(const std::string& path, SocketRAII& channel) {
+    sockaddr_un addr;
+    if (!make_address(path, addr)) {
+        return std::nullopt;
+    }
+    channel = SocketRAII(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (channel.get() == -1 ||
+        ::connect(channel.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+        Logger::error("No server to take over from on ", path, ": ", strerror(errno));
+        return std::nullopt;
+    }
+    char byte = 0;
+    iovec iov{&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(channel.get(), &msg, MSG_CMSG_CLOEXEC) != 1 || byte != kListenerByte) {
+        Logger::error("The server on ", path, " did not pass its listener");
+        return std::nullopt;
+    }
+    cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    if (cm == nullptr || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS ||
+        cm->cmsg_len != CMSG_LEN(sizeof(int))) {
+        Logger::error("The server on ", path, " sent no listener");
+        return std::nullopt;
+    }
+    int listener;
+    std::memcpy(&listener, CMSG_DATA(cm), sizeof(int));
+    return listener;
+}
+
+bool confirm_takeover(SocketRAII& channel) {
+    char byte = kReadyByte;
+    bool sent = ::send(channel.get(), &byte, 1, MSG_NOSIGNAL) == 1;
+    channel = SocketRAII();
+    if (!sent) {
+        Logger::error("Failed to confirm the takeover: ", strerror(errno));
+    }
+    return sent;
+}
@@ -0,0 +1,197 @@
+#include "http.hpp"
+
+#include <ctime>
+
+
+namespace {
+
+constexpr std::string_view kHeaderEnd = "\r\n\r\n";
+
+bool ieq(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+        return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+    });
+}
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+// comma-separated Connection tokens, e.g. "keep-alive, Upgrade"
+bool has_token(std::string_view list, std::string_view token) {
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        if (ieq(trim(list.substr(0, comma)), token)) {
+            return true;
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        list.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+} // namespace
+
+
+HttpParse parse_http_request(std::string_view data, HttpRequest& request) {
+    size_t header_end = data.find(kHeaderEnd);
+    if (header_end == std::string_view::npos) {
+        return HttpParse::Incomplete;
+    }
+    std::string_view head = data.substr(0, header_end + 2);   // every line ends in "\r\n"
+
+    // request line: METHOD SP target SP HTTP/1.x
+    size_t line_end = head.find("\r\n");
+    std::string_view line = head.substr(0, line_end);
+    size_t sp1 = line.find(' ');
+    size_t sp2 = line.rfind(' ');
+    if (sp1 == std::string_view::npos || sp2 == sp1) {
+        return HttpParse::Invalid;
+    }
+    request.method = line.substr(0, sp1);
+    request.target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    std::string_view version = line.substr(sp2 + 1);
+    if (version.size() != 8 || !version.starts_with("HTTP/1.") || (version[7] != '0' && version[7] != '1')) {
+        return HttpParse::Invalid;
+    }
+    request.minor_version = version[7] - '0';
+
+    bool close = false;
+    bool keep_alive = false;
+    size_t content_length = 0;
+    request.header_count = 0;
+    size_t pos = line_end + 2;
+    while (pos < head.size()) {
+        size_t end = head.find("\r\n", pos);
+        std::string_view header = head.substr(pos, end - pos);
+        pos = end + 2;
+        size_t colon = header.find(':');
+        if (colon == std::string_view::npos || colon == 0) {
+            return HttpParse::Invalid;
+        }
+        std::string_view name = header.substr(0, colon);
+        std::string_view value = trim(header.substr(colon + 1));
+        if (request.header_count == HttpRequest::kMaxHeaders) {
+            return HttpParse::Invalid;
+        }
+        request.headers[request.header_count++] = {name, value};
+        if (ieq(name, "Content-Length")) {
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), content_length);
+            if (ec != std::errc{} || ptr != value.data() + value.size()) {
+                return HttpParse::Invalid;
+            }
+        } else if (ieq(name, "Transfer-Encoding")) {
+            return HttpParse::Invalid;  // no chunked bodies in this minimal server
+        } else if (ieq(name, "Connection")) {
+            close = has_token(value, "close");
+            keep_alive = has_token(value, "keep-alive");
+        }
+    }
+    // HTTP/1.1 keeps the connection unless told otherwise, 1.0 only when asked
+    request.keep_alive = request.minor_version == 1 ? !close : keep_alive;
+
+    size_t body_start = header_end + kHeaderEnd.size();
+    if (data.size() - body_start < content_length) {
+        return HttpParse::Incomplete;
+    }
+    request.body = data.substr(body_start, content_length);
+    request.size = body_start + content_length;
+    return HttpParse::Complete;
+}
+
+std::string_view http_date_header() {
+    thread_local time_t cached_second = 0;
+    thread_local char line[64];
+    thread_local size_t length = 0;
+    time_t now = time(nullptr);
+    if (now != cached_second) {
+        tm utc;
+        gmtime_r(&now, &utc);
+        length = strftime(line, sizeof(line), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &utc);
+        cached_second = now;
+    }
+    return {line, length};
+}
+
+
+HttpResponder::HttpResponder(bool echo, size_t fixed_body) : echo_(echo) {
+    constexpr std::string_view kFixedHeaders = "Server: cpp-io-learning\r\nContent-Type: text/plain\r\n";
+    ok_head_ = "HTTP/1.1 200 OK\r\n";
+    ok_head_ += kFixedHeaders;
+    std::string body = fixed_body == 0 ? "Hello, World!" : std::string(fixed_body, 'x');
+    fixed_length_ = "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    fixed_body_ = std::move(body);
+
+    busy_head_ = "HTTP/1.1 503 Service Unavailable\r\n";
+    busy_head_ += kFixedHeaders;
+    busy_head_ += "Retry-After: 1\r\n";
+    busy_length_ = "Content-Length: 5\r\n\r\n";
+    busy_body_ = "BUSY\n";
+
+    file_head_ = "HTTP/1.1 200 OK\r\nServer: cpp-io-learning\r\nContent-Type: application/octet-stream\r\n";
+    not_found_head_ = "HTTP/1.1 404 Not Found\r\n";
+    not_found_head_ += kFixedHeaders;
+    not_found_length_ = "Content-Length: 10\r\n\r\n";
+    not_found_body_ = "Not Found\n";
+}
+
+void HttpResponder::append_connection(const HttpRequest& request, std::string& out) {
+    // only what differs from the version's default is spelled out
+    if (!request.keep_alive) {
+        out += "Connection: close\r\n";
+    } else if (request.minor_version == 0) {
+        out += "Connection: keep-alive\r\n";
+    }
+}
+
+void HttpResponder::append_body(const HttpRequest& request, std::string_view body, std::string& out) {
+    if (request.method != "HEAD") {
+        out += body;
+    }
+}
+
+void HttpResponder::respond(const HttpRequest& request, std::string& out) const {
+    out += ok_head_;
+    out += http_date_header();
+    append_connection(request, out);
+    if (!echo_) {
+        out += fixed_length_;
+        append_body(request, fixed_body_, out);
+        return;
+    }
+    std::string_view body = request.body.empty() ? request.target : request.body;
+    char length[24];
+    auto [end, ec] = std::to_chars(length, length + sizeof(length), body.size());
+    out += "Content-Length: ";
+    out.append(length, end);
+    out += "\r\n\r\n";
+    append_body(request, body, out);
+}
+
+void HttpResponder::respond_busy(const HttpRequest& request, std::string& out) const {
+    out += busy_head_;
+    out += http_date_header();
+    append_connection(request, out);
+    out += busy_length_;
+    append_body(request, busy_body_, out);
+}
+
+void HttpResponder::respond_file(const HttpRequest& request, std::string_view file_headers, std::string& out) const {
+    out += file_head_;
+    out += http_date_header();
+    append_connection(request, out);
+    out += file_headers;
+    out += "\r\n";
+}
+
+void HttpResponder::respond_not_found(const HttpRequest& request, std::string& out) const {
+    out += not_found_head_;
+    out += http_date_header();
+    append_connection(request, out);
+    out += not_found_length_;
+    append_body(request, not_found_body_, out);
+}
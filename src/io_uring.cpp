@@ -1,13 +1,46 @@
 #include "server.hpp"
 
-void IOUringServer::run(uint16_t port){
+// user_data bit for IORING_OP_POLL_ADD entries linked in front of a splice
+static constexpr uint64_t kPollTag = 0x200000000;
+// user_data bit for sends, so they can be told apart from a concurrent recv
+static constexpr uint64_t kWriteTag = 0x400000000;
+// user_data bit for IORING_OP_PROVIDE_BUFFERS, which hand recv buffers back to the kernel
+static constexpr uint64_t kProvideTag = 0x800000000;
+// user_data bit for the read armed on the offload completion eventfd
+static constexpr uint64_t kOffloadTag = 0x1000000000;
+// user_data bit for IORING_OP_FSYNC of message log segments
+static constexpr uint64_t kLogSyncTag = 0x2000000000;
+// user_data of the poll on the stop eventfd; kStopTag | 1 is the accept cancel it submits
+static constexpr uint64_t kStopTag = 0x4000000000;
+// user_data bit for the file -> pipe splice linked in front of a static file's pipe -> socket one
+static constexpr uint64_t kFileTag = 0x8000000000;
 
-    if (io_uring_queue_init(2048, &ring_, IORING_SETUP_SQPOLL) < 0) {
-        Logger::error("Failed to initialize io_uring");
+void IOUringServer::run(uint16_t port){
+    if (config_.transport == Transport::Udp) {
+        run_udp(port);
         return;
     }
 
-    auto server_fd_opt = init_socket(port, get_name());
+    int ret = config_.io_uring_sqpoll ? io_uring_queue_init(kIOUringEntries, &ring_, IORING_SETUP_SQPOLL) : -1;
+    if (ret < 0) {
+        // SQPOLL needs CAP_SYS_NICE before 5.11; a plain ring still beats epoll
+        if (config_.io_uring_sqpoll) {
+            Logger::info("io_uring SQPOLL unavailable (", strerror(-ret), "), submitting from the loop");
+        }
+        if (ret = io_uring_queue_init(kIOUringEntries, &ring_, 0); ret < 0) {
+            Logger::error("Failed to initialize io_uring: ", strerror(-ret));
+            return;
+        }
+    }
+
+    // before init_socket: the stats thread it starts reads pubsub_
+    if (config_.protocol == Protocol::PubSub) {
+        pubsub_ = std::make_unique<PubSubHub>([this](int client_fd, const SharedBuffer& message) {
+            return deliver_fanout(client_fd, message);
+        });
+    }
+    // offload workers share the cache with each other
+    auto server_fd_opt = init_socket(port, get_name(), config_.offload_workers > 0 ? kKvLockStripes : 0);
     if (!server_fd_opt.has_value()) {
         Logger::error("Failed to create socket");
         return;
@@ -16,6 +49,27 @@ void IOUringServer::run(uint16_t port){
 
     set_non_blocking(server_fd_.get());
 
+    if (!config_.splice_echo) {
+        recv_buffers_.resize(kRecvBufferCount);
+        for (unsigned id = 0; id < kRecvBufferCount; ++id) {
+            size_t capacity = 0;
+            recv_buffers_[id] = BufferPool::acquire(kReadChunk, capacity);
+            if (!provide_recv_buffer(static_cast<uint16_t>(id))) {
+                Logger::error("Failed to provide recv buffers");
+                return;
+            }
+        }
+    }
+
+    if (config_.offload_workers > 0 && !config_.splice_echo) {
+        completions_ = std::make_unique<OffloadCompletions>();
+        if (completions_->event_fd() == -1 || !arm_offload_read()) {
+            Logger::error("Failed to set up the offload completion eventfd");
+            return;
+        }
+        start_offload();
+    }
+
     // add server socket to io_uring
     struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
     if (!sqe) {
@@ -26,14 +80,30 @@ void IOUringServer::run(uint16_t port){
     io_uring_prep_accept(sqe, server_fd_.get(), nullptr, nullptr, 0);
     sqe->user_data = 0x100000000;
 
+    sqe = io_uring_get_sqe(&ring_);
+    if (!sqe) {
+        Logger::error("Failed to get sqe");
+        return;
+    }
+    io_uring_prep_poll_add(sqe, stop_fd_.get(), POLLIN);
+    sqe->user_data = kStopTag;
+
     cqes_.resize(2048);
+    completion_io_ = true;
 
+    bool draining = false;
+    DrainTimer drain{};
+    __kernel_timespec tick{0, std::chrono::nanoseconds(kDrainTick).count()};
+    LoopProbe probe(loop_stats_);
+    loop_probe_ = &probe;
     while(running_){
+        probe.before_wait();
         int submitted = io_uring_submit(&ring_);
         if (submitted < 0) {
             Logger::error("Failed to submit io_uring requests: ", strerror(-submitted));
             break;
         }
+        probe.submitted(submitted);
         
         // If no requests were submitted, we might be waiting for completions
         if (submitted == 0) {
@@ -41,23 +111,67 @@ void IOUringServer::run(uint16_t port){
             std::this_thread::sleep_for(std::chrono::microseconds(100));
         }
 
-        int ret = io_uring_wait_cqe(&ring_, &cqes_[0]);
-        if (ret < 0) {
+        // a draining loop wakes every tick to close idle connections
+        int ret = draining ? io_uring_wait_cqe_timeout(&ring_, &cqes_[0], &tick)
+                           : io_uring_wait_cqe(&ring_, &cqes_[0]);
+        if (ret < 0 && ret != -ETIME) {
             Logger::error("Failed to wait for io_uring completions: ", strerror(-ret));
             continue;
         }
 
-        int cqe_count = io_uring_peek_batch_cqe(&ring_, cqes_.data(), cqes_.size());
+        int cqe_count = ret == -ETIME ? 0 : io_uring_peek_batch_cqe(&ring_, cqes_.data(), cqes_.size());
+        trace_ready();
         if (cqe_count < 0){
             cqe_count = 1;
         }
+        probe.after_wait(cqe_count);
 
         for (int i = 0; i < cqe_count; ++i){
             struct io_uring_cqe* cqe = cqes_[i];
+            if (cqe->user_data & kStopTag) {
+                if (cqe->user_data == kStopTag) {
+                    // no more accepts; with a successor, it takes the connections still queued
+                    draining = true;
+                    drain = start_drain();
+                    if (struct io_uring_sqe* sqe = get_sqe()) {
+                        io_uring_prep_cancel64(sqe, 0x100000000, 0);
+                        sqe->user_data = kStopTag | 1;
+                    }
+                    Logger::info(get_name(), " draining ", clients_.size(), " connections");
+                }
+                io_uring_cqe_seen(&ring_, cqe);
+                continue;
+            }
+            if (cqe->user_data & kOffloadTag) {
+                // the completion eventfd was written: offloaded jobs are back
+                completions_->drain([this](OffloadJob& job) {
+                    finish_offload(job);
+                }, true);
+                arm_offload_read();
+                io_uring_cqe_seen(&ring_, cqe);
+                continue;
+            }
+            if (cqe->user_data & kLogSyncTag) {
+                finish_log_sync(cqe->res);
+                io_uring_cqe_seen(&ring_, cqe);
+                continue;
+            }
+            if (cqe->user_data & (kPollTag | kProvideTag)) {
+                // readiness step of a poll->splice link (the splice cqe carries the
+                // result), or a recv buffer handed back to the kernel
+                if ((cqe->user_data & kProvideTag) && cqe->res < 0) {
+                    Logger::error("Failed to provide recv buffer: ", strerror(-cqe->res));
+                }
+                io_uring_cqe_seen(&ring_, cqe);
+                continue;
+            }
             if (cqe->res < 0) {
                 uint64_t user_data = cqe->user_data;
                 int fd = static_cast<int>(user_data & 0xFFFFFFFF);
-                if (user_data & 0x100000000) {
+                if ((user_data & 0x100000000) && draining) {
+                    // cancelled by the stop
+                    server_fd_ = SocketRAII();
+                } else if (user_data & 0x100000000) {
                     // accept error, try again
                     struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
                     if(sqe){
@@ -75,10 +189,10 @@ void IOUringServer::run(uint16_t port){
                         }
                     }
                 }else{
-                    // client read error, close connection
+                    // client read/write error, close connection
                     auto it = clients_.find(fd);
                     if (it != clients_.end()){
-                        cleanup_client(it->second.get());
+                        handle_client_completion(it->second.get(), cqe);
                     }
                 }
             }else{
@@ -87,17 +201,31 @@ void IOUringServer::run(uint16_t port){
                 if (user_data & 0x100000000){
                     // accept success
                     int client_fd = cqe->res;
-                    set_non_blocking(client_fd);
+                    if (admit_connection(client_fd)) {
+                        set_non_blocking(client_fd);
 
-                    auto ctx = std::make_unique<ClientContext>(client_fd);
-                    clients_[client_fd] = std::move(ctx);
-                    active_connections_++;
+                        auto ctx = std::make_unique<ClientContext>(client_fd);
+                        if (config_.splice_echo && !make_pipe(ctx->pipe_rd, ctx->pipe_wr)) {
+                            Logger::error("Failed to create splice pipe");
+                            close(client_fd);
+                        } else {
+                            ctx->id = ++next_connection_id_;
+                            clients_[client_fd] = std::move(ctx);
+                            active_connections_++;
 
-                    handle_client_read(clients_[client_fd].get());
+                            if (config_.splice_echo) {
+                                handle_splice_read(clients_[client_fd].get());
+                            } else {
+                                handle_client_read(clients_[client_fd].get());
+                            }
+                        }
+                    }
 
-                    // submit next accept request
-                    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
-                    if(sqe){
+                    // submit next accept request, unless it completed just ahead of its cancel
+                    struct io_uring_sqe* sqe = draining ? nullptr : io_uring_get_sqe(&ring_);
+                    if (draining) {
+                        server_fd_ = SocketRAII();
+                    } else if(sqe){
                         io_uring_prep_accept(sqe, server_fd_.get(), nullptr, nullptr, 0);
                         sqe->user_data = 0x100000000;
                     } else {
@@ -112,25 +240,9 @@ void IOUringServer::run(uint16_t port){
                         }
                     }
                 }else{
-                    // client read success
                     auto it = clients_.find(fd);
                     if (it != clients_.end()){
-                        ClientContext* ctx = it->second.get();
-                        if (ctx->is_reading){
-                            ctx->is_reading = false;
-                            ctx->buffer_size = cqe->res;
-
-                            if (ctx->buffer_size > 0){
-                                total_messages_++;
-                                handle_client_write(ctx);
-                            }else{
-                                // client closed connection
-                                cleanup_client(ctx);
-                            }
-                        }else if(ctx->is_writing){
-                            ctx->is_writing = false;
-                            handle_client_read(ctx);
-                        }
+                        handle_client_completion(it->second.get(), cqe);
                     }
                 }
             }
@@ -138,27 +250,369 @@ void IOUringServer::run(uint16_t port){
             // Mark this completion as seen
             io_uring_cqe_seen(&ring_, cqe);
         }
+        // group commit: the messages of this batch, and of every batch since the
+        // last sync was submitted, share the next one
+        if (log_ && log_syncs_inflight_ == 0) {
+            sync_log();
+        }
+        // one send per connection for everything this batch of completions produced
+        if (!pending_flush_.empty()) {
+            flush_pending();
+        }
+        if (draining && !drain_idle(drain)) {
+            break;
+        }
     }
 
+    loop_probe_ = nullptr;
     io_uring_queue_exit(&ring_);
+    // past the drain deadline; the ring is gone, so nothing points into the contexts
+    for (auto& [fd, ctx] : clients_) {
+        close(fd);
+    }
+    clients_.clear();
+    log_batch_ = {};
+    log_.reset();
+    // workers first: a job they still hold belongs to completions_
+    offload_.reset();
+    completions_.reset();
+    for (char* buffer : recv_buffers_) {
+        BufferPool::release(buffer, kReadChunk);
+    }
+    recv_buffers_.clear();
     Logger::info("Server stopped");
-    if (stats_thread_.joinable()) {
-        stats_thread_.join();
+    stop_service();
+}
+
+// After every batch while draining: closes the due share, if any, of the
+// connections parked in recv with nothing buffered, queued or out with a
+// worker. False once every connection is gone or the deadline has passed.
+bool IOUringServer::drain_idle(DrainTimer& drain){
+    std::vector<ClientContext*> idle;
+    for (auto& [fd, ctx] : clients_) {
+        if (ctx->is_reading && !ctx->is_writing && !ctx->is_closing && !ctx->offloading &&
+            ctx->in.empty() && ctx->out.empty() && !ctx->zc_out && ctx->fanout.empty() &&
+            ctx->pipe_bytes == 0 && !ctx->flush_pending && !ctx->held_listed) {
+            idle.push_back(ctx.get());
+        }
+    }
+    size_t quota = drain.quota(idle.size());
+    for (size_t i = 0; i < quota; ++i) {
+        cleanup_client(idle[i]);    // the cancelled recv completes and frees the context
     }
+    io_uring_submit(&ring_);
+    return !clients_.empty() && !drain.expired();
 }
 
 
 void IOUringServer::cleanup_client(ClientContext* ctx){
+    if (!ctx->is_closing) {
+        ctx->is_closing = true;
+        active_connections_--;
+        trace_closed(ctx->client_fd);
+        if (pubsub_) {
+            pubsub_->remove_client(ctx->client_fd);
+        }
+    }
+    // a pending recv/send still points into ctx, and SEND_ZC buffers belong to
+    // the kernel until their notification arrives; keeping the fd open also
+    // stops its number (our user_data) from being reused in the meantime
+    if (ctx->is_reading || ctx->is_writing || !ctx->zc_pinned.empty()) {
+        shutdown(ctx->client_fd, SHUT_RDWR); // completes the pending ops early
+        return;
+    }
     close(ctx->client_fd);
     clients_.erase(ctx->client_fd);
-    active_connections_--;
+}
+
+void IOUringServer::handle_client_completion(ClientContext* ctx, struct io_uring_cqe* cqe){
+    if (config_.splice_echo) {
+        handle_splice_completion(ctx, cqe);
+        return;
+    }
+    if (cqe->flags & IORING_CQE_F_NOTIF) {
+        // SEND_ZC notification: the kernel no longer references the buffer
+        if (static_cast<uint32_t>(cqe->res) & IORING_NOTIF_USAGE_ZC_COPIED) {
+            zerocopy_copied_++;
+        }
+        if (!ctx->zc_pinned.empty()) {
+            ctx->zc_pinned.pop_front();
+        }
+        if (ctx->is_closing) {
+            cleanup_client(ctx);
+        }
+        return;
+    }
+
+    if (cqe->user_data & kFileTag) {
+        handle_file_completion(ctx, cqe);
+        return;
+    }
+
+    // a recv and a fan-out send can be in flight together; the tag tells them apart
+    bool write_done = cqe->user_data & kWriteTag;
+    if (write_done) {
+        ctx->is_writing = false;
+        if (cqe->flags & IORING_CQE_F_MORE) {
+            ctx->zc_pinned.push_back(ctx->sending_fanout ? ctx->fanout.front() : ctx->zc_out);
+        }
+    } else {
+        ctx->is_reading = false;
+    }
+    // a recv that got data owns one provided buffer until its bytes are framed
+    int buffer_id = (!write_done && (cqe->flags & IORING_CQE_F_BUFFER))
+        ? static_cast<int>(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+    if (ctx->is_closing) {
+        if (buffer_id >= 0) {
+            provide_recv_buffer(static_cast<uint16_t>(buffer_id));
+        }
+        cleanup_client(ctx);
+        return;
+    }
+    if (write_done && ctx->sending_file) {
+        handle_file_completion(ctx, cqe);
+        return;
+    }
+
+    if (cqe->res < 0) {
+        if (!write_done && cqe->res == -ENOBUFS) {
+            // every provided buffer was taken; the ones recycled since are queued ahead of this recv
+            handle_client_read(ctx);
+            return;
+        }
+        if (write_done && zerocopy_supported_ && config_.zerocopy_threshold > 0 &&
+            (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)) {
+            // kernel without SEND_ZC: copy from now on
+            Logger::error("IORING_OP_SEND_ZC unsupported, falling back to copying sends");
+            zerocopy_supported_ = false;
+            if (ctx->zc_out && !ctx->sending_fanout) {
+                ctx->out.append(*ctx->zc_out);
+                ctx->zc_out.reset();
+            }
+            handle_client_write(ctx);
+            return;
+        }
+        cleanup_client(ctx);
+        return;
+    }
+
+    if (!write_done){
+        if (cqe->res == 0 || buffer_id < 0){
+            // client closed connection
+            cleanup_client(ctx);
+            return;
+        }
+
+        trace_recv();
+        std::string_view data(recv_buffers_[buffer_id], cqe->res);
+        if (completions_) {
+            OffloadJob* job = completions_->acquire();
+            bool within_limit = frame_input(ctx->in, data, ctx->client_fd, [job](std::string_view messages) {
+                job->input += messages;
+            });
+            provide_recv_buffer(static_cast<uint16_t>(buffer_id));
+            if (!within_limit) {
+                completions_->release(job);
+                Logger::error("Client-", ctx->client_fd, " sent an oversized or malformed message");
+                cleanup_client(ctx);
+            } else if (job->input.empty()) {
+                completions_->release(job);
+                handle_client_read(ctx);
+            } else {
+                submit_offload(ctx, job); // the next recv is armed once its replies are out
+            }
+            return;
+        }
+        reply_.clear();
+        file_sends_.clear();
+        bool within_limit = process_input(ctx->in, data, reply_, ctx->client_fd, &file_sends_, &ctx->last_reply);
+        provide_recv_buffer(static_cast<uint16_t>(buffer_id));
+        if (!reply_.empty()) {
+            queue_reply(ctx, reply_, &file_sends_);
+        }
+        if (!within_limit) {
+            Logger::error("Client-", ctx->client_fd, " sent an oversized or malformed message");
+            cleanup_client(ctx);
+        } else if (!ctx->out.empty() || ctx->zc_out){
+            // sent at the end of the batch; the next recv is armed once they are out
+            schedule_flush(ctx);
+        } else {
+            // message not complete yet
+            handle_client_read(ctx);
+        }
+        return;
+    }
+
+    trace_sent(ctx->client_fd);
+    // walk the batch: own replies (unless it was fan-out only), then fan-out
+    size_t left = cqe->res;
+    if (!ctx->sending_fanout) {
+        std::string_view own = ctx->zc_out ? std::string_view(*ctx->zc_out) : ctx->out.view();
+        if (!ctx->files.empty()) {
+            own = own.substr(0, ctx->files.front().at);   // sent up to the next file body
+        }
+        size_t remaining = own.size() - ctx->out_offset;
+        if (left < remaining) {
+            ctx->out_offset += left;
+            left = 0;
+        } else if (!ctx->files.empty()) {
+            left -= remaining;
+            ctx->out_offset = own.size();
+        } else {
+            left -= remaining;
+            ctx->out_offset = 0;
+            ctx->zc_out.reset();
+            ctx->out.clear();
+        }
+    }
+    while (left > 0 && !ctx->fanout.empty()) {
+        size_t size = ctx->fanout.front()->size();
+        size_t remaining = size - ctx->fanout_offset;
+        if (left < remaining) {
+            ctx->fanout_offset += left;
+            break;
+        }
+        left -= remaining;
+        ctx->fanout_offset = 0;
+        ctx->fanout_bytes -= size;
+        ctx->fanout.pop_front();
+    }
+    ctx->sending_fanout = false;
+    if (!ctx->out.empty() || ctx->zc_out || !ctx->fanout.empty()) {
+        handle_client_write(ctx); // short send or more queued meanwhile
+    }
+    if (ctx->out.empty() && !ctx->zc_out && !ctx->is_reading && !ctx->is_closing && !ctx->offloading) {
+        handle_client_read(ctx);
+    }
+}
+
+// Replies wait for the end of the batch; a large one becomes a zero-copy send,
+// unless static file bodies are to be spliced in between its bytes.
+void IOUringServer::queue_reply(ClientContext* ctx, std::string& reply, const std::vector<FileSend>* files){
+    if (files && !files->empty()) {
+        for (const FileSend& file : *files) {
+            ctx->files.push_back({ctx->out.size() + file.at, file.file});
+        }
+        ctx->out.append(reply);
+    } else if (zerocopy_supported_ && config_.zerocopy_threshold > 0 && ctx->out.empty() &&
+        !ctx->zc_out && reply.size() >= config_.zerocopy_threshold) {
+        ctx->zc_out = std::make_shared<const std::string>(std::move(reply));
+        reply.clear();
+    } else {
+        ctx->out.append(reply);
+    }
+    if (log_) {
+        // covers the messages of this reply, they were appended before it was built
+        ctx->out_seq = log_->appended();
+    }
+}
+
+// One IORING_OP_FSYNC per segment written since the last sync. Runs while
+// none is in flight, so messages appended meanwhile wait for the next one.
+void IOUringServer::sync_log(){
+    if (log_->failed() || !log_->take_batch(log_batch_)) {
+        return;
+    }
+    for (const auto& segment : log_batch_.segments) {
+        struct io_uring_sqe* sqe = get_sqe();
+        if (!sqe) {
+            // the whole batch is synced again with the next one
+            Logger::error("Failed to get sqe for a message log fsync");
+            log_sync_incomplete_ = true;
+            continue;
+        }
+        io_uring_prep_fsync(sqe, segment->fd, IORING_FSYNC_DATASYNC);
+        sqe->user_data = kLogSyncTag;
+        log_syncs_inflight_++;
+    }
+    if (log_syncs_inflight_ == 0) {
+        finish_log_sync(0);
+    }
+}
+
+// Once every fsync of the batch is back its replies can go out. After a
+// failed fsync the log accepts nothing more, and every connection holding
+// replies for it is closed as its turn to write comes.
+void IOUringServer::finish_log_sync(int res){
+    if (res < 0) {
+        Logger::error("Message log fsync failed: ", strerror(-res));
+        log_sync_failed_ = true;
+    }
+    if (log_syncs_inflight_ > 0 && --log_syncs_inflight_ > 0) {
+        return;
+    }
+    if (log_sync_failed_) {
+        log_->fail_batch(log_batch_);
+    } else if (log_sync_incomplete_) {
+        log_->retry_batch(log_batch_);
+    } else {
+        log_->finish_batch(log_batch_);
+    }
+    log_sync_failed_ = false;
+    log_sync_incomplete_ = false;
+    log_batch_.segments.clear();
+    for (int fd : held_) {
+        auto it = clients_.find(fd);
+        if (it == clients_.end() || !it->second->held_listed) {
+            continue;
+        }
+        it->second->held_listed = false;
+        if (!it->second->is_closing) {
+            schedule_flush(it->second.get());
+        }
+    }
+    held_.clear();
+}
+
+// Workers signal the completion eventfd; reading it through the ring lets
+// finished jobs wake the loop like any other completion.
+bool IOUringServer::arm_offload_read(){
+    struct io_uring_sqe* sqe = get_sqe();
+    if (!sqe) {
+        Logger::error("Failed to get sqe for the offload eventfd");
+        return false;
+    }
+    io_uring_prep_read(sqe, completions_->event_fd(), &offload_counter_, sizeof(offload_counter_), 0);
+    sqe->user_data = kOffloadTag;
+    return true;
+}
+
+void IOUringServer::submit_offload(ClientContext* ctx, OffloadJob* job){
+    job->fd = ctx->client_fd;
+    job->connection_id = ctx->id;
+    job->shed = config_.busy_reply && overloaded();
+    ctx->offloading = true;
+    offloaded_jobs_.fetch_add(1, std::memory_order_relaxed);
+    offload_->submit(job);
+}
+
+// A worker finished a job: its replies go out with this batch, or the
+// connection reads again straight away if there were none.
+void IOUringServer::finish_offload(OffloadJob& job){
+    auto it = clients_.find(job.fd);
+    if (it == clients_.end() || it->second->id != job.connection_id || it->second->is_closing) {
+        return; // closed while the job was out
+    }
+    ClientContext* ctx = it->second.get();
+    ctx->offloading = false;
+    if (!job.output.empty()) {
+        queue_reply(ctx, job.output);
+    }
+    if (!ctx->out.empty() || ctx->zc_out) {
+        schedule_flush(ctx);
+    } else {
+        handle_client_read(ctx);
+    }
 }
 
 void IOUringServer::handle_client_read(ClientContext* ctx){
     if (ctx->is_reading) return; // already reading
+    if (ctx->last_reply) {
+        cleanup_client(ctx);    // its reply is out, nothing more is read
+        return;
+    }
 
     ctx->is_reading = true;
-    ctx->buffer_size = 0;
 
     struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
     if (!sqe) {
@@ -167,17 +621,40 @@ void IOUringServer::handle_client_read(ClientContext* ctx){
         sqe = io_uring_get_sqe(&ring_);
         if (!sqe) {
             Logger::error("Failed to get sqe for read after retry, closing client");
+            ctx->is_reading = false;
             cleanup_client(ctx);
             return;
         }
     }
 
-    io_uring_prep_recv(sqe, ctx->client_fd, ctx->buffer, sizeof(ctx->buffer), 0);
+    recv_calls_++;
+    // no buffer yet: the kernel picks one from the group once data arrives
+    io_uring_prep_recv(sqe, ctx->client_fd, nullptr, kReadChunk, 0);
+    io_uring_sqe_set_flags(sqe, IOSQE_BUFFER_SELECT);
+    sqe->buf_group = kRecvBufferGroup;
     sqe->user_data = ctx->client_fd;
 }
 
+// Sends the connection's own replies first, then queued fan-out messages.
 void IOUringServer::handle_client_write(ClientContext* ctx){
     if (ctx->is_writing) return; // already writing
+    if (ctx->out.empty() && !ctx->zc_out && ctx->fanout.empty()) return;
+    if (log_ && (!ctx->out.empty() || ctx->zc_out) && ctx->out_seq > log_->durable()) {
+        if (log_->failed()) {
+            cleanup_client(ctx);    // its messages may never reach the disk
+            return;
+        }
+        // released by finish_log_sync
+        if (!ctx->held_listed) {
+            ctx->held_listed = true;
+            held_.push_back(ctx->client_fd);
+        }
+        return;
+    }
+    if (!ctx->files.empty() && ctx->out_offset == ctx->files.front().at) {
+        handle_file_write(ctx);
+        return;
+    }
 
     ctx->is_writing = true;
 
@@ -188,23 +665,458 @@ void IOUringServer::handle_client_write(ClientContext* ctx){
         sqe = io_uring_get_sqe(&ring_);
         if (!sqe) {
             Logger::error("Failed to get sqe for write after retry, closing client");
+            ctx->is_writing = false;
             cleanup_client(ctx);
             return;
         }
     }
 
-    std::string response = "Echo: " + std::string(ctx->buffer, ctx->buffer_size);
-    if (ctx->buffer_size > 0 && ctx->buffer[ctx->buffer_size - 1] == '\n') {
-        response.pop_back(); 
+    bool zc_enabled = zerocopy_supported_ && config_.zerocopy_threshold > 0;
+    ctx->sending_fanout = !ctx->zc_out && ctx->out.empty();
+    std::string_view first = ctx->zc_out ? std::string_view(*ctx->zc_out)
+                           : !ctx->sending_fanout ? ctx->out.view() : std::string_view(*ctx->fanout.front());
+    if (!ctx->sending_fanout && !ctx->files.empty()) {
+        first = first.substr(0, ctx->files.front().at);
     }
-    response += " (Msg #" + std::to_string(total_messages_.load() + 1) + ")\n";
-    
-    size_t response_size = std::min(response.size(), sizeof(ctx->buffer));
-    if (response_size > 0) {
-        std::memcpy(ctx->buffer, response.c_str(), response_size);
+    size_t offset = ctx->sending_fanout ? ctx->fanout_offset : ctx->out_offset;
+    // published messages are shared, so they can go zero-copy as they are
+    bool zerocopy = ctx->zc_out != nullptr ||
+                    (ctx->sending_fanout && zc_enabled && first.size() >= config_.zerocopy_threshold);
+
+    if (zerocopy) {
+        io_uring_prep_send_zc(sqe, ctx->client_fd, first.data() + offset,
+            first.size() - offset, MSG_NOSIGNAL, IORING_SEND_ZC_REPORT_USAGE);
+        zerocopy_sends_++;
+    } else {
+        // own replies and queued fan-out go out in one sendmsg, up to a large
+        // fan-out message that is left for its own zero-copy send
+        size_t iov_count = 0;
+        ctx->send_iov[iov_count].iov_base = const_cast<char*>(first.data() + offset);
+        ctx->send_iov[iov_count].iov_len = first.size() - offset;
+        iov_count++;
+        for (size_t j = ctx->sending_fanout ? 1 : 0;
+             ctx->files.empty() && j < ctx->fanout.size() && iov_count < kMaxIov; ++j) {
+            const std::string& message = *ctx->fanout[j];
+            if (zc_enabled && message.size() >= config_.zerocopy_threshold) {
+                break;
+            }
+            if (j == 0) {
+                // fan-out head after own replies may already be partly sent
+                ctx->send_iov[iov_count].iov_base = const_cast<char*>(message.data() + ctx->fanout_offset);
+                ctx->send_iov[iov_count].iov_len = message.size() - ctx->fanout_offset;
+            } else {
+                ctx->send_iov[iov_count].iov_base = const_cast<char*>(message.data());
+                ctx->send_iov[iov_count].iov_len = message.size();
+            }
+            iov_count++;
+        }
+        iov_count = clamp_iov(ctx->send_iov, iov_count, config_.max_record_size);
+        ctx->send_msg = {};
+        ctx->send_msg.msg_iov = ctx->send_iov;
+        ctx->send_msg.msg_iovlen = iov_count;
+        // headers ahead of a file body wait for it instead of going out alone
+        io_uring_prep_sendmsg(sqe, ctx->client_fd, &ctx->send_msg,
+            MSG_NOSIGNAL | (!ctx->sending_fanout && !ctx->files.empty() ? MSG_MORE : 0));
+    }
+    send_calls_++;
+    sqe->user_data = kWriteTag | ctx->client_fd;
+}
+
+// The static file body at the head of `files`, moved in two linked
+// IORING_OP_SPLICEs: up to a pipe's worth from the file into the pipe, then
+// from the pipe into the socket. Bytes a short socket splice left in the pipe
+// go out first, behind a poll for POLLOUT if the socket was full.
+void IOUringServer::handle_file_write(ClientContext* ctx){
+    if (ctx->pipe_rd.get() == -1 && !make_pipe(ctx->pipe_rd, ctx->pipe_wr)) {
+        Logger::error("Failed to create splice pipe, closing client");
+        cleanup_client(ctx);
+        return;
+    }
+    FileSend& file = ctx->files.front();
+    size_t count = ctx->pipe_bytes;
+    if (count == 0) {
+        count = std::min(file.file->size - file.offset, sendfile_chunk());
+    }
+    bool fill = ctx->pipe_bytes == 0;
+    bool poll = !fill && ctx->wait_writable;
+    struct io_uring_sqe* first = get_sqe();
+    struct io_uring_sqe* sqe = first && (fill || poll) ? get_sqe() : first;
+    if (!sqe) {
+        Logger::error("Failed to get sqe for file splice, closing client");
+        cleanup_client(ctx);
+        return;
+    }
+    if (fill) {
+        io_uring_prep_splice(first, file.file->fd.get(), static_cast<int64_t>(file.offset),
+            ctx->pipe_wr.get(), -1, count, SPLICE_F_MOVE);
+        io_uring_sqe_set_flags(first, IOSQE_IO_LINK);
+        first->user_data = kFileTag | ctx->client_fd;
+    } else if (poll) {
+        io_uring_prep_poll_add(first, ctx->client_fd, POLLOUT);
+        io_uring_sqe_set_flags(first, IOSQE_IO_LINK);
+        first->user_data = kPollTag | ctx->client_fd;
+    }
+    // a short fill cancels this one; whatever did reach the pipe is sent next round
+    io_uring_prep_splice(sqe, ctx->pipe_rd.get(), -1, ctx->client_fd, -1, count, SPLICE_F_MOVE);
+    sqe->user_data = kWriteTag | ctx->client_fd;
+    ctx->is_writing = true;
+    ctx->sending_file = true;
+    send_calls_++;
+}
+
+// Either half of a file splice: the file -> pipe one counts what the pipe
+// holds, the pipe -> socket one what left it, and picks the next send.
+void IOUringServer::handle_file_completion(ClientContext* ctx, struct io_uring_cqe* cqe){
+    if (cqe->user_data & kFileTag) {
+        if (ctx->is_closing) {
+            return;     // the cancelled socket splice completes the cleanup
+        }
+        if (cqe->res <= 0) {
+            // truncated behind our back (0), or unreadable
+            Logger::error("Static file came up short, closing Client-", ctx->client_fd);
+            cleanup_client(ctx);
+            return;
+        }
+        ctx->pipe_bytes += cqe->res;
+        ctx->files.front().offset += cqe->res;
+        return;
+    }
+    ctx->sending_file = false;
+    if (cqe->res == -EAGAIN) {
+        ctx->wait_writable = true;
+        handle_file_write(ctx);
+        return;
+    }
+    if (cqe->res < 0 && cqe->res != -ECANCELED) {
+        cleanup_client(ctx);
+        return;
+    }
+    if (cqe->res > 0) {
+        trace_sent(ctx->client_fd);
+        ctx->pipe_bytes -= cqe->res;
+        spliced_bytes_ += cqe->res;
+        ctx->wait_writable = false;
     }
+    const FileSend& file = ctx->files.front();
+    if (ctx->pipe_bytes == 0 && file.offset == file.file->size) {
+        ctx->files.pop_front();
+        if (ctx->files.empty() && ctx->out_offset == ctx->out.size()) {
+            ctx->out_offset = 0;
+            ctx->out.clear();
+        }
+    }
+    if (!ctx->out.empty() || !ctx->fanout.empty()) {
+        handle_client_write(ctx);
+    }
+    if (ctx->out.empty() && !ctx->is_reading && !ctx->is_closing && !ctx->offloading) {
+        handle_client_read(ctx);
+    }
+}
+
+// Queues a published message by reference; sends are submitted from
+// flush_pending once the current batch of completions has been processed.
+Delivery IOUringServer::deliver_fanout(int client_fd, const SharedBuffer& message){
+    auto it = clients_.find(client_fd);
+    if (it == clients_.end() || it->second->is_closing || it->second->overflowed) {
+        return Delivery::Dropped;
+    }
+    ClientContext* ctx = it->second.get();
+    schedule_flush(ctx);
+    if (ctx->fanout_bytes + message->size() > config_.subscriber_queue_limit) {
+        if (config_.slow_subscriber_policy == SlowSubscriberPolicy::Drop) {
+            return Delivery::Dropped;
+        }
+        ctx->overflowed = true;
+        return Delivery::Overflow;
+    }
+    ctx->fanout.push_back(message);
+    ctx->fanout_bytes += message->size();
+    return Delivery::Queued;
+}
 
-    io_uring_prep_send(sqe, ctx->client_fd, ctx->buffer, response_size, 0);
+void IOUringServer::schedule_flush(ClientContext* ctx){
+    if (!ctx->flush_pending) {
+        ctx->flush_pending = true;
+        pending_flush_.push_back(ctx->client_fd);
+    }
+}
+
+void IOUringServer::flush_pending(){
+    // swap with a second list, so both keep their capacity across batches
+    flushing_.swap(pending_flush_);
+    for (int fd : flushing_) {
+        auto it = clients_.find(fd);
+        if (it == clients_.end()) continue;
+        ClientContext* ctx = it->second.get();
+        ctx->flush_pending = false;
+        if (ctx->is_closing) {
+            continue;
+        }
+        if (ctx->overflowed) {
+            cleanup_client(ctx);
+        } else {
+            handle_client_write(ctx);
+        }
+    }
+    flushing_.clear();
+}
+
+
+
+// Returns a recv buffer to the kernel's group once its bytes have been consumed.
+bool IOUringServer::provide_recv_buffer(uint16_t buffer_id){
+    struct io_uring_sqe* sqe = get_sqe();
+    if (!sqe) {
+        Logger::error("Failed to get sqe to provide recv buffer ", buffer_id);
+        return false;
+    }
+    io_uring_prep_provide_buffers(sqe, recv_buffers_[buffer_id], kReadChunk, 1, kRecvBufferGroup, buffer_id);
+    sqe->user_data = kProvideTag;
+    return true;
+}
+
+struct io_uring_sqe* IOUringServer::get_sqe(){
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+    if (!sqe) {
+        // Try to submit pending requests and retry
+        io_uring_submit(&ring_);
+        sqe = io_uring_get_sqe(&ring_);
+    }
+    return sqe;
+}
+
+// Bulk-stream echo: socket -> pipe -> socket with IORING_OP_SPLICE. Splice is
+// served by io-wq workers, so each one is linked behind a poll for readiness
+// instead of parking a worker on an idle socket.
+void IOUringServer::handle_splice_read(ClientContext* ctx){
+    ctx->is_reading = true;
+
+    struct io_uring_sqe* poll_sqe = get_sqe();
+    struct io_uring_sqe* sqe = poll_sqe ? get_sqe() : nullptr;
+    if (!sqe) {
+        Logger::error("Failed to get sqe for splice, closing client");
+        cleanup_client(ctx);
+        return;
+    }
+    io_uring_prep_poll_add(poll_sqe, ctx->client_fd, POLLIN);
+    io_uring_sqe_set_flags(poll_sqe, IOSQE_IO_LINK);
+    poll_sqe->user_data = kPollTag | ctx->client_fd;
+
+    io_uring_prep_splice(sqe, ctx->client_fd, -1, ctx->pipe_wr.get(), -1,
+        kSpliceChunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    sqe->user_data = ctx->client_fd;
+}
+
+void IOUringServer::handle_splice_write(ClientContext* ctx){
+    ctx->is_writing = true;
+
+    struct io_uring_sqe* poll_sqe = nullptr;
+    if (ctx->wait_writable) {
+        poll_sqe = get_sqe();
+        if (!poll_sqe) {
+            Logger::error("Failed to get sqe for splice, closing client");
+            cleanup_client(ctx);
+            return;
+        }
+        io_uring_prep_poll_add(poll_sqe, ctx->client_fd, POLLOUT);
+        io_uring_sqe_set_flags(poll_sqe, IOSQE_IO_LINK);
+        poll_sqe->user_data = kPollTag | ctx->client_fd;
+    }
+    struct io_uring_sqe* sqe = get_sqe();
+    if (!sqe) {
+        Logger::error("Failed to get sqe for splice, closing client");
+        cleanup_client(ctx);
+        return;
+    }
+    io_uring_prep_splice(sqe, ctx->pipe_rd.get(), -1, ctx->client_fd, -1,
+        ctx->pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
     sqe->user_data = ctx->client_fd;
 }
 
+void IOUringServer::handle_splice_completion(ClientContext* ctx, struct io_uring_cqe* cqe){
+    if (ctx->is_closing) {
+        ctx->is_reading = false;
+        ctx->is_writing = false;
+        cleanup_client(ctx);
+        return;
+    }
+    if (ctx->is_reading) {
+        ctx->is_reading = false;
+        if (cqe->res == -EAGAIN) {
+            handle_splice_read(ctx); // spurious wakeup
+        } else if (cqe->res <= 0) {
+            cleanup_client(ctx);     // error or peer closed
+        } else {
+            ctx->pipe_bytes = cqe->res;
+            ctx->wait_writable = false;
+            handle_splice_write(ctx);
+        }
+    } else if (ctx->is_writing) {
+        ctx->is_writing = false;
+        if (cqe->res == -EAGAIN) {
+            ctx->wait_writable = true;
+            handle_splice_write(ctx);
+            return;
+        }
+        if (cqe->res < 0) {
+            cleanup_client(ctx);
+            return;
+        }
+        ctx->pipe_bytes -= cqe->res;
+        spliced_bytes_ += cqe->res;
+        ctx->wait_writable = false;
+        if (ctx->pipe_bytes > 0) {
+            handle_splice_write(ctx);
+        } else {
+            handle_splice_read(ctx);
+        }
+    }
+}
+
+
+// UDP: one ring and loop thread per SO_REUSEPORT socket.
+void IOUringServer::run_udp(uint16_t port){
+    completion_io_ = true;
+    std::vector<SocketRAII> sockets;
+    for (size_t i = 0; i < config_.udp_sockets; ++i) {
+        auto socket_opt = open_udp_socket(port);
+        if (!socket_opt.has_value()) {
+            return;
+        }
+        sockets.push_back(std::move(socket_opt.value()));
+    }
+    if (!start_service("udp port " + std::to_string(port), get_name(), sockets.size() > 1 ? kKvLockStripes : 0)) {
+        return;
+    }
+
+    std::vector<std::thread> loops;
+    for (size_t i = 1; i < sockets.size(); ++i) {
+        loops.emplace_back([this, fd = sockets[i].get()] { udp_loop(fd); });
+    }
+    udp_loop(sockets[0].get());
+    for (auto& loop : loops) {
+        loop.join();
+    }
+    stop_service();
+}
+
+// Every slot of the batch always has a RECVMSG in flight or holds a datagram
+// waiting for its reply. Replies of everything reaped so far go out as SENDMSGs
+// once the previous round of sends has completed, since they share one buffer;
+// the slots they came from are re-armed at the same time.
+// Datagrams have nothing to drain: a loop returns as soon as a stop is requested.
+void IOUringServer::udp_loop(int socket_fd){
+    constexpr uint64_t kSendTag = ~0ULL;
+    constexpr uint64_t kUdpStopTag = kSendTag - 1;
+    struct io_uring ring;
+    if (io_uring_queue_init(256, &ring, 0) < 0) {
+        Logger::error("Failed to initialize io_uring");
+        return;
+    }
+    auto get_sqe = [&ring]() {
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        if (!sqe) {
+            io_uring_submit(&ring);
+            sqe = io_uring_get_sqe(&ring);
+        }
+        return sqe;
+    };
+    UdpRecvBatch batch;
+    UdpReplies replies(config_.udp_gso);
+    std::vector<size_t> unarmed;    // slots that found the SQ full, armed again next round
+    std::vector<size_t> rearming;
+    auto arm = [&](size_t slot) {
+        batch.reset(slot);
+        struct io_uring_sqe* sqe = get_sqe();
+        if (!sqe) {
+            unarmed.push_back(slot);
+            return;
+        }
+        io_uring_prep_recvmsg(sqe, socket_fd, batch.header(slot), 0);
+        sqe->user_data = slot;
+    };
+    for (size_t slot = 0; slot < kUdpBatch; ++slot) {
+        arm(slot);
+    }
+    struct io_uring_sqe* stop_sqe = get_sqe();
+    if (!stop_sqe) {
+        Logger::error("Failed to get sqe for the stop eventfd");
+        io_uring_queue_exit(&ring);
+        return;
+    }
+    io_uring_prep_poll_add(stop_sqe, stop_fd_.get(), POLLIN);
+    stop_sqe->user_data = kUdpStopTag;
+
+    std::vector<std::pair<size_t, size_t>> ready;   // slot, datagram bytes
+    std::vector<struct io_uring_cqe*> cqes(2 * kUdpBatch);
+    size_t sends_in_flight = 0;
+    bool stopped = false;
+    LoopProbe probe(loop_stats_);
+    while (running_ && !stopped) {
+        if (!unarmed.empty()) {
+            // the last submit made room
+            rearming.swap(unarmed);
+            for (size_t slot : rearming) {
+                arm(slot);
+            }
+            rearming.clear();
+        }
+        probe.before_wait();
+        int ret = io_uring_submit_and_wait(&ring, 1);
+        if (ret < 0 && ret != -EINTR) {
+            Logger::error("Failed to wait for io_uring completions: ", strerror(-ret));
+            break;
+        }
+        unsigned count = io_uring_peek_batch_cqe(&ring, cqes.data(), cqes.size());
+        probe.submitted(std::max(ret, 0), false);
+        probe.after_wait(count);
+        trace_ready();
+        for (unsigned i = 0; i < count; ++i) {
+            struct io_uring_cqe* cqe = cqes[i];
+            if (cqe->user_data == kUdpStopTag) {
+                stopped = true;
+            } else if (cqe->user_data == kSendTag) {
+                --sends_in_flight;
+                trace_sent(socket_fd);
+            } else if (cqe->res < 0) {
+                if (cqe->res != -EAGAIN && cqe->res != -EINTR) {
+                    Logger::error("UDP recvmsg failed: ", strerror(-cqe->res));
+                }
+                arm(cqe->user_data);
+            } else {
+                recv_calls_++;
+                ready.emplace_back(cqe->user_data, cqe->res);
+            }
+            io_uring_cqe_seen(&ring, cqe);
+        }
+        if (sends_in_flight > 0 || ready.empty()) {
+            continue;
+        }
+
+        replies.clear();
+        trace_recv();
+        for (auto [slot, length] : ready) {
+            process_datagrams(batch, slot, length, replies, socket_fd);
+        }
+        size_t sends = replies.build();
+        for (size_t i = 0; i < sends; ++i) {
+            struct io_uring_sqe* sqe = get_sqe();
+            if (!sqe) {
+                // datagrams may be lost anyway; the clients retry or count them
+                Logger::error("Failed to get sqe for UDP replies, dropping ", sends - i, " sends");
+                sends = i;
+                break;
+            }
+            io_uring_prep_sendmsg(sqe, socket_fd, replies.header(i), 0);
+            sqe->user_data = kSendTag;
+            datagrams_out_.fetch_add(replies.datagrams(i), std::memory_order_relaxed);
+        }
+        send_calls_ += sends;
+        sends_in_flight = sends;
+        for (auto [slot, length] : ready) {
+            arm(slot);
+        }
+        ready.clear();
+    }
+    io_uring_queue_exit(&ring);
+}
@@ -0,0 +1,341 @@
+#include "kv_store.hpp"
+#include "utils.hpp"
+
+
+SlabArena::SlabArena(size_t memory_limit)
+    : max_pages_(std::max<size_t>(1, memory_limit / kPageSize)) {
+    for (size_t size = kMinChunk; size < kPageSize; size = (size * 5 / 4 + 7) & ~size_t{7}) {
+        chunk_sizes_.push_back(size);
+    }
+    chunk_sizes_.push_back(kPageSize);
+    free_lists_.assign(chunk_sizes_.size(), nullptr);
+}
+
+SlabArena::~SlabArena() {
+    for (Page& page : pages_) {
+        ::operator delete(page.memory, std::align_val_t{kPageSize});
+    }
+}
+
+uint8_t SlabArena::class_for(size_t size) const {
+    auto it = std::lower_bound(chunk_sizes_.begin(), chunk_sizes_.end(), size);
+    if (it == chunk_sizes_.end()) return kNoClass;
+    return static_cast<uint8_t>(it - chunk_sizes_.begin());
+}
+
+SlabArena::Page& SlabArena::page_of(char* chunk) {
+    // pages are kPageSize-aligned, so masking the chunk address finds its page
+    return pages_[page_index_[reinterpret_cast<uintptr_t>(chunk) & ~(kPageSize - 1)]];
+}
+
+void SlabArena::carve(Page& page, uint8_t size_class) {
+    page.size_class = size_class;
+    size_t chunk = chunk_sizes_[size_class];
+    for (size_t offset = 0; offset + chunk <= kPageSize; offset += chunk) {
+        std::memcpy(page.memory + offset, &free_lists_[size_class], sizeof(char*));
+        free_lists_[size_class] = page.memory + offset;
+    }
+}
+
+bool SlabArena::reassign_empty_page(uint8_t size_class) {
+    for (Page& page : pages_) {
+        if (page.live != 0 || page.size_class == size_class) continue;
+        // unlink the page's chunks from its old class before re-carving it
+        char** link = &free_lists_[page.size_class];
+        while (*link != nullptr) {
+            char* chunk = *link;
+            if (chunk >= page.memory && chunk < page.memory + kPageSize) {
+                std::memcpy(link, chunk, sizeof(char*));
+            } else {
+                link = reinterpret_cast<char**>(chunk);
+            }
+        }
+        carve(page, size_class);
+        return true;
+    }
+    return false;
+}
+
+char* SlabArena::allocate(uint8_t size_class) {
+    if (free_lists_[size_class] == nullptr) {
+        if (pages_.size() < max_pages_) {
+            char* memory = static_cast<char*>(::operator new(kPageSize, std::align_val_t{kPageSize}));
+            page_index_[reinterpret_cast<uintptr_t>(memory)] = static_cast<uint32_t>(pages_.size());
+            pages_.push_back(Page{memory, size_class});
+            carve(pages_.back(), size_class);
+        } else if (!reassign_empty_page(size_class)) {
+            return nullptr;
+        }
+    }
+    char* chunk = free_lists_[size_class];
+    std::memcpy(&free_lists_[size_class], chunk, sizeof(char*));
+    page_of(chunk).live++;
+    bytes_in_use_ += chunk_sizes_[size_class];
+    return chunk;
+}
+
+void SlabArena::release(char* chunk, uint8_t size_class) {
+    std::memcpy(chunk, &free_lists_[size_class], sizeof(char*));
+    free_lists_[size_class] = chunk;
+    page_of(chunk).live--;
+    bytes_in_use_ -= chunk_sizes_[size_class];
+}
+
+
+namespace {
+
+// writers to a shard are serialized (owning loop or stripe mutex), so a plain
+// load/store is enough and avoids a locked RMW
+void bump(std::atomic<long long>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+} // namespace
+
+KvShard::KvShard(size_t memory_limit)
+    : slots_(1024), mask_(1023), arena_(memory_limit) {}
+
+size_t KvShard::find(std::string_view key, uint64_t hash) const {
+    for (size_t i = hash & mask_; slots_[i].hash != 0; i = (i + 1) & mask_) {
+        const Slot& slot = slots_[i];
+        if (slot.hash == hash && std::string_view(slot.item, slot.key_len) == key) {
+            return i;
+        }
+    }
+    return SIZE_MAX;
+}
+
+std::optional<std::string_view> KvShard::get(std::string_view key, uint64_t hash, int64_t now) {
+    size_t index = find(key, hash);
+    if (index == SIZE_MAX) {
+        bump(misses_);
+        return std::nullopt;
+    }
+    Slot& slot = slots_[index];
+    if (slot.expires_at != 0 && slot.expires_at <= now) {
+        erase_at(index);
+        publish_sizes();
+        bump(misses_);
+        return std::nullopt;
+    }
+    slot.referenced = true;
+    bump(hits_);
+    return std::string_view(slot.item + slot.key_len, slot.value_len);
+}
+
+bool KvShard::set(std::string_view key, std::string_view value, uint64_t hash, int64_t now, int64_t ttl_seconds) {
+    uint8_t size_class = arena_.class_for(key.size() + value.size());
+    if (size_class == SlabArena::kNoClass) {
+        return false;
+    }
+    int64_t expires_at = ttl_seconds > 0 ? now + ttl_seconds : 0;
+
+    size_t index = find(key, hash);
+    if (index != SIZE_MAX && slots_[index].size_class == size_class) {
+        // same chunk size: overwrite in place
+        Slot& slot = slots_[index];
+        std::memcpy(slot.item + slot.key_len, value.data(), value.size());
+        slot.value_len = static_cast<uint32_t>(value.size());
+        slot.expires_at = expires_at;
+        slot.referenced = true;
+        return true;
+    }
+
+    // allocate before dropping the old item so a failed SET leaves it readable;
+    // eviction may have removed or shifted it, so look it up again afterwards
+    char* item = allocate_evicting(size_class, now);
+    if (item == nullptr) {
+        publish_sizes();
+        return false;
+    }
+    std::memcpy(item, key.data(), key.size());
+    std::memcpy(item + key.size(), value.data(), value.size());
+    index = find(key, hash);
+    if (index != SIZE_MAX) {
+        erase_at(index);
+    }
+
+    if ((size_ + 1) * 10 > slots_.size() * 7) {
+        grow();
+    }
+    size_t i = hash & mask_;
+    while (slots_[i].hash != 0) {
+        i = (i + 1) & mask_;
+    }
+    slots_[i] = Slot{hash, item, static_cast<uint32_t>(key.size()),
+                     static_cast<uint32_t>(value.size()), expires_at, size_class, false};
+    size_++;
+    publish_sizes();
+    return true;
+}
+
+bool KvShard::del(std::string_view key, uint64_t hash) {
+    size_t index = find(key, hash);
+    if (index == SIZE_MAX) {
+        return false;
+    }
+    erase_at(index);
+    publish_sizes();
+    return true;
+}
+
+void KvShard::erase_at(size_t index) {
+    arena_.release(slots_[index].item, slots_[index].size_class);
+    size_--;
+    // backward-shift deletion keeps probe chains intact without tombstones
+    size_t hole = index;
+    for (size_t i = (index + 1) & mask_; slots_[i].hash != 0; i = (i + 1) & mask_) {
+        size_t home = slots_[i].hash & mask_;
+        // move the entry back unless its home lies cyclically in (hole, i]
+        bool stays = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+        if (!stays) {
+            slots_[hole] = slots_[i];
+            hole = i;
+        }
+    }
+    slots_[hole] = Slot{};
+}
+
+char* KvShard::allocate_evicting(uint8_t size_class, int64_t now) {
+    if (char* chunk = arena_.allocate(size_class)) {
+        return chunk;
+    }
+    // first reuse a cold chunk of the same class; if the class has none to give,
+    // evict across classes until some page empties out and can be re-carved
+    for (bool any_class : {false, true}) {
+        while (evict_one(size_class, now, any_class)) {
+            if (char* chunk = arena_.allocate(size_class)) {
+                return chunk;
+            }
+        }
+    }
+    return nullptr;
+}
+
+// CLOCK sweep: expired items go first, referenced items get a second chance.
+// Returns false after two full turns of the hand without a victim.
+bool KvShard::evict_one(uint8_t size_class, int64_t now, bool any_class) {
+    for (size_t scanned = 0; scanned < 2 * slots_.size() && size_ > 0; ++scanned) {
+        size_t i = clock_hand_;
+        clock_hand_ = (clock_hand_ + 1) & mask_;
+        Slot& slot = slots_[i];
+        if (slot.hash == 0) continue;
+
+        bool expired = slot.expires_at != 0 && slot.expires_at <= now;
+        if (!expired && !any_class && slot.size_class != size_class) continue;
+        if (!expired && slot.referenced) {
+            slot.referenced = false;
+            continue;
+        }
+
+        erase_at(i);
+        bump(evictions_);
+        // backward shift may have moved an unvisited entry into slot i
+        clock_hand_ = i;
+        return true;
+    }
+    return false;
+}
+
+void KvShard::grow() {
+    std::vector<Slot> old = std::move(slots_);
+    slots_.assign(old.size() * 2, Slot{});
+    mask_ = slots_.size() - 1;
+    clock_hand_ = 0;
+    for (const Slot& slot : old) {
+        if (slot.hash == 0) continue;
+        size_t i = slot.hash & mask_;
+        while (slots_[i].hash != 0) {
+            i = (i + 1) & mask_;
+        }
+        slots_[i] = slot;
+    }
+}
+
+void KvShard::publish_sizes() {
+    published_items_.store(static_cast<long long>(size_), std::memory_order_relaxed);
+    published_in_use_.store(arena_.bytes_in_use(), std::memory_order_relaxed);
+    published_reserved_.store(arena_.bytes_reserved(), std::memory_order_relaxed);
+}
+
+// reads only the published atomics, so it is safe from any thread
+void KvShard::collect(KvStats& stats) const {
+    stats.hits += hits_.load(std::memory_order_relaxed);
+    stats.misses += misses_.load(std::memory_order_relaxed);
+    stats.evictions += evictions_.load(std::memory_order_relaxed);
+    stats.items += published_items_.load(std::memory_order_relaxed);
+    stats.bytes_in_use += published_in_use_.load(std::memory_order_relaxed);
+    stats.bytes_reserved += published_reserved_.load(std::memory_order_relaxed);
+}
+
+
+// the limit is split evenly; every shard can still grow to at least one page
+KvStore::KvStore(size_t memory_limit, size_t lock_stripes) : locked_(lock_stripes > 0) {
+    size_t count = std::max<size_t>(1, lock_stripes);
+    for (size_t i = 0; i < count; ++i) {
+        shards_.push_back(std::make_unique<Shard>(memory_limit / count));
+    }
+}
+
+namespace {
+
+int64_t now_seconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+// GET <key> | SET <key> <ttl-seconds> <value> | DEL <key>
+void KvStore::execute(std::string_view line, std::string& reply) {
+    std::string_view rest = trim_line(line);
+    std::string_view command = next_token(rest);
+    std::string_view key = next_token(rest);
+    if (key.empty()) {
+        reply += "ERROR expected a key\n";
+        return;
+    }
+
+    uint64_t hash = std::hash<std::string_view>{}(key);
+    hash = hash ? hash : 1;
+    Shard& shard = shard_for(hash);
+    std::unique_lock<std::mutex> lock(shard.mtx, std::defer_lock);
+    if (locked_) {
+        lock.lock();
+    }
+
+    if (equals_ignore_case(command, "GET")) {
+        if (auto value = shard.data.get(key, hash, now_seconds())) {
+            reply += "VALUE ";
+            reply += *value;
+            reply += '\n';
+        } else {
+            reply += "NOT_FOUND\n";
+        }
+    } else if (equals_ignore_case(command, "SET")) {
+        std::string_view ttl = next_token(rest);
+        int64_t ttl_seconds = 0;
+        auto [ptr, ec] = std::from_chars(ttl.data(), ttl.data() + ttl.size(), ttl_seconds);
+        if (ttl.empty() || ec != std::errc{} || ptr != ttl.data() + ttl.size() || ttl_seconds < 0) {
+            reply += "ERROR bad ttl\n";
+        } else if (shard.data.set(key, rest, hash, now_seconds(), ttl_seconds)) {
+            reply += "STORED\n";
+        } else {
+            reply += "SERVER_ERROR out of memory\n";
+        }
+    } else if (equals_ignore_case(command, "DEL")) {
+        reply += shard.data.del(key, hash) ? "DELETED\n" : "NOT_FOUND\n";
+    } else {
+        reply += "ERROR unknown command\n";
+    }
+}
+
+// lock-free: the event-loop shard is never locked, so collect() must not
+// touch anything but its atomics
+KvStats KvStore::stats() {
+    KvStats stats;
+    for (auto& shard : shards_) {
+        shard->data.collect(stats);
+    }
+    return stats;
+}
@@ -0,0 +1,36 @@
+#include "loop_stats.hpp"
+
+
+Log2Histogram::Snapshot Log2Histogram::drain() {
+    Snapshot snapshot;
+    for (size_t i = 0; i < kBuckets; ++i) {
+        snapshot[i] = buckets_[i].exchange(0, std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+uint64_t Log2Histogram::count(const Snapshot& snapshot) {
+    uint64_t total = 0;
+    for (uint64_t bucket : snapshot) {
+        total += bucket;
+    }
+    return total;
+}
+
+uint64_t Log2Histogram::percentile(const Snapshot& snapshot, double fraction) {
+    uint64_t total = count(snapshot);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; ++i) {
+        seen += snapshot[i];
+        if (total > 0 && seen >= total * fraction) {
+            return i == 0 ? 0 : (1ULL << i) - 1;
+        }
+    }
+    return 0;
+}
+
+std::string Log2Histogram::summary(const Snapshot& snapshot) {
+    return "p50<=" + std::to_string(percentile(snapshot, 0.5)) +
+           " p99<=" + std::to_string(percentile(snapshot, 0.99)) +
+           " max<=" + std::to_string(percentile(snapshot, 1.0));
+}
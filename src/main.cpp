@@ -1,22 +1,149 @@
 #include "server.hpp"
 
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+
 
 Server* server = nullptr;
 
 void print_usage(const char* program_name) {
-    std::cout << "Usage: " << program_name << " <server_type> [port]\n"
-              << "  server_type: bio | select | poll | epoll\n"
-              << "  port:        server port (default: 18081)\n\n"
+    std::cout << "Usage: " << program_name << " <server_type> [port] [options]\n"
+              << "  server_type: auto | bio | select | poll | epoll | iouring | co-epoll | co-iouring\n"
+              << "               auto probes the kernel and picks iouring or epoll\n"
+              << "  port:        server port (default: 18081)\n"
+              << "Options:\n"
+              << "  --zerocopy-threshold BYTES   send replies of at least BYTES with MSG_ZEROCOPY (epoll)\n"
+              << "                               or IORING_OP_SEND_ZC (iouring); 0 disables (default: 0)\n"
+              << "  --max-message BYTES          drop clients buffering more than BYTES without a newline\n"
+              << "  --splice                     bulk-stream echo through a pipe with splice(2) or\n"
+              << "                               IORING_OP_SPLICE, no message framing (epoll, iouring)\n"
+              << "  --protocol echo|kv|pubsub|http\n"
+              << "                               echo messages back (default), serve the cache protocol:\n"
+              << "                               GET <key> | SET <key> <ttl-seconds> <value> | DEL <key>\n"
+              << "                               topics (epoll, iouring):\n"
+              << "                               SUBSCRIBE <topic> | UNSUBSCRIBE <topic> | PUBLISH <topic> <payload>\n"
+              << "                               or HTTP/1.1 requests, keep-alive and pipelined\n"
+              << "  --http-body BYTES|echo       HTTP response body: BYTES of 'x', or the request body\n"
+              << "                               (its target if it has none); default: Hello, World!\n"
+              << "  --static-dir DIR             HTTP: GET /name answers with the file DIR/name, sent with\n"
+              << "                               sendfile(2) or IORING_OP_SPLICE (co-*: pread+send)\n"
+              << "  --static-copy                send those files with pread+send instead, for comparison\n"
+              << "  --kv-memory MB               cache arena limit (default: 64)\n"
+              << "  --subscriber-queue BYTES     fan-out bytes a subscriber may have queued (default: 4MB)\n"
+              << "  --slow-subscriber drop|disconnect\n"
+              << "                               what to do when that queue is full (default: drop)\n"
+              << "  --udp                        serve datagrams instead of connections (epoll, iouring);\n"
+              << "                               each datagram holds one or more messages\n"
+              << "  --udp-sockets N              SO_REUSEPORT sockets, one loop thread each (default: 1)\n"
+              << "  --udp-gso                    coalesce receives with UDP_GRO and same-sized replies\n"
+              << "                               with UDP_SEGMENT\n"
+              << "  --unix PATH                  listen on an AF_UNIX stream socket instead of TCP\n"
+              << "  --seqpacket                  make that socket SOCK_SEQPACKET; replies leave in\n"
+              << "                               records of at most 16KB\n"
+              << "  --listen-fd N                serve an inherited, already bound TCP or AF_UNIX socket\n"
+              << "  --max-connections N          refuse connections beyond N (default: 0, no limit)\n"
+              << "  --max-lag-us US              refuse connections while the loop runs more than US\n"
+              << "                               behind its events (default: 0, off; not bio)\n"
+              << "  --busy-reply                 answer refused connections, and messages read while\n"
+              << "                               over --max-lag-us, with BUSY instead of handling them\n"
+              << "  --read-budget BYTES          epoll: bytes read from one connection before other ready\n"
+              << "                               connections get a turn; 0 reads until EAGAIN (default: 65536)\n"
+              << "  --offload-workers N          handle messages on N worker threads, off the event loop\n"
+              << "                               (epoll, iouring; default: 0, on the loop)\n"
+              << "  --handler-cost-us US         burn US of CPU per message, to simulate a heavy handler\n"
+              << "  --log-dir DIR                append every message to a log in DIR and reply once it\n"
+              << "                               is on disk; restarts replay it (epoll, iouring)\n"
+              << "  --log-segment-mb MB          size of each preallocated log file (default: 64)\n"
+              << "  --capture FILE               record every message with its connection and arrival\n"
+              << "                               time, for benchmark-client --replay FILE\n"
+              << "  --trace-sample N             trace 1 of every N messages; kill -USR1 writes the\n"
+              << "                               samples as Chrome trace JSON (default: 0, off)\n"
+              << "  --trace-file PREFIX          trace files are PREFIX-<pid>-<n>.json (default: trace)\n"
+              << "  --drain-ms MS                on SIGINT/SIGTERM stop accepting and close idle connections\n"
+              << "                               over up to MS before exiting; a second signal exits at once\n"
+              << "                               (default: 5000)\n"
+              << "  --handoff PATH               pass the listening socket to a successor started with\n"
+              << "                               --takeover PATH, then drain\n"
+              << "  --takeover PATH              serve the listening socket of the server on --handoff PATH\n"
+              << "                               instead of binding one\n\n"
               << "Examples:\n"
+              << "  " << program_name << " auto\n"
               << "  " << program_name << " bio\n"
-              << "  " << program_name << " epoll 8080\n";
+              << "  " << program_name << " epoll 8080\n"
+              << "  " << program_name << " iouring 8080 --zerocopy-threshold 65536\n"
+              << "  " << program_name << " epoll 8080 --protocol kv --kv-memory 256\n"
+              << "  " << program_name << " iouring 8080 --protocol http\n"
+              << "  " << program_name << " epoll 8080 --protocol http --static-dir /var/www\n"
+              << "  " << program_name << " epoll 8080 --udp --udp-sockets 4\n"
+              << "  " << program_name << " epoll 8080 --max-connections 10000 --max-lag-us 2000 --busy-reply\n"
+              << "  " << program_name << " iouring --unix /tmp/cpp-io.sock\n"
+              << "  " << program_name << " epoll 8080 --offload-workers 4 --handler-cost-us 200\n"
+              << "  " << program_name << " epoll 8080 --protocol kv --log-dir /var/tmp/cpp-io-log\n"
+              << "  " << program_name << " epoll 8080 --handoff /tmp/cpp-io.handoff\n"
+              << "  " << program_name << " epoll 8080 --takeover /tmp/cpp-io.handoff --handoff /tmp/cpp-io.handoff\n";
 }
 
 
-void signal_handler(int signal){
-    Logger::info("Received signal ", signal, ", shutting down...");
-    server->stop();
-    std::exit(0);
+// The fastest backend this kernel fully supports, and the features it should use.
+ServerKind choose_server_kind(const PlatformFeatures& features, ServerConfig& config) {
+    Logger::info("Platform: ", describe(features));
+    if (features.nofile < 65536) {
+        Logger::info("RLIMIT_NOFILE is ", features.nofile, ", connections beyond that will be refused");
+    }
+    ServerKind kind = ServerKind::Epoll;
+    if (features.io_uring && features.core_ops) {
+        kind = ServerKind::IOUring;
+        config.io_uring_sqpoll = features.sqpoll;
+        Logger::info("auto: using iouring", features.sqpoll ? " with SQPOLL" : " without SQPOLL",
+                     " and provided recv buffers");
+        if (config.zerocopy_threshold > 0 && !features.send_zc) {
+            Logger::info("auto: IORING_OP_SEND_ZC unsupported, zerocopy off");
+            config.zerocopy_threshold = 0;
+        }
+        if (config.splice_echo && !features.splice) {
+            Logger::info("auto: IORING_OP_SPLICE unsupported, using the message path");
+            config.splice_echo = false;
+        }
+    } else {
+        Logger::info("auto: using epoll, ", !features.io_uring ? "io_uring cannot be set up"
+                                                               : "io_uring lacks accept/recv/sendmsg/provide-buffers");
+        if (config.zerocopy_threshold > 0 && !features.so_zerocopy) {
+            Logger::info("auto: SO_ZEROCOPY unsupported, zerocopy off");
+            config.zerocopy_threshold = 0;
+        }
+    }
+    return kind;
+}
+
+// SIGINT, SIGTERM and SIGUSR1 are blocked in every thread and read from a
+// signalfd here, so stopping the server may lock and log, and no loop's wait
+// is cut short with EINTR. A write to quit_fd ends the thread once run() has
+// returned.
+void watch_signals(int signal_fd, int quit_fd){
+    pollfd fds[2] = {{signal_fd, POLLIN, 0}, {quit_fd, POLLIN, 0}};
+    bool stopping = false;
+    while (true) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[1].revents & POLLIN) {
+            return;
+        }
+        signalfd_siginfo info;
+        if (read(signal_fd, &info, sizeof(info)) != sizeof(info)) {
+            continue;
+        }
+        if (info.ssi_signo == SIGUSR1) {
+            Tracer::request_dump();
+            continue;
+        }
+        Logger::info("Received signal ", info.ssi_signo, stopping ? ", stopping now" : ", draining...");
+        stopping = true;
+        server->stop();
+    }
 }
 
 
@@ -27,11 +154,111 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    uint16_t port = (argc > 2) ? static_cast<uint16_t>(std::stoi(argv[2])) : 18081;
+    uint16_t port = 18081;
+    ServerConfig config;
+    uint32_t trace_sample = 0;
+    std::string trace_prefix = "trace";
+    for (int i = 2; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--zerocopy-threshold" && i + 1 < argc) {
+            config.zerocopy_threshold = std::stoull(argv[++i]);
+        } else if (arg == "--max-message" && i + 1 < argc) {
+            config.max_message_size = std::stoull(argv[++i]);
+        } else if (arg == "--splice") {
+            config.splice_echo = true;
+        } else if (arg == "--protocol" && i + 1 < argc) {
+            std::string_view protocol = argv[++i];
+            if (protocol == "kv") {
+                config.protocol = Protocol::Kv;
+            } else if (protocol == "pubsub") {
+                config.protocol = Protocol::PubSub;
+            } else if (protocol == "http") {
+                config.protocol = Protocol::Http;
+            } else if (protocol != "echo") {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--http-body" && i + 1 < argc) {
+            std::string_view body = argv[++i];
+            if (body == "echo") {
+                config.http_echo = true;
+            } else {
+                config.http_body = std::stoull(argv[i]);
+            }
+        } else if (arg == "--static-dir" && i + 1 < argc) {
+            config.static_dir = argv[++i];
+        } else if (arg == "--static-copy") {
+            config.static_copy = true;
+        } else if (arg == "--kv-memory" && i + 1 < argc) {
+            config.kv_memory_limit = std::stoull(argv[++i]) * 1024 * 1024;
+        } else if (arg == "--subscriber-queue" && i + 1 < argc) {
+            config.subscriber_queue_limit = std::stoull(argv[++i]);
+        } else if (arg == "--slow-subscriber" && i + 1 < argc) {
+            std::string_view policy = argv[++i];
+            if (policy == "disconnect") {
+                config.slow_subscriber_policy = SlowSubscriberPolicy::Disconnect;
+            } else if (policy != "drop") {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--udp") {
+            config.transport = Transport::Udp;
+        } else if (arg == "--udp-sockets" && i + 1 < argc) {
+            config.udp_sockets = std::max<size_t>(1, std::stoull(argv[++i]));
+        } else if (arg == "--udp-gso") {
+            config.udp_gso = true;
+        } else if (arg == "--unix" && i + 1 < argc) {
+            config.unix_path = argv[++i];
+        } else if (arg == "--seqpacket") {
+            config.unix_seqpacket = true;
+        } else if (arg == "--listen-fd" && i + 1 < argc) {
+            config.listen_fd = std::stoi(argv[++i]);
+        } else if (arg == "--max-connections" && i + 1 < argc) {
+            config.max_connections = std::stoull(argv[++i]);
+        } else if (arg == "--max-lag-us" && i + 1 < argc) {
+            config.max_lag_us = std::stoull(argv[++i]);
+        } else if (arg == "--read-budget" && i + 1 < argc) {
+            config.read_budget = std::stoull(argv[++i]);
+        } else if (arg == "--offload-workers" && i + 1 < argc) {
+            config.offload_workers = std::stoull(argv[++i]);
+        } else if (arg == "--handler-cost-us" && i + 1 < argc) {
+            config.handler_cost_us = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--log-dir" && i + 1 < argc) {
+            config.log_dir = argv[++i];
+        } else if (arg == "--log-segment-mb" && i + 1 < argc) {
+            config.log_segment_size = std::max<size_t>(1, std::stoull(argv[++i])) * 1024 * 1024;
+        } else if (arg == "--capture" && i + 1 < argc) {
+            config.capture_path = argv[++i];
+        } else if (arg == "--busy-reply") {
+            config.busy_reply = true;
+        } else if (arg == "--trace-sample" && i + 1 < argc) {
+            trace_sample = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--trace-file" && i + 1 < argc) {
+            trace_prefix = argv[++i];
+        } else if (arg == "--drain-ms" && i + 1 < argc) {
+            config.drain_ms = std::stoull(argv[++i]);
+        } else if (arg == "--handoff" && i + 1 < argc) {
+            config.handoff_path = argv[++i];
+        } else if (arg == "--takeover" && i + 1 < argc) {
+            config.takeover_path = argv[++i];
+        } else if (i == 2 && !arg.starts_with("--")) {
+            port = static_cast<uint16_t>(std::stoi(argv[i]));
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.zerocopy_threshold > 0 && config.zerocopy_threshold < kMinZerocopyThreshold) {
+        Logger::info("Raising zerocopy threshold to ", kMinZerocopyThreshold, " bytes");
+        config.zerocopy_threshold = kMinZerocopyThreshold;
+    }
     Logger::info("Using port ", port, " for server ", argv[1]);
     ServerKind kind = ServerKind::Bio;
-    if (std::string_view(argv[1]) == "select") {
-        Logger::info("Using select server");
+    if (std::string_view(argv[1]) == "auto") {
+        kind = choose_server_kind(probe_platform(), config);
+    } else if (std::string_view(argv[1]) == "bio") {
+        kind = ServerKind::Bio;
+    } else if (std::string_view(argv[1]) == "select") {
         kind = ServerKind::Select;
     } else if (std::string_view(argv[1]) == "poll") {
         kind = ServerKind::Poll;
@@ -39,21 +266,140 @@ int main(int argc, char* argv[]) {
         kind = ServerKind::Epoll;
     }else if (std::string_view(argv[1]) == "iouring") {
         kind = ServerKind::IOUring;
+    } else if (std::string_view(argv[1]) == "co-epoll") {
+        kind = ServerKind::CoEpoll;
+    } else if (std::string_view(argv[1]) == "co-iouring") {
+        kind = ServerKind::CoIOUring;
+    } else {
+        Logger::error("Unknown server type ", argv[1]);
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (config.zerocopy_threshold > 0 && kind != ServerKind::Epoll && kind != ServerKind::IOUring) {
+        Logger::info("--zerocopy-threshold is only implemented for epoll and iouring, using plain sends");
+        config.zerocopy_threshold = 0;
+    }
+    if (config.splice_echo && kind != ServerKind::Epoll && kind != ServerKind::IOUring) {
+        Logger::info("--splice is only implemented for epoll and iouring, using the message path");
+        config.splice_echo = false;
+    }
+    if (config.protocol == Protocol::PubSub && kind != ServerKind::Epoll && kind != ServerKind::IOUring) {
+        Logger::error("--protocol pubsub is only implemented for epoll and iouring");
+        return 1;
+    }
+    if (config.transport == Transport::Udp) {
+        if (kind != ServerKind::Epoll && kind != ServerKind::IOUring) {
+            Logger::error("--udp is only implemented for epoll and iouring");
+            return 1;
+        }
+        if (config.protocol == Protocol::PubSub || config.splice_echo) {
+            Logger::error("--udp serves the echo and kv protocols only");
+            return 1;
+        }
+        if (!config.unix_path.empty() || config.listen_fd >= 0) {
+            Logger::error("--udp binds its own sockets, it cannot be combined with --unix or --listen-fd");
+            return 1;
+        }
+        if (!config.handoff_path.empty() || !config.takeover_path.empty()) {
+            // a new process simply binds its own SO_REUSEPORT sockets next to the old ones
+            Logger::error("--udp has no listener to hand off, it cannot be combined with --handoff or --takeover");
+            return 1;
+        }
+    }
+    if (config.offload_workers > 0) {
+        if ((kind != ServerKind::Epoll && kind != ServerKind::IOUring) || config.transport == Transport::Udp) {
+            Logger::error("--offload-workers is only implemented for epoll and iouring over connections");
+            return 1;
+        }
+        if (config.protocol == Protocol::PubSub) {
+            Logger::error("--offload-workers cannot be combined with pubsub, whose topics belong to the loop");
+            return 1;
+        }
+        if (trace_sample > 0) {
+            // a message's spans are kept per thread, but a worker handles it and the loop sends it
+            Logger::error("--offload-workers cannot be combined with --trace-sample");
+            return 1;
+        }
+    }
+    if (!config.log_dir.empty()) {
+        if ((kind != ServerKind::Epoll && kind != ServerKind::IOUring) || config.transport == Transport::Udp) {
+            Logger::error("--log-dir is only implemented for epoll and iouring over connections");
+            return 1;
+        }
+        if (config.protocol == Protocol::PubSub || config.splice_echo) {
+            Logger::error("--log-dir logs framed request messages, not pubsub or --splice");
+            return 1;
+        }
+    }
+    if (!config.capture_path.empty() && (config.transport == Transport::Udp || config.splice_echo)) {
+        Logger::error("--capture records the messages of connections, not --udp or --splice");
+        return 1;
+    }
+    if (config.max_lag_us > 0 && (kind == ServerKind::Bio || config.transport == Transport::Udp)) {
+        Logger::info("--max-lag-us needs a single event loop, only --max-connections applies");
+    }
+    if (config.protocol == Protocol::Http) {
+        // requests are not '\n'-framed, so nothing that frames, logs or handles lines applies
+        if (config.transport == Transport::Udp || config.splice_echo || config.offload_workers > 0 ||
+            !config.log_dir.empty() || !config.capture_path.empty()) {
+            Logger::error("--protocol http cannot be combined with --udp, --splice, --offload-workers, "
+                          "--log-dir or --capture");
+            return 1;
+        }
+    } else if (!config.static_dir.empty() || config.static_copy) {
+        Logger::error("--static-dir and --static-copy need --protocol http");
+        return 1;
+    }
+    if (config.static_copy && config.static_dir.empty()) {
+        Logger::error("--static-copy needs --static-dir DIR");
+        return 1;
+    }
+    if (!config.static_dir.empty() && (kind == ServerKind::CoEpoll || kind == ServerKind::CoIOUring)) {
+        Logger::info("The coroutine servers send static files with pread+send");
+    }
+    if (config.unix_seqpacket && config.unix_path.empty()) {
+        Logger::error("--seqpacket needs --unix PATH");
+        return 1;
+    }
+    if (!config.takeover_path.empty() && config.listen_fd >= 0) {
+        Logger::error("--takeover receives its listener, it cannot be combined with --listen-fd");
+        return 1;
     }
     Server the_server = Server::make(kind);
+    the_server.configure(config);
     server = &the_server;
 
-    signal(SIGINT, signal_handler);// 2: ctrl+c
-    signal(SIGTERM, signal_handler);// 15: kill
+    // blocked before any thread starts, so every thread inherits the mask
+    sigset_t handled_signals;
+    sigemptyset(&handled_signals);
+    sigaddset(&handled_signals, SIGINT);  // 2: ctrl+c
+    sigaddset(&handled_signals, SIGTERM); // 15: kill
+    sigaddset(&handled_signals, SIGUSR1); // trace dump
+    pthread_sigmask(SIG_BLOCK, &handled_signals, nullptr);
+    SocketRAII signal_fd(signalfd(-1, &handled_signals, SFD_CLOEXEC));
+    SocketRAII quit_fd(eventfd(0, EFD_CLOEXEC));
+    if (signal_fd.get() == -1 || quit_fd.get() == -1) {
+        Logger::error("Failed to set up signal handling");
+        return 1;
+    }
+    std::thread signal_thread(watch_signals, signal_fd.get(), quit_fd.get());
+    Tracer::configure(trace_sample, trace_prefix);
 
     Logger::info("Server ", server->get_name(), " started on port ", port);
     
     Timer timer;
+    int status = 0;
     try{
         server->run(port);
     } catch (const std::exception& e){
         Logger::error("Server ", server->get_name(), " failed: ", e.what());
-        return 1;
+        status = 1;
+    }
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t n = write(quit_fd.get(), &one, sizeof(one));
+    signal_thread.join();
+    if (status != 0) {
+        return status;
     }
 
     auto elapsed_ms = timer.elapsed();
@@ -0,0 +1,348 @@
+#include "message_log.hpp"
+
+#include <array>
+#include <dirent.h>
+
+
+namespace {
+
+// CRC-32C (Castagnoli), reflected, one table lookup per byte.
+constexpr std::array<uint32_t, 256> make_crc_table() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+constexpr std::array<uint32_t, 256> kCrcTable = make_crc_table();
+
+uint32_t crc32c(std::string_view data) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (unsigned char byte : data) {
+        crc = kCrcTable[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+std::string segment_path(const std::string& dir, uint64_t first_seq) {
+    char name[32];
+    snprintf(name, sizeof(name), "%020llu.log", static_cast<unsigned long long>(first_seq));
+    return dir + "/" + name;
+}
+
+// a new file's directory entry is only durable once the directory is synced
+bool sync_directory(const std::string& dir) {
+    SocketRAII dir_fd(::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    return dir_fd.get() != -1 && ::fsync(dir_fd.get()) == 0;
+}
+
+} // namespace
+
+
+LogSegment::~LogSegment() {
+    if (data != nullptr) {
+        ::munmap(data, size);
+    }
+    if (fd != -1) {
+        ::close(fd);
+    }
+}
+
+std::shared_ptr<LogSegment> LogSegment::create(const std::string& dir, uint64_t first_seq, size_t size) {
+    auto segment = std::make_shared<LogSegment>();
+    segment->path = segment_path(dir, first_seq);
+    segment->first_seq = first_seq;
+    segment->fd = ::open(segment->path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (segment->fd == -1) {
+        Logger::error("Failed to create log segment ", segment->path, ": ", strerror(errno));
+        return nullptr;
+    }
+    // allocated now, so an fdatasync never has to persist a size change
+    if (int err = posix_fallocate(segment->fd, 0, static_cast<off_t>(size)); err != 0) {
+        Logger::error("Failed to preallocate log segment ", segment->path, ": ", strerror(err));
+        ::unlink(segment->path.c_str());
+        return nullptr;
+    }
+    void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    if (data == MAP_FAILED) {
+        Logger::error("Failed to map log segment ", segment->path, ": ", strerror(errno));
+        ::unlink(segment->path.c_str());
+        return nullptr;
+    }
+    segment->data = static_cast<char*>(data);
+    segment->size = size;
+    if (!sync_directory(dir)) {
+        Logger::error("Failed to sync log directory ", dir);
+        ::unlink(segment->path.c_str());
+        return nullptr;
+    }
+    return segment;
+}
+
+std::shared_ptr<LogSegment> LogSegment::open(const std::string& path, uint64_t first_seq) {
+    auto segment = std::make_shared<LogSegment>();
+    segment->path = path;
+    segment->first_seq = first_seq;
+    segment->fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    struct stat st;
+    if (segment->fd == -1 || ::fstat(segment->fd, &st) == -1) {
+        Logger::error("Failed to open log segment ", path, ": ", strerror(errno));
+        return nullptr;
+    }
+    segment->size = static_cast<size_t>(st.st_size);
+    if (segment->size == 0) {
+        return segment;
+    }
+    void* data = ::mmap(nullptr, segment->size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    if (data == MAP_FAILED) {
+        Logger::error("Failed to map log segment ", path, ": ", strerror(errno));
+        return nullptr;
+    }
+    segment->data = static_cast<char*>(data);
+    return segment;
+}
+
+uint64_t LogSegment::scan(const std::function<void(std::string_view)>& visit) {
+    uint64_t records = 0;
+    used = 0;
+    while (used + kHeaderSize <= size) {
+        uint32_t length;
+        uint32_t crc;
+        std::memcpy(&length, data + used, sizeof(length));
+        std::memcpy(&crc, data + used + sizeof(length), sizeof(crc));
+        if (length == 0 || used + kHeaderSize + length > size) {
+            break;
+        }
+        std::string_view payload(data + used + kHeaderSize, length);
+        if (crc32c(payload) != crc) {
+            break;  // torn write: the record was never acknowledged
+        }
+        visit(payload);
+        used += kHeaderSize + length;
+        ++records;
+    }
+    return records;
+}
+
+void LogSegment::append(std::string_view payload) {
+    uint32_t length = static_cast<uint32_t>(payload.size());
+    uint32_t crc = crc32c(payload);
+    char* at = data + used;
+    std::memcpy(at + kHeaderSize, payload.data(), payload.size());
+    std::memcpy(at + sizeof(length), &crc, sizeof(crc));
+    std::memcpy(at, &length, sizeof(length));
+    used += kHeaderSize + payload.size();
+}
+
+
+MessageLog::MessageLog(std::string dir, size_t segment_size)
+    : dir_(std::move(dir)), segment_size_(segment_size) {}
+
+MessageLog::~MessageLog() {
+    if (syncer_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        syncer_.join();
+    }
+}
+
+bool MessageLog::open(const std::function<void(std::string_view)>& replay) {
+    if (::mkdir(dir_.c_str(), 0755) == -1 && errno != EEXIST) {
+        Logger::error("Failed to create log directory ", dir_, ": ", strerror(errno));
+        return false;
+    }
+    std::vector<std::pair<uint64_t, std::string>> files;
+    if (DIR* dir = ::opendir(dir_.c_str())) {
+        while (dirent* entry = ::readdir(dir)) {
+            std::string_view name = entry->d_name;
+            uint64_t first_seq = 0;
+            auto [ptr, ec] = std::from_chars(name.data(), name.data() + name.size(), first_seq);
+            if (ec == std::errc{} && std::string_view(ptr) == ".log") {
+                files.emplace_back(first_seq, dir_ + "/" + std::string(name));
+            }
+        }
+        ::closedir(dir);
+    }
+    std::sort(files.begin(), files.end());
+
+    for (auto& [first_seq, path] : files) {
+        auto segment = LogSegment::open(path, first_seq);
+        if (!segment) {
+            return false;
+        }
+        recovered_ = first_seq + segment->scan(replay);
+        current_ = std::move(segment);  // earlier segments are unmapped as the next one replaces them
+    }
+    appended_ = recovered_;
+    durable_.store(recovered_, std::memory_order_release);
+    if (current_ && current_->data != nullptr) {
+        // bytes behind the last valid record are a torn write, possibly with
+        // intact records after it; clear all of them so none can show up
+        // behind the ones appended from here on. A clean tail is a sparse
+        // read of zero pages, so this stays cheap on an ordinary restart.
+        char* tail = current_->data + current_->used;
+        char* end = current_->data + current_->size;
+        if (std::any_of(tail, end, [](char byte) { return byte != 0; })) {
+            std::memset(tail, 0, end - tail);
+            if (::fdatasync(current_->fd) == -1) {
+                Logger::error("Failed to clear the torn tail of the message log: ", strerror(errno));
+                return false;
+            }
+        }
+    }
+    if (current_ && current_->data == nullptr) {
+        // a crash between create's open and its fallocate left an empty file
+        // under the very name roll() is about to create; it holds no record
+        if (::unlink(current_->path.c_str()) == -1 || !sync_directory(dir_)) {
+            Logger::error("Failed to remove the empty log segment ", current_->path, ": ", strerror(errno));
+            return false;
+        }
+        current_.reset();
+    }
+    if (!current_) {
+        return roll();
+    }
+    return true;
+}
+
+bool MessageLog::roll() {
+    if (current_ && current_dirty_) {
+        dirty_.push_back(current_);
+    }
+    current_ = LogSegment::create(dir_, appended_, segment_size_);
+    current_dirty_ = false;
+    return current_ != nullptr;
+}
+
+bool MessageLog::append(std::string_view message) {
+    if (failed()) {
+        return false;
+    }
+    if (!current_->fits(message.size())) {
+        if (LogSegment::kHeaderSize + message.size() > segment_size_) {
+            Logger::error("Message of ", message.size(), " bytes does not fit a log segment");
+            return false;
+        }
+        if (!roll()) {
+            return false;
+        }
+    }
+    current_->append(message);
+    current_dirty_ = true;
+    ++appended_;
+    return true;
+}
+
+bool MessageLog::take_batch(SyncBatch& batch) {
+    if (!current_dirty_ && dirty_.empty()) {
+        return false;
+    }
+    batch.target = appended_;
+    batch.segments = std::move(dirty_);
+    dirty_.clear();
+    if (current_dirty_) {
+        batch.segments.push_back(current_);
+        current_dirty_ = false;
+    }
+    return true;
+}
+
+void MessageLog::finish_batch(const SyncBatch& batch) {
+    if (failed()) {
+        return;     // its target would cover the records of the failed batch
+    }
+    // batches finish in order, but a merged one may cover a later target first
+    uint64_t durable = durable_.load(std::memory_order_relaxed);
+    while (durable < batch.target &&
+           !durable_.compare_exchange_weak(durable, batch.target, std::memory_order_release)) {
+    }
+    syncs_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MessageLog::fail_batch(const SyncBatch& batch) {
+    if (!failed_.exchange(true, std::memory_order_acq_rel)) {
+        Logger::error("Message log stopped at ", durable(), " durable messages, ", batch.target - durable(),
+                      " or more may be lost; no further message is accepted");
+    }
+}
+
+void MessageLog::retry_batch(SyncBatch& batch) {
+    for (auto& segment : batch.segments) {
+        if (segment == current_) {
+            current_dirty_ = true;
+        } else if (std::find(dirty_.begin(), dirty_.end(), segment) == dirty_.end()) {
+            dirty_.push_back(std::move(segment));
+        }
+    }
+    // older segments first, as take_batch lists them
+    std::sort(dirty_.begin(), dirty_.end(), [](const auto& a, const auto& b) { return a->first_seq < b->first_seq; });
+    batch.segments.clear();
+}
+
+bool MessageLog::start_syncer() {
+    event_fd_ = SocketRAII(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    if (event_fd_.get() == -1) {
+        return false;
+    }
+    syncer_ = std::thread([this] { sync_loop(); });
+    return true;
+}
+
+void MessageLog::request_sync() {
+    SyncBatch batch;
+    if (!take_batch(batch)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requested_.push_back(std::move(batch));
+    }
+    wake_.notify_one();
+}
+
+void MessageLog::sync_loop() {
+    std::vector<SyncBatch> batches;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return stopping_ || !requested_.empty(); });
+            if (stopping_) {
+                return;
+            }
+            batches.swap(requested_);
+        }
+        // everything requested meanwhile rides on this one sync
+        SyncBatch merged;
+        for (SyncBatch& batch : batches) {
+            merged.target = std::max(merged.target, batch.target);
+            for (auto& segment : batch.segments) {
+                if (std::find(merged.segments.begin(), merged.segments.end(), segment) == merged.segments.end()) {
+                    merged.segments.push_back(std::move(segment));
+                }
+            }
+        }
+        batches.clear();
+        bool synced = true;
+        for (auto& segment : merged.segments) {
+            if (::fdatasync(segment->fd) == -1) {
+                Logger::error("fdatasync of ", segment->path, " failed: ", strerror(errno));
+                synced = false;
+            }
+        }
+        if (synced) {
+            finish_batch(merged);
+        } else {
+            fail_batch(merged);     // the loops close whatever waits for it
+        }
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t n = ::write(event_fd_.get(), &one, sizeof(one));
+    }
+}
@@ -0,0 +1,74 @@
+#include "offload.hpp"
+
+
+OffloadCompletions::OffloadCompletions()
+    : event_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+OffloadJob* OffloadCompletions::acquire() {
+    if (free_.empty()) {
+        jobs_.push_back(std::make_unique<OffloadJob>());
+        jobs_.back()->completions = this;
+        return jobs_.back().get();
+    }
+    OffloadJob* job = free_.back();
+    free_.pop_back();
+    return job;
+}
+
+void OffloadCompletions::release(OffloadJob* job) {
+    // the strings keep their capacity for the next job
+    job->input.clear();
+    job->output.clear();
+    job->shed = false;
+    free_.push_back(job);
+}
+
+void OffloadCompletions::complete(OffloadJob* job) {
+    done_.push(job);
+    if (!signalled_.exchange(true, std::memory_order_seq_cst)) {
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t n = ::write(event_fd_.get(), &one, sizeof(one));
+    }
+}
+
+
+OffloadPool::OffloadPool(size_t workers, Handler handler) : handler_(std::move(handler)) {
+    for (size_t i = 0; i < workers; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (auto& worker : workers_) {
+        worker->thread = std::thread([this, w = worker.get()] { work(*w); });
+    }
+}
+
+OffloadPool::~OffloadPool() {
+    stopping_.store(true, std::memory_order_relaxed);
+    for (auto& worker : workers_) {
+        worker->ready.release();
+    }
+    for (auto& worker : workers_) {
+        worker->thread.join();
+    }
+}
+
+void OffloadPool::submit(OffloadJob* job) {
+    Worker& worker = *workers_[static_cast<size_t>(job->fd) % workers_.size()];
+    worker.queue.push(job);
+    worker.ready.release();
+}
+
+void OffloadPool::work(Worker& worker) {
+    while (true) {
+        worker.ready.acquire();
+        if (stopping_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        OffloadJob* job;
+        // a release can run ahead of its node becoming visible
+        while ((job = worker.queue.pop()) == nullptr) {
+            std::this_thread::yield();
+        }
+        handler_(*job);
+        job->completions->complete(job);
+    }
+}
@@ -10,17 +10,58 @@ void PollServer::run(uint16_t port){
     auto server_fd = std::move(server_fd_opt.value());
 
     // init poll fd
+    // [0] the listener, [1] the stop eventfd; a negative fd is skipped by poll
     std::vector<pollfd> poll_fds;
     poll_fds.emplace_back(server_fd.get(), POLLIN);
+    poll_fds.emplace_back(stop_fd_.get(), POLLIN);
+    bool draining = false;
+    DrainTimer drain{};
 
+    LoopProbe probe(loop_stats_);
+    loop_probe_ = &probe;
     while(running_){
-        int nready = poll(poll_fds.data(), poll_fds.size(), -1); // copy poll_fds to kernel space (every time)
+        probe.before_wait();
+        // a draining loop also wakes every tick to close idle connections
+        int timeout = draining ? static_cast<int>(kDrainTick.count()) : -1;
+        int nready = poll(poll_fds.data(), poll_fds.size(), timeout); // copy poll_fds to kernel space (every time)
+        probe.after_wait(std::max(nready, 0));
+        trace_ready();
         if (nready == -1) {
             if (running_) {
                 Logger::error("Failed to poll");
             }
             continue;
         }
+        if (poll_fds[1].revents & POLLIN) {
+            // no more accepts; with a successor, it takes the connections still queued
+            draining = true;
+            drain = start_drain();
+            poll_fds[0].fd = -1;
+            poll_fds[1].fd = -1;
+            poll_fds[0].revents = 0;
+            poll_fds[1].revents = 0;
+            server_fd = SocketRAII();
+            Logger::info(get_name(), " draining ", poll_fds.size() - 2, " connections");
+        }
+        if (draining) {
+            // replies were sent before poll was called again, so a connection
+            // without a partial message is idle
+            size_t quota = drain.quota(poll_fds.size() - 2 - pending_input_.size());
+            for (auto it = poll_fds.begin() + 2; it != poll_fds.end() && quota > 0;) {
+                if (pending_input_.contains(it->fd) || it->revents != 0) {
+                    ++it;
+                    continue;
+                }
+                ::close(it->fd);
+                trace_closed(it->fd);
+                it = poll_fds.erase(it);
+                active_connections_--;
+                quota--;
+            }
+            if (poll_fds.size() == 2 || drain.expired()) {
+                break;
+            }
+        }
         if (poll_fds[0].revents & POLLIN) {
             sockaddr_in client_addr{};
             socklen_t client_addr_len = sizeof(client_addr);
@@ -31,19 +72,22 @@ void PollServer::run(uint16_t port){
                 }
                 continue;
             }
-
-            poll_fds.emplace_back(client_fd, POLLIN);
-            active_connections_++;
+            if (admit_connection(client_fd)) {
+                poll_fds.emplace_back(client_fd, POLLIN);
+                active_connections_++;
+            }
             // Logger::info("New connection from ", client_fd);
         }
-        for (auto it = poll_fds.begin() + 1; it != poll_fds.end();) { // 跳过监听fd
+        for (auto it = poll_fds.begin() + 2; it != poll_fds.end();) { // 跳过监听fd和 stop fd
             int client_fd = it->fd;
             
             // 优先处理断开和错误事件
             if (it->revents & (POLLHUP | POLLERR)) {
                 ::close(client_fd);
+                pending_input_.erase(client_fd);
                 it = poll_fds.erase(it);
                 active_connections_--;
+                trace_closed(client_fd);
                 // Logger::info("Client-", client_fd, " disconnected (HUP/ERR). Active connections: ", active_connections_.load());
                 continue;
             }
@@ -52,8 +96,10 @@ void PollServer::run(uint16_t port){
             if (it->revents & POLLIN) {
                 if (!handle_client_data(client_fd)) {
                     ::close(client_fd);
+                    pending_input_.erase(client_fd);
                     it = poll_fds.erase(it);
                     active_connections_--;
+                    trace_closed(client_fd);
                     // Logger::info("Client-", client_fd, " disconnected (recv failed). Active connections: ", active_connections_.load());
                     continue;
                 }
@@ -63,32 +109,47 @@ void PollServer::run(uint16_t port){
 
         
     }
-    for (auto& pfd : poll_fds) {
-        ::close(pfd.fd);
+    loop_probe_ = nullptr;
+    // the listener belongs to server_fd, the stop eventfd to the server
+    for (auto it = poll_fds.begin() + 2; it != poll_fds.end(); ++it) {
+        ::close(it->fd);
     }
     poll_fds.clear();
+    pending_input_.clear();
     Logger::info("Server stopped");
-    if (stats_thread_.joinable()) {
-        stats_thread_.join();
-    }
+    stop_service();
 }
 
 
 bool PollServer::handle_client_data(int client_fd){
-    char buffer[1024];
-    ssize_t bytes_read = ::recv(client_fd, buffer, sizeof(buffer)-1, 0);
+    char buffer[kReadChunk];
+    ssize_t bytes_read = ::recv(client_fd, buffer, sizeof(buffer), 0);
+    recv_calls_++;
     if (bytes_read <= 0) {
         return false;
     }
-    buffer[bytes_read] = '\0';
-    std::string response = "Echo[" + std::to_string(total_messages_.load(std::memory_order_relaxed)) + "]:" + std::string(buffer);
-    if (buffer[bytes_read] == '\n'){
-        response.pop_back(); 
+    trace_recv();
+    PooledBuffer& input = pending_input_[client_fd];
+    reply_.clear();
+    file_sends_.clear();
+    bool close_after = false;
+    bool within_limit = process_input(input, std::string_view(buffer, bytes_read), reply_, client_fd, &file_sends_,
+                                      &close_after);
+    if (input.empty()) {
+        pending_input_.erase(client_fd);
     }
-    if (::send(client_fd, response.c_str(), response.size(), 0) == -1) {
-        Logger::error("Failed to send response to client");
+    if (!within_limit) {
+        Logger::error("Client-", client_fd, " sent an oversized or malformed message");
         return false;
     }
-    total_messages_++;
-    return true;
+    // everything this recv produced goes out in one call
+    if (!reply_.empty()) {
+        send_calls_ += 1 + file_sends_.size();
+        if (!send_reply(client_fd, reply_, file_sends_)) {
+            Logger::error("Failed to send response to client");
+            return false;
+        }
+        trace_sent(client_fd);
+    }
+    return !close_after;
 }
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "probe.hpp"
+#include "utils.hpp"
+
+namespace {
+
+rlim_t raise_limit(int resource) {
+    rlimit limit{};
+    if (getrlimit(resource, &limit) == -1) {
+        return 0;
+    }
+    if (limit.rlim_cur < limit.rlim_max) {
+        rlimit raised = limit;
+        raised.rlim_cur = limit.rlim_max;
+        if (setrlimit(resource, &raised) == 0) {
+            limit = raised;
+        }
+    }
+    return limit.rlim_cur;
+}
+
+void probe_io_uring(PlatformFeatures& features) {
+    struct io_uring ring;
+    io_uring_params params{};
+    params.flags = IORING_SETUP_SQPOLL;
+    if (io_uring_queue_init_params(kIOUringEntries, &ring, &params) == 0) {
+        features.sqpoll = true;
+    } else {
+        params = {};
+        if (io_uring_queue_init_params(kIOUringEntries, &ring, &params) != 0) {
+            return;     // disabled (sysctl, seccomp), too old, or out of locked memory
+        }
+    }
+    features.io_uring = true;
+    features.native_workers = params.features & IORING_FEAT_NATIVE_WORKERS;
+
+    if (struct io_uring_probe* probe = io_uring_get_probe_ring(&ring)) {
+        features.core_ops = io_uring_opcode_supported(probe, IORING_OP_ACCEPT) &&
+                            io_uring_opcode_supported(probe, IORING_OP_RECV) &&
+                            io_uring_opcode_supported(probe, IORING_OP_SENDMSG) &&
+                            io_uring_opcode_supported(probe, IORING_OP_PROVIDE_BUFFERS);
+        features.send_zc = io_uring_opcode_supported(probe, IORING_OP_SEND_ZC);
+        features.splice = io_uring_opcode_supported(probe, IORING_OP_SPLICE);
+        io_uring_free_probe(probe);
+    }
+    io_uring_queue_exit(&ring);
+}
+
+}
+
+PlatformFeatures probe_platform() {
+    PlatformFeatures features;
+    features.nofile = raise_limit(RLIMIT_NOFILE);
+    features.memlock = raise_limit(RLIMIT_MEMLOCK);
+    probe_io_uring(features);
+
+    SocketRAII sock(socket(AF_INET, SOCK_STREAM, 0));
+    int one = 1;
+    features.so_zerocopy = sock.get() != -1 &&
+                           setsockopt(sock.get(), SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+    return features;
+}
+
+std::string describe(const PlatformFeatures& features) {
+    auto yes_no = [](bool value) { return value ? "yes" : "no"; };
+    auto limit = [](rlim_t value) {
+        return value == RLIM_INFINITY ? std::string("unlimited") : std::to_string(value);
+    };
+    std::ostringstream out;
+    out << "io_uring: " << yes_no(features.io_uring)
+        << ", sqpoll: " << yes_no(features.sqpoll)
+        << ", native workers: " << yes_no(features.native_workers)
+        << ", accept/recv/sendmsg/provide-buffers: " << yes_no(features.core_ops)
+        << ", send_zc: " << yes_no(features.send_zc)
+        << ", splice: " << yes_no(features.splice)
+        << ", SO_ZEROCOPY: " << yes_no(features.so_zerocopy)
+        << ", RLIMIT_NOFILE: " << limit(features.nofile)
+        << ", RLIMIT_MEMLOCK: " << limit(features.memlock);
+    return out.str();
+}
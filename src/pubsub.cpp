@@ -0,0 +1,87 @@
+#include "pubsub.hpp"
+#include "utils.hpp"
+
+
+namespace {
+
+// single writer (the loop), so no locked read-modify-write is needed
+void add(std::atomic<long long>& counter, long long amount) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+} // namespace
+
+void PubSubHub::execute(int client_fd, std::string_view line, std::string& reply) {
+    std::string_view rest = trim_line(line);
+    std::string_view command = next_token(rest);
+    std::string topic(next_token(rest));
+    if (topic.empty()) {
+        reply += "ERROR expected a topic\n";
+        return;
+    }
+
+    if (equals_ignore_case(command, "SUBSCRIBE")) {
+        auto& topics = topics_[client_fd];
+        if (std::find(topics.begin(), topics.end(), topic) == topics.end()) {
+            topics.push_back(topic);
+            subscribers_[topic].push_back(client_fd);
+        }
+        reply += "SUBSCRIBED " + topic + "\n";
+    } else if (equals_ignore_case(command, "UNSUBSCRIBE")) {
+        unsubscribe(client_fd, topic);
+        auto it = topics_.find(client_fd);
+        if (it != topics_.end()) {
+            std::erase(it->second, topic);
+        }
+        reply += "UNSUBSCRIBED " + topic + "\n";
+    } else if (equals_ignore_case(command, "PUBLISH")) {
+        add(published_, 1);
+        long long receivers = 0;
+        auto it = subscribers_.find(topic);
+        if (it != subscribers_.end()) {
+            auto message = std::make_shared<const std::string>(
+                "MESSAGE " + topic + " " + std::string(rest) + "\n");
+            for (int fd : it->second) {
+                switch (deliver_(fd, message)) {
+                    case Delivery::Queued:
+                        receivers++;
+                        break;
+                    case Delivery::Dropped:
+                        add(dropped_, 1);
+                        break;
+                    case Delivery::Overflow:
+                        add(disconnected_, 1);
+                        break;
+                }
+            }
+        }
+        add(delivered_, receivers);
+        reply += "PUBLISHED " + std::to_string(receivers) + "\n";
+    } else {
+        reply += "ERROR unknown command\n";
+    }
+}
+
+void PubSubHub::unsubscribe(int client_fd, const std::string& topic) {
+    auto it = subscribers_.find(topic);
+    if (it == subscribers_.end()) return;
+    auto& fds = it->second;
+    auto pos = std::find(fds.begin(), fds.end(), client_fd);
+    if (pos != fds.end()) {
+        // order of delivery across subscribers does not matter
+        *pos = fds.back();
+        fds.pop_back();
+    }
+    if (fds.empty()) {
+        subscribers_.erase(it);
+    }
+}
+
+void PubSubHub::remove_client(int client_fd) {
+    auto it = topics_.find(client_fd);
+    if (it == topics_.end()) return;
+    for (const std::string& topic : it->second) {
+        unsubscribe(client_fd, topic);
+    }
+    topics_.erase(it);
+}
@@ -15,12 +15,24 @@ void SelectServer::run(uint16_t port){
     // add server_fd to master_fds, that is, we will monitor server_fd for new connections
     FD_SET(server_fd.get(), &master_fds);
 
-    int max_fd = server_fd.get();
+    // readable once a stop was requested
+    FD_SET(stop_fd_.get(), &master_fds);
+
+    int max_fd = std::max(server_fd.get(), stop_fd_.get());
     std::vector<SocketRAII> client_fds;
+    bool draining = false;
+    DrainTimer drain{};
 
+    LoopProbe probe(loop_stats_);
+    loop_probe_ = &probe;
     while(running_) {
         read_fds = master_fds; // copy master_fds to read_fds
-        int nready = select(max_fd + 1, &read_fds, nullptr, nullptr, nullptr);
+        // a draining loop also wakes every tick to close idle connections
+        timeval tick{0, static_cast<suseconds_t>(std::chrono::microseconds(kDrainTick).count())};
+        probe.before_wait();
+        int nready = select(max_fd + 1, &read_fds, nullptr, nullptr, draining ? &tick : nullptr);
+        probe.after_wait(std::max(nready, 0));
+        trace_ready();
         if (nready == -1) {
             if (running_) {
                 Logger::error("Failed to select");
@@ -28,8 +40,39 @@ void SelectServer::run(uint16_t port){
             continue;
         }
 
+        if (!draining && FD_ISSET(stop_fd_.get(), &read_fds)) {
+            // no more accepts; with a successor, it takes the connections still queued
+            draining = true;
+            drain = start_drain();
+            FD_CLR(stop_fd_.get(), &master_fds);
+            FD_CLR(server_fd.get(), &master_fds);
+            FD_CLR(server_fd.get(), &read_fds);
+            server_fd = SocketRAII();
+            Logger::info(get_name(), " draining ", client_fds.size(), " connections");
+        }
+        if (draining) {
+            // replies were sent before select was called again, so a connection
+            // without a partial message is idle
+            size_t quota = drain.quota(client_fds.size() - pending_input_.size());
+            for (auto it = client_fds.begin(); it != client_fds.end() && quota > 0;) {
+                int client_fd = it->get();
+                if (pending_input_.contains(client_fd) || FD_ISSET(client_fd, &read_fds)) {
+                    ++it;
+                    continue;
+                }
+                FD_CLR(client_fd, &master_fds);
+                it = client_fds.erase(it);
+                active_connections_--;
+                trace_closed(client_fd);
+                quota--;
+            }
+            if (client_fds.empty() || drain.expired()) {
+                break;
+            }
+        }
+
         // check if there is a new connection
-        if (FD_ISSET(server_fd.get(), &read_fds)) {
+        if (server_fd.get() != -1 && FD_ISSET(server_fd.get(), &read_fds)) {
             sockaddr_in client_addr{};
             socklen_t client_addr_len = sizeof(client_addr);
             int client_fd = ::accept(server_fd.get(), reinterpret_cast<sockaddr*>(&client_addr), &client_addr_len);
@@ -39,10 +82,12 @@ void SelectServer::run(uint16_t port){
                 }
                 continue;
             }
-            client_fds.emplace_back(client_fd);
-            FD_SET(client_fd, &master_fds);
-            max_fd = std::max(max_fd, client_fd);
-            active_connections_++;
+            if (admit_connection(client_fd)) {
+                client_fds.emplace_back(client_fd);
+                FD_SET(client_fd, &master_fds);
+                max_fd = std::max(max_fd, client_fd);
+                active_connections_++;
+            }
 
             // Logger::info("New connection from ", client_fd);
         }
@@ -54,8 +99,10 @@ void SelectServer::run(uint16_t port){
                 if (!handle_client_data(client_fd)) {
                     // 连接关闭
                     FD_CLR(client_fd, &master_fds);
+                    pending_input_.erase(client_fd);
                     it = client_fds.erase(it);
                     active_connections_--;
+                    trace_closed(client_fd);
                     
                     // Logger::info("Client-", client_fd, " disconnected. Active connections: ", active_connections_.load());
                     continue;
@@ -65,29 +112,43 @@ void SelectServer::run(uint16_t port){
         }
         
     }
+    loop_probe_ = nullptr;
     client_fds.clear();
+    pending_input_.clear();
     Logger::info("Server stopped");
-    if (stats_thread_.joinable()) {
-        stats_thread_.join();
-    }
+    stop_service();
 }
 
 
 bool SelectServer::handle_client_data(int client_fd){
-    char buffer[1024];
-    ssize_t bytes_read = ::recv(client_fd, buffer, sizeof(buffer)-1, 0);
+    char buffer[kReadChunk];
+    ssize_t bytes_read = ::recv(client_fd, buffer, sizeof(buffer), 0);
+    recv_calls_++;
     if (bytes_read <= 0) {
         return false;
     }
-    buffer[bytes_read] = '\0';
-    std::string response = "Echo[" + std::to_string(total_messages_.load(std::memory_order_relaxed)) + "]:" + std::string(buffer);
-    if (buffer[bytes_read] == '\n'){
-        response.pop_back(); 
+    trace_recv();
+    PooledBuffer& input = pending_input_[client_fd];
+    reply_.clear();
+    file_sends_.clear();
+    bool close_after = false;
+    bool within_limit = process_input(input, std::string_view(buffer, bytes_read), reply_, client_fd, &file_sends_,
+                                      &close_after);
+    if (input.empty()) {
+        pending_input_.erase(client_fd);
     }
-    if (::send(client_fd, response.c_str(), response.size(), 0) == -1) {
-        Logger::error("Failed to send response to client");
+    if (!within_limit) {
+        Logger::error("Client-", client_fd, " sent an oversized or malformed message");
         return false;
     }
-    total_messages_++;
-    return true;
+    // everything this recv produced goes out in one call
+    if (!reply_.empty()) {
+        send_calls_ += 1 + file_sends_.size();
+        if (!send_reply(client_fd, reply_, file_sends_)) {
+            Logger::error("Failed to send response to client");
+            return false;
+        }
+        trace_sent(client_fd);
+    }
+    return !close_after;
 }
\ No newline at end of file
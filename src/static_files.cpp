@@ -0,0 +1,132 @@
+#include "static_files.hpp"
+
+#include <sys/eventfd.h>
+
+
+namespace {
+
+// what makes a cached entry stale: new contents, new metadata, or another file under its name
+constexpr uint32_t kWatchMask = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO |
+                                IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF;
+
+// "/name?query" -> "name"; empty for anything outside the directory itself
+std::string_view file_name(std::string_view target) {
+    target = target.substr(0, target.find_first_of("?#"));
+    if (target.size() < 2 || target[0] != '/') {
+        return {};
+    }
+    std::string_view name = target.substr(1);
+    if (name == "." || name == ".." || name.find_first_of(std::string_view("/\0", 2)) != std::string_view::npos) {
+        return {};
+    }
+    return name;
+}
+
+} // namespace
+
+
+StaticFileCache::StaticFileCache(std::string dir)
+    : dir_(std::move(dir)), stop_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+StaticFileCache::~StaticFileCache() {
+    if (watcher_.joinable()) {
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t n = ::write(stop_fd_.get(), &one, sizeof(one));
+        watcher_.join();
+    }
+}
+
+bool StaticFileCache::open() {
+    dir_fd_ = SocketRAII(::open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (dir_fd_.get() == -1) {
+        Logger::error("Failed to open static directory ", dir_, ": ", strerror(errno));
+        return false;
+    }
+    inotify_fd_ = SocketRAII(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+    if (inotify_fd_.get() == -1 || stop_fd_.get() == -1 ||
+        inotify_add_watch(inotify_fd_.get(), dir_.c_str(), kWatchMask) == -1) {
+        Logger::error("Failed to watch static directory ", dir_, ": ", strerror(errno));
+        return false;
+    }
+    watcher_ = std::thread([this] { watch(); });
+    return true;
+}
+
+std::shared_ptr<const StaticFile> StaticFileCache::lookup(std::string_view target) {
+    std::string_view name = file_name(target);
+    if (name.empty()) {
+        return nullptr;
+    }
+    // opened under the lock: an entry is never inserted after the watcher
+    // dropped it for a change that happened before it was opened
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (auto it = files_.find(name); it != files_.end()) {
+        stats_.hits++;
+        return it->second;
+    }
+    auto file = open_file(name);
+    if (file) {
+        stats_.opens++;
+        files_.emplace(name, file);
+    }
+    return file;
+}
+
+std::shared_ptr<const StaticFile> StaticFileCache::open_file(std::string_view name) {
+    std::string path(name);
+    SocketRAII fd(::openat(dir_fd_.get(), path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW));
+    struct stat st;
+    if (fd.get() == -1 || ::fstat(fd.get(), &st) == -1 || !S_ISREG(st.st_mode)) {
+        return nullptr;
+    }
+    auto file = std::make_shared<StaticFile>();
+    file->fd = std::move(fd);
+    file->size = static_cast<size_t>(st.st_size);
+    file->mtime = st.st_mtim;
+    tm utc;
+    gmtime_r(&st.st_mtim.tv_sec, &utc);
+    char modified[64];
+    strftime(modified, sizeof(modified), "%a, %d %b %Y %H:%M:%S GMT", &utc);
+    file->headers = "Content-Length: " + std::to_string(file->size) + "\r\nLast-Modified: " + modified + "\r\n";
+    return file;
+}
+
+StaticFileStats StaticFileCache::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    StaticFileStats stats = stats_;
+    stats.files = files_.size();
+    return stats;
+}
+
+void StaticFileCache::watch() {
+    alignas(inotify_event) char buffer[4096];
+    pollfd fds[2] = {{inotify_fd_.get(), POLLIN, 0}, {stop_fd_.get(), POLLIN, 0}};
+    while (true) {
+        if (::poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[1].revents & POLLIN) {
+            return;
+        }
+        ssize_t length;
+        while ((length = ::read(inotify_fd_.get(), buffer, sizeof(buffer))) > 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (ssize_t at = 0; at < length;) {
+                const auto* event = reinterpret_cast<const inotify_event*>(buffer + at);
+                at += sizeof(inotify_event) + event->len;
+                if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    // events were lost, or the directory itself went away
+                    stats_.invalidations += files_.size();
+                    files_.clear();
+                } else if (auto it = event->len > 0 ? files_.find(std::string_view(event->name)) : files_.end();
+                           it != files_.end()) {
+                    files_.erase(it);
+                    stats_.invalidations++;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,200 @@
+#include "trace.hpp"
+#include "utils.hpp"
+
+#include <fstream>
+#include <map>
+
+std::atomic<uint32_t> Tracer::sample_every_{0};
+std::atomic<bool> Tracer::dump_requested_{false};
+std::string Tracer::file_prefix_;
+std::mutex Tracer::rings_mutex_;
+std::vector<std::shared_ptr<TraceRing>> Tracer::rings_;
+std::vector<std::shared_ptr<TraceRing>> Tracer::free_rings_;
+
+namespace {
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+struct Tracer::ThreadState {
+    std::shared_ptr<TraceRing> ring;
+    uint32_t countdown = 1;
+    uint64_t next_seq = 0;
+    int64_t ready_ns = 0;
+    int64_t recv_ns = 0;
+    std::unordered_map<int, std::vector<uint64_t>> awaiting_send;   // fd -> sampled messages
+
+    ~ThreadState() {
+        if (ring) {
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            free_rings_.push_back(std::move(ring));
+        }
+    }
+};
+
+thread_local Tracer::ThreadState Tracer::state_;
+
+
+void TraceRing::snapshot(std::vector<TraceEvent>& out) const {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t begin = head > kCapacity ? head - kCapacity : 0;
+    size_t first = out.size();
+    for (uint64_t i = begin; i < head; ++i) {
+        out.push_back(events_[i & (kCapacity - 1)]);
+    }
+    // entries the writer overwrote while we copied are torn, drop them; that
+    // includes slot now_head, which push writes before publishing it
+    uint64_t now_head = head_.load(std::memory_order_acquire);
+    uint64_t lapped = now_head + 1 > kCapacity ? now_head + 1 - kCapacity : 0;
+    if (lapped > begin) {
+        size_t skip = std::min<uint64_t>(lapped - begin, head - begin);
+        out.erase(out.begin() + first, out.begin() + first + skip);
+    }
+}
+
+
+void Tracer::configure(uint32_t sample_every, std::string file_prefix) {
+    file_prefix_ = std::move(file_prefix);
+    sample_every_.store(sample_every, std::memory_order_relaxed);
+    if (sample_every > 0) {
+        std::thread(dump_loop).detach();
+        Logger::info("Tracing 1 in ", sample_every, " messages, kill -USR1 ", getpid(),
+                     " writes ", file_prefix_, "-", getpid(), "-<n>.json");
+    }
+}
+
+Tracer::ThreadState& Tracer::thread_state() {
+    if (!state_.ring) {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        if (!free_rings_.empty()) {
+            state_.ring = std::move(free_rings_.back());
+            free_rings_.pop_back();
+        } else {
+            state_.ring = std::make_shared<TraceRing>(static_cast<uint32_t>(rings_.size() + 1));
+            rings_.push_back(state_.ring);
+        }
+        state_.countdown = sample_every_.load(std::memory_order_relaxed);
+    }
+    return state_;
+}
+
+void Tracer::mark_ready() {
+    state_.ready_ns = now_ns();
+}
+
+void Tracer::mark_recv() {
+    state_.recv_ns = now_ns();
+}
+
+uint64_t Tracer::begin_message(int fd) {
+    if (--state_.countdown != 0) {
+        return 0;
+    }
+    ThreadState& state = thread_state();
+    state.countdown = sample_every_.load(std::memory_order_relaxed);
+    uint64_t id = (static_cast<uint64_t>(state.ring->tid()) << 40) | ++state.next_seq;
+    int64_t recv_ns = state.recv_ns ? state.recv_ns : now_ns();
+    // blocking backends have no readiness step, their wakeup is the recv
+    int64_t ready_ns = state.ready_ns && state.ready_ns <= recv_ns ? state.ready_ns : recv_ns;
+    state.ring->push({id, ready_ns, fd, TracePhase::Ready});
+    state.ring->push({id, recv_ns, fd, TracePhase::Recv});
+    state.ring->push({id, now_ns(), fd, TracePhase::HandlerBegin});
+    state.awaiting_send[fd].push_back(id);
+    return id;
+}
+
+void Tracer::end_message(uint64_t id, int fd) {
+    if (id != 0) {
+        state_.ring->push({id, now_ns(), fd, TracePhase::HandlerEnd});
+    }
+}
+
+void Tracer::sent(int fd) {
+    if (state_.awaiting_send.empty()) {
+        return;
+    }
+    auto it = state_.awaiting_send.find(fd);
+    if (it == state_.awaiting_send.end()) {
+        return;
+    }
+    int64_t ts = now_ns();
+    for (uint64_t id : it->second) {
+        state_.ring->push({id, ts, fd, TracePhase::SendDone});
+    }
+    state_.awaiting_send.erase(it);
+}
+
+void Tracer::closed(int fd) {
+    state_.awaiting_send.erase(fd);
+}
+
+void Tracer::dump_loop() {
+    for (int n = 0;;) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (!dump_requested_.exchange(false, std::memory_order_relaxed)) {
+            continue;
+        }
+        std::string path = file_prefix_ + "-" + std::to_string(getpid()) + "-" + std::to_string(n++) + ".json";
+        if (dump(path)) {
+            Logger::info("Trace written to ", path);
+        } else {
+            Logger::error("Failed to write trace ", path);
+        }
+    }
+}
+
+// Each sampled message becomes four complete ("X") events on its thread's
+// track: recv (wakeup to recv done), queued (behind earlier messages of the
+// same read), handler, and send (handler end to the send completing).
+bool Tracer::dump(const std::string& path) {
+    struct Message {
+        uint32_t tid = 0;
+        int32_t fd = 0;
+        std::array<int64_t, 5> ts{};
+    };
+    std::map<uint64_t, Message> messages;
+    {
+        std::vector<TraceEvent> events;
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        for (const auto& ring : rings_) {
+            events.clear();
+            ring->snapshot(events);
+            for (const TraceEvent& event : events) {
+                Message& message = messages[event.id];
+                message.tid = ring->tid();
+                message.fd = event.fd;
+                message.ts[static_cast<size_t>(event.phase)] = event.ts_ns;
+            }
+        }
+    }
+
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+    static constexpr std::array<const char*, 4> kSpans = {"recv", "queued", "handler", "send"};
+    file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    file << std::fixed << std::setprecision(3);
+    for (const auto& [id, message] : messages) {
+        for (size_t span = 0; span < kSpans.size(); ++span) {
+            int64_t begin = message.ts[span];
+            int64_t end = message.ts[span + 1];
+            if (begin == 0 || end < begin) {
+                continue;
+            }
+            file << (first ? "" : ",") << "\n{\"name\":\"" << kSpans[span]
+                 << "\",\"cat\":\"message\",\"ph\":\"X\",\"ts\":" << begin / 1000.0
+                 << ",\"dur\":" << (end - begin) / 1000.0 << ",\"pid\":" << getpid()
+                 << ",\"tid\":" << message.tid << ",\"args\":{\"fd\":" << message.fd
+                 << ",\"id\":" << id << "}}";
+            first = false;
+        }
+    }
+    file << "\n]}\n";
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,109 @@
+#include "udp.hpp"
+
+
+UdpRecvBatch::UdpRecvBatch() {
+    for (size_t slot = 0; slot < kUdpBatch; ++slot) {
+        buffers_[slot] = BufferPool::acquire(kUdpMaxDatagram, capacity_);
+        reset(slot);
+    }
+}
+
+UdpRecvBatch::~UdpRecvBatch() {
+    for (char* buffer : buffers_) {
+        BufferPool::release(buffer, capacity_);
+    }
+}
+
+void UdpRecvBatch::reset(size_t slot) {
+    iov_[slot].iov_base = buffers_[slot];
+    iov_[slot].iov_len = kUdpMaxDatagram;
+    msghdr& msg = headers_[slot].msg_hdr;
+    msg.msg_name = &peers_[slot];
+    msg.msg_namelen = sizeof(sockaddr_storage);
+    msg.msg_iov = &iov_[slot];
+    msg.msg_iovlen = 1;
+    msg.msg_control = control_[slot].bytes;
+    msg.msg_controllen = sizeof(Control);
+    msg.msg_flags = 0;
+}
+
+size_t UdpRecvBatch::gro_size(size_t slot) const {
+    const msghdr& msg = headers_[slot].msg_hdr;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(const_cast<msghdr*>(&msg), cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int size;
+            std::memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+            return size > 0 ? static_cast<size_t>(size) : 0;
+        }
+    }
+    return 0;
+}
+
+
+void UdpReplies::add(const sockaddr_storage& peer, socklen_t peer_length, size_t offset) {
+    size_t length = data_.size() - offset;
+    if (length == 0 || length > kUdpMaxPayload) {
+        data_.resize(offset);
+        return;
+    }
+    replies_.push_back({offset, length, peer, peer_length});
+}
+
+size_t UdpReplies::build() {
+    headers_.assign(replies_.size(), mmsghdr{});
+    iov_.resize(replies_.size());
+    control_.resize(replies_.size());
+    segments_.clear();
+
+    size_t count = 0;
+    for (size_t i = 0; i < replies_.size();) {
+        const Reply& first = replies_[i];
+        size_t bytes = first.length;
+        size_t segments = 1;
+        if (gso_) {
+            // replies are contiguous in data_, so a train is a single iovec
+            while (i + segments < replies_.size() && segments < kUdpMaxSegments) {
+                const Reply& next = replies_[i + segments];
+                const Reply& last = replies_[i + segments - 1];
+                if (last.length != first.length || next.length > first.length ||
+                    bytes + next.length > kUdpMaxPayload ||
+                    next.peer_length != first.peer_length ||
+                    std::memcmp(&next.peer, &first.peer, first.peer_length) != 0) {
+                    break;
+                }
+                bytes += next.length;
+                ++segments;
+            }
+        }
+
+        iov_[count].iov_base = data_.data() + first.offset;
+        iov_[count].iov_len = bytes;
+        msghdr& msg = headers_[count].msg_hdr;
+        msg.msg_name = const_cast<sockaddr_storage*>(&first.peer);
+        msg.msg_namelen = first.peer_length;
+        msg.msg_iov = &iov_[count];
+        msg.msg_iovlen = 1;
+        if (segments > 1) {
+            msg.msg_control = control_[count].bytes;
+            msg.msg_controllen = sizeof(Control);
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t segment_size = static_cast<uint16_t>(first.length);
+            std::memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+        }
+        segments_.push_back(segments);
+        ++count;
+        i += segments;
+    }
+    headers_.resize(count);
+    return count;
+}
+
+void UdpReplies::clear() {
+    data_.clear();
+    replies_.clear();
+    headers_.clear();
+    segments_.clear();
+}
@@ -18,6 +18,12 @@ std::string get_current_time(){
     return ss.str();
 }
 
+void burn_cpu(uint32_t us){
+    auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+    while (std::chrono::steady_clock::now() < until) {
+    }
+}
+
 void print_stats(std::string_view server_name, int active_connections, long long total_messages){
     Logger::info("(", get_current_time(), ")", server_name, " - active connections: ", active_connections, " - total messages: ", total_messages);
 }
@@ -26,4 +32,80 @@ bool set_non_blocking(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
     if (flags == -1) return false;
     return fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+// for blocking sockets: keeps sending until every byte is out
+bool send_all(int fd, std::string_view data, size_t max_chunk, int flags) {
+    while (!data.empty()) {
+        size_t chunk = max_chunk > 0 ? std::min(max_chunk, data.size()) : data.size();
+        ssize_t sent = ::send(fd, data.data(), chunk, MSG_NOSIGNAL | flags);
+        if (sent == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data.remove_prefix(sent);
+    }
+    return true;
+}
+
+bool sendfile_all(int fd, int file_fd, size_t count, size_t max_chunk) {
+    off_t offset = 0;
+    while (static_cast<size_t>(offset) < count) {
+        size_t left = count - static_cast<size_t>(offset);
+        ssize_t sent = ::sendfile(fd, file_fd, &offset, max_chunk > 0 ? std::min(max_chunk, left) : left);
+        if (sent <= 0) {
+            if (sent == -1 && errno == EINTR) continue;
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t clamp_iov(iovec* iov, size_t count, size_t limit) {
+    if (limit == 0) {
+        return count;
+    }
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (bytes + iov[i].iov_len >= limit) {
+            iov[i].iov_len = limit - bytes;
+            return i + 1;
+        }
+        bytes += iov[i].iov_len;
+    }
+    return count;
+}
+
+bool make_pipe(SocketRAII& read_end, SocketRAII& write_end) {
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1) return false;
+    read_end = SocketRAII(fds[0]);
+    write_end = SocketRAII(fds[1]);
+    return true;
+}
+
+std::string_view trim_line(std::string_view line) {
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+        line.remove_suffix(1);
+    }
+    return line;
+}
+
+// splits off the next space-separated word; `rest` keeps everything after it
+std::string_view next_token(std::string_view& rest) {
+    size_t start = rest.find_first_not_of(' ');
+    if (start == std::string_view::npos) {
+        rest = {};
+        return {};
+    }
+    size_t end = rest.find(' ', start);
+    std::string_view token = rest.substr(start, end - start);
+    rest = end == std::string_view::npos ? std::string_view{} : rest.substr(end + 1);
+    return token;
+}
+
+// `upper` must already be upper case
+bool equals_ignore_case(std::string_view word, std::string_view upper) {
+    return word.size() == upper.size() && std::equal(word.begin(), word.end(), upper.begin(),
+        [](char x, char y) { return std::toupper(static_cast<unsigned char>(x)) == y; });
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <iostream>
 #include <string>
@@ -11,14 +12,33 @@
 #include <sstream>
 #include <iomanip>
 #include <mutex>
+#include <random>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <deque>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <dirent.h>
+
+#include "capture_format.hpp"
 
 // 简单的日志类
 class Logger {
 public:
     template<typename... Args>
     static void log(Args&&... args) {
+        // a stream per line keeps std::fixed/std::setprecision from sticking to std::cout
+        std::ostringstream line;
+        (line << ... << std::forward<Args>(args));
         std::lock_guard<std::mutex> lock(mutex_);
-        (std::cout << ... << std::forward<Args>(args)) << std::endl;
+        std::cout << line.str() << std::endl;
     }
 private:
     static std::mutex mutex_;
@@ -42,12 +62,32 @@ private:
 
 class BenchmarkClient {
 public:
+    static constexpr size_t kSeqpacketRecord = 16 * 1024;
+
     struct Config {
         std::string host = "127.0.0.1";
         uint16_t port = 18081;
         int num_clients = 100;
         int messages_per_client = 10;
         int message_interval_ms = 100;
+        size_t payload_size = 0;   // 0: short greeting, otherwise pad each message to this size
+        int kv_keys = 0;           // >0: cache workload (GET/SET) over this many keys
+        int set_percent = 10;      // share of SETs in the cache workload
+        int fanout_subscribers = 0; // >0: pub/sub fan-out, clients become publishers
+        int pipeline_depth = 1;    // messages sent back-to-back before reading their replies
+        bool udp = false;          // one message per datagram, unanswered ones count as lost
+        int udp_timeout_ms = 200;  // how long a batch waits for its replies
+        std::string unix_path;     // 非空: 通过 AF_UNIX socket 连接
+        bool seqpacket = false;    // AF_UNIX SOCK_SEQPACKET, 每次发送是一个记录
+        int churn_rate = 0;        // >0: 每秒新建这么多连接, 每个连接发送 messages_per_client 条消息后关闭
+        int churn_seconds = 10;    // churn 模式持续时间
+        std::string replay_path;   // 非空: 按服务器 --capture 文件中的连接和时间重放
+        double replay_speed = 1.0; // 重放时间缩放, 2 表示两倍速; 0 表示不等待, 尽快发送
+        long long idle_connections = 0; // >0: 分步打开这么多空闲连接, 每步后采样内存占用
+        int idle_steps = 10;       // 空闲连接分几步打开
+        int idle_settle_ms = 1000; // 每步打开后等待服务端接受完连接的时间
+        int server_pid = 0;        // 服务端进程号, 用于读取 /proc/<pid>/status 和 /proc/<pid>/fd
+        std::string http_get;      // 非空: 在 keep-alive 连接上 GET 这个路径, 每条消息是一个请求
     };
     
     struct Stats {
@@ -57,15 +97,62 @@ public:
         std::atomic<int> failed_messages{0};
         std::atomic<long long> total_bytes_sent{0};
         std::atomic<long long> total_bytes_received{0};
+        std::atomic<long long> kv_hits{0};
+        std::atomic<long long> kv_gets{0};
+        std::atomic<long long> fanout_received{0};
+        std::atomic<long long> last_delivery_ns{0};
+        std::atomic<long long> datagrams_sent{0};
+        std::atomic<long long> datagrams_received{0};
+        std::atomic<long long> busy_replies{0};    // 服务器过载时返回的 BUSY
+        // 发布到订阅者收到的延迟, 第 i 个桶统计 [2^(i-1), 2^i) 微秒
+        std::array<std::atomic<long long>, 40> latency_us{};
+        // 重放: 每次发送比计划时间晚多少, 桶同上
+        std::array<std::atomic<long long>, 40> send_lag_us{};
     };
     
     BenchmarkClient(const Config& config) : config_(config) {}
     
     void run() {
+        if (!config_.replay_path.empty()) {
+            run_replay();
+            return;
+        }
+        if (config_.idle_connections > 0) {
+            run_idle();
+            return;
+        }
         Logger::log("Starting benchmark with ", config_.num_clients, " clients, ",
                    config_.messages_per_client, " messages each");
-        Logger::log("Target: ", config_.host, ":", config_.port);
+        if (config_.unix_path.empty()) {
+            Logger::log("Target: ", config_.host, ":", config_.port);
+        } else {
+            Logger::log("Target: unix:", config_.unix_path, config_.seqpacket ? " (seqpacket)" : "");
+        }
+        if (config_.payload_size > 0) {
+            Logger::log("Payload: ", config_.payload_size, " bytes per message");
+        }
+        if (config_.pipeline_depth > 1) {
+            Logger::log("Pipeline: ", config_.pipeline_depth, " messages in flight per client");
+        }
+        if (config_.kv_keys > 0) {
+            Logger::log("Cache workload: ", config_.kv_keys, " keys, ", config_.set_percent, "% SET");
+        }
+        if (!config_.http_get.empty()) {
+            Logger::log("HTTP: GET ", config_.http_get, " on keep-alive connections");
+        }
         
+        if (config_.fanout_subscribers > 0) {
+            run_fanout();
+            return;
+        }
+        if (config_.churn_rate > 0) {
+            run_churn();
+            return;
+        }
+        if (config_.udp) {
+            Logger::log("UDP: one message per datagram, ", config_.udp_timeout_ms, "ms reply timeout");
+        }
+
         Timer timer;
         
         // 创建客户端线程
@@ -74,7 +161,13 @@ public:
         
         for (int i = 0; i < config_.num_clients; ++i) {
             threads.emplace_back([this, i]() {
-                run_client(i);
+                if (config_.udp) {
+                    run_udp_client(i);
+                } else if (!config_.http_get.empty()) {
+                    run_http_client();
+                } else {
+                    run_client(i);
+                }
             });
         }
         
@@ -86,19 +179,26 @@ public:
         auto elapsed_ms = timer.elapsed();
         
         // 输出统计结果
-        print_results(elapsed_ms);
+        if (config_.udp) {
+            print_udp_results(elapsed_ms);
+        } else {
+            print_results(elapsed_ms);
+        }
     }
     
 private:
-    void run_client(int client_id) {
+    // 连接服务器, 失败返回 -1
+    int connect_to_server() {
+        if (!config_.unix_path.empty()) {
+            return connect_unix();
+        }
         // 创建socket
         int sock = socket(AF_INET, SOCK_STREAM, 0);
         if (sock < 0) {
             stats_.failed_connections++;
-            return;
+            return -1;
         }
         
-        // 连接服务器
         sockaddr_in addr{};
         addr.sin_family = AF_INET;
         addr.sin_port = htons(config_.port);
@@ -106,38 +206,91 @@ private:
         if (inet_pton(AF_INET, config_.host.c_str(), &addr.sin_addr) <= 0) {
             close(sock);
             stats_.failed_connections++;
-            return;
+            return -1;
         }
         
         if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
             close(sock);
             stats_.failed_connections++;
-            return;
+            return -1;
         }
         
         stats_.successful_connections++;
+        return sock;
+    }
+
+    int connect_unix() {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, config_.unix_path.c_str(), sizeof(addr.sun_path) - 1);
+        int sock = socket(AF_UNIX, config_.seqpacket ? SOCK_SEQPACKET : SOCK_STREAM, 0);
+        if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            if (sock >= 0) close(sock);
+            stats_.failed_connections++;
+            return -1;
+        }
+        stats_.successful_connections++;
+        return sock;
+    }
+
+    void run_client(int client_id) {
+        int sock = connect_to_server();
+        if (sock < 0) {
+            return;
+        }
         
-        // 发送消息
-        for (int i = 0; i < config_.messages_per_client; ++i) {
-            std::string message = "Hello from client " + std::to_string(client_id) + 
-                                 " message " + std::to_string(i + 1) + "\n";
-            
-            ssize_t sent = send(sock, message.c_str(), message.length(), 0);
-            if (sent > 0) {
-                stats_.successful_messages++;
-                stats_.total_bytes_sent += sent;
-                
-                // 接收响应
-                char buffer[1024];
-                ssize_t received = recv(sock, buffer, sizeof(buffer) - 1, 0);
+        std::mt19937 rng(client_id);
+        LineReader reader(sock);
+        std::vector<bool> is_get;
+        int depth = std::max(1, config_.pipeline_depth);
+
+        // 发送消息, 每批 depth 条一次发出, 再依次读取响应
+        for (int i = 0; i < config_.messages_per_client; i += depth) {
+            int batch = std::min(depth, config_.messages_per_client - i);
+            std::string request;
+            is_get.assign(batch, false);
+            for (int j = 0; j < batch; ++j) {
+                bool get = false;
+                request += make_message(client_id, i + j, rng, get);
+                is_get[j] = get;
+            }
+
+            long long sent_ns = now_ns();
+            if (!send_all(sock, request)) {
+                stats_.failed_messages += batch;
+                continue;
+            }
+            stats_.successful_messages += batch;
+            stats_.total_bytes_sent += request.size();
+
+            for (int j = 0; j < batch; ++j) {
+                // 接收响应, 以换行结束
+                char head[8] = {};
+                ssize_t received;
+                if (depth == 1) {
+                    received = recv_line(sock, head);
+                } else {
+                    std::string line;
+                    received = reader.next(line) ? static_cast<ssize_t>(line.size() + 1) : -1;
+                    std::memcpy(head, line.data(), std::min<size_t>(sizeof(head), line.size()));
+                }
+                if (is_get[j] && received > 0) {
+                    stats_.kv_gets++;
+                    if (std::string_view(head, 6) == "VALUE ") {
+                        stats_.kv_hits++;
+                    }
+                }
                 if (received > 0) {
                     stats_.total_bytes_received += received;
+                    if (received == 5 && std::string_view(head, 4) == "BUSY") {
+                        stats_.busy_replies++;
+                    }
                 } else {
                     stats_.failed_messages++;
                 }
-            } else {
-                stats_.failed_messages++;
             }
+            // 一批请求的往返时间: 发送到最后一个响应
+            record_latency((now_ns() - sent_ns) / 1000);
             
             // 间隔
             if (config_.message_interval_ms > 0) {
@@ -147,8 +300,922 @@ private:
         
         close(sock);
     }
+
+    // HTTP: 每批 depth 个 GET 一次发出, 再按 Content-Length 依次读完响应;
+    // 非 200 的响应计为失败
+    void run_http_client() {
+        int sock = connect_to_server();
+        if (sock < 0) {
+            return;
+        }
+        std::string one = "GET " + config_.http_get + " HTTP/1.1\r\nHost: " + config_.host + "\r\n\r\n";
+        int depth = std::max(1, config_.pipeline_depth);
+        HttpReader reader(sock);
+        std::string request;
+
+        for (int i = 0; i < config_.messages_per_client; i += depth) {
+            int batch = std::min(depth, config_.messages_per_client - i);
+            request.clear();
+            for (int j = 0; j < batch; ++j) {
+                request += one;
+            }
+
+            long long sent_ns = now_ns();
+            if (!send_all(sock, request)) {
+                stats_.failed_messages += config_.messages_per_client - i;
+                break;
+            }
+            stats_.total_bytes_sent += request.size();
+
+            for (int j = 0; j < batch; ++j) {
+                size_t received = 0;
+                int status = reader.next(received);
+                if (status < 0) {
+                    // 连接断开, 剩下的请求都算失败
+                    stats_.failed_messages += config_.messages_per_client - i - j;
+                    close(sock);
+                    return;
+                }
+                stats_.total_bytes_received += received;
+                if (status == 200) {
+                    stats_.successful_messages++;
+                } else {
+                    stats_.failed_messages++;
+                }
+            }
+            record_latency((now_ns() - sent_ns) / 1000);
+
+            if (config_.message_interval_ms > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(config_.message_interval_ms));
+            }
+        }
+
+        close(sock);
+    }
+
+    // UDP: 每批 depth 个数据报一次发出, 然后等待响应; 超时未收到的计为丢失
+    void run_udp_client(int client_id) {
+        int sock = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(config_.port);
+        if (sock < 0 || inet_pton(AF_INET, config_.host.c_str(), &addr.sin_addr) <= 0 ||
+            connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            if (sock >= 0) close(sock);
+            stats_.failed_connections++;
+            return;
+        }
+        stats_.successful_connections++;
+        timeval timeout{config_.udp_timeout_ms / 1000, (config_.udp_timeout_ms % 1000) * 1000};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::mt19937 rng(client_id);
+        std::vector<char> buffer(65536);
+        int depth = std::max(1, config_.pipeline_depth);
+        for (int i = 0; i < config_.messages_per_client; i += depth) {
+            int batch = std::min(depth, config_.messages_per_client - i);
+            long long batch_ns = now_ns();
+            int pending = 0;
+            for (int j = 0; j < batch; ++j) {
+                std::string message;
+                if (config_.kv_keys > 0) {
+                    bool is_get = false;
+                    message = make_message(client_id, i + j, rng, is_get);
+                } else {
+                    // udp <send-ns> from-<client> <padding>, 回显中带回发送时间
+                    message = "udp " + std::to_string(now_ns()) + " from-" + std::to_string(client_id);
+                    if (message.size() + 1 < config_.payload_size) {
+                        message.append(config_.payload_size - message.size() - 1, 'x');
+                    }
+                    message += "\n";
+                }
+                if (send(sock, message.data(), message.size(), 0) == static_cast<ssize_t>(message.size())) {
+                    stats_.datagrams_sent++;
+                    stats_.total_bytes_sent += message.size();
+                    pending++;
+                } else {
+                    stats_.failed_messages++;
+                }
+            }
+
+            while (pending > 0) {
+                ssize_t received = recv(sock, buffer.data(), buffer.size(), 0);
+                if (received <= 0) {
+                    break;  // 超时, 本批剩余的数据报丢失
+                }
+                pending--;
+                stats_.datagrams_received++;
+                stats_.total_bytes_received += received;
+                std::string_view reply(buffer.data(), received);
+                long long sent_ns = batch_ns;
+                if (size_t at = reply.find("udp "); at != std::string_view::npos) {
+                    sent_ns = std::atoll(std::string(reply.substr(at + 4, 20)).c_str());
+                }
+                record_latency((now_ns() - sent_ns) / 1000);
+            }
+
+            if (config_.message_interval_ms > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(config_.message_interval_ms));
+            }
+        }
+        close(sock);
+    }
+
+    // 连接风暴: num_clients 个线程按目标速率轮流 连接 -> 交换 K 条消息 -> 关闭,
+    // 每次连接使用新的临时源端口; 落后于计划时立即发起下一个连接 (开环)
+    void run_churn() {
+        Logger::log("Churn benchmark: ", config_.churn_rate, " connections/s for ", config_.churn_seconds,
+                   "s, ", config_.messages_per_client, " messages each, ", config_.num_clients, " threads");
+        std::map<std::string, long long> netstat_before = read_netstat();
+
+        Timer timer;
+        auto start = std::chrono::steady_clock::now();
+        long long total = static_cast<long long>(config_.churn_rate) * config_.churn_seconds;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < config_.num_clients; ++t) {
+            threads.emplace_back([this, t, start, total]() {
+                std::mt19937 rng(t);
+                auto interval = std::chrono::nanoseconds(1000000000LL / config_.churn_rate);
+                // 第 n 个连接计划在 start + n * interval 发起, 线程 t 负责 n % num_clients == t
+                for (long long n = t; n < total; n += config_.num_clients) {
+                    std::this_thread::sleep_until(start + n * interval);
+                    run_churn_connection(static_cast<int>(n), rng);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        auto elapsed_ms = timer.elapsed();
+
+        std::map<std::string, long long> netstat_after = read_netstat();
+        Logger::log("\n=== Churn Benchmark Results ===");
+        Logger::log("Duration: ", elapsed_ms, "ms");
+        Logger::log("Connections - Success: ", stats_.successful_connections.load(),
+                   ", Failed: ", stats_.failed_connections.load());
+        Logger::log("Messages - Success: ", stats_.successful_messages.load(),
+                   ", Failed: ", stats_.failed_messages.load());
+        if (elapsed_ms > 0) {
+            Logger::log("Connection rate: ", std::fixed, std::setprecision(2),
+                       stats_.successful_connections.load() * 1000.0 / elapsed_ms, " connections/s (target ",
+                       config_.churn_rate, ")");
+        }
+        Logger::log("Connect latency (us, bucket upper bound) - p50: ", latency_percentile(0.5),
+                   ", p99: ", latency_percentile(0.99), ", p999: ", latency_percentile(0.999));
+        if (netstat_before.empty() || netstat_after.empty()) {
+            Logger::log("Accept queue: /proc/net/netstat not readable");
+        } else {
+            // 全机计数; 服务端与客户端在同一台机器时即为服务端的 accept 队列溢出
+            Logger::log("Accept queue - ListenOverflows: ",
+                       netstat_after["ListenOverflows"] - netstat_before["ListenOverflows"],
+                       ", ListenDrops: ", netstat_after["ListenDrops"] - netstat_before["ListenDrops"]);
+        }
+    }
+
+    void run_churn_connection(int index, std::mt19937& rng) {
+        long long begin = now_ns();
+        int sock = connect_to_server();
+        if (sock < 0) {
+            return;
+        }
+        record_latency((now_ns() - begin) / 1000);
+        for (int i = 0; i < config_.messages_per_client; ++i) {
+            bool is_get = false;
+            std::string message = make_message(index, i, rng, is_get);
+            char head[8] = {};
+            if (send_all(sock, message) && recv_line(sock, head) > 0) {
+                stats_.successful_messages++;
+                stats_.total_bytes_sent += message.size();
+            } else {
+                stats_.failed_messages++;
+                break;
+            }
+        }
+        close(sock);
+    }
+
+    // 重放的一次发送: 服务器一次读取中收到的同一连接的消息
+    struct ReplaySend {
+        uint64_t offset_ns;
+        std::vector<std::string_view> messages;     // 指向映射的捕获文件
+    };
+
+    // 映射捕获文件, 每个连接一个线程, 按原始 (或缩放后的) 时间发送, 同时读取响应.
+    // 发送与读取交替进行且不阻塞, 服务器变慢时发送落后于计划, 延迟从计划入队时算起 (开环)
+    void run_replay() {
+        int fd = ::open(config_.replay_path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        if (fd < 0 || fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(CaptureFileHeader)) {
+            Logger::log("Cannot read capture ", config_.replay_path);
+            if (fd >= 0) close(fd);
+            return;
+        }
+        size_t size = static_cast<size_t>(st.st_size);
+        void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            Logger::log("Cannot map capture ", config_.replay_path);
+            return;
+        }
+        std::string_view rest(static_cast<const char*>(data), size);
+        if (std::memcmp(rest.data(), kCaptureMagic, sizeof(kCaptureMagic)) != 0) {
+            Logger::log(config_.replay_path, " is not a capture file");
+            munmap(data, size);
+            return;
+        }
+        rest.remove_prefix(sizeof(CaptureFileHeader));
+
+        // 按连接分组; 同一连接同一时间戳的连续记录来自一次读取, 合并为一次发送
+        std::map<uint32_t, std::vector<ReplaySend>> connections;
+        CaptureRecordHeader header;
+        std::string_view message;
+        long long total_messages = 0;
+        uint64_t first_offset_ns = 0;
+        uint64_t last_offset_ns = 0;
+        while (next_capture_record(rest, header, message)) {
+            if (total_messages == 0) {
+                first_offset_ns = header.offset_ns;  // 捕获开始到第一条消息之间的空闲不重放
+            }
+            uint64_t offset_ns = header.offset_ns - std::min(header.offset_ns, first_offset_ns);
+            std::vector<ReplaySend>& sends = connections[header.connection];
+            if (sends.empty() || sends.back().offset_ns != offset_ns) {
+                sends.push_back({offset_ns, {}});
+            }
+            sends.back().messages.push_back(message);
+            total_messages++;
+            last_offset_ns = std::max(last_offset_ns, offset_ns);
+        }
+        std::ostringstream speed;
+        speed << config_.replay_speed << "x speed";
+        Logger::log("Replaying ", total_messages, " messages on ", connections.size(), " connections, ",
+                   last_offset_ns / 1000000, "ms of traffic at ",
+                   config_.replay_speed > 0 ? speed.str() : std::string("full speed"));
+        if (config_.unix_path.empty()) {
+            Logger::log("Target: ", config_.host, ":", config_.port);
+        } else {
+            Logger::log("Target: unix:", config_.unix_path, config_.seqpacket ? " (seqpacket)" : "");
+        }
+
+        Timer timer;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        threads.reserve(connections.size());
+        for (auto& [id, sends] : connections) {
+            threads.emplace_back([this, &sends = sends, start]() {
+                run_replay_connection(sends, start);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        auto elapsed_ms = timer.elapsed();
+        munmap(data, size);
+
+        print_results(elapsed_ms, "Latency per message");
+        Logger::log("Send lag behind schedule (us, bucket upper bound) - p50: ",
+                   percentile(stats_.send_lag_us, 0.5), ", p99: ", percentile(stats_.send_lag_us, 0.99),
+                   ", p999: ", percentile(stats_.send_lag_us, 0.999));
+    }
+
+    void run_replay_connection(const std::vector<ReplaySend>& sends, std::chrono::steady_clock::time_point start) {
+        auto due = [&](const ReplaySend& send) {
+            if (config_.replay_speed <= 0) {
+                return start;
+            }
+            return start + std::chrono::nanoseconds(static_cast<long long>(send.offset_ns / config_.replay_speed));
+        };
+        long long messages = 0;
+        for (const ReplaySend& send : sends) {
+            messages += send.messages.size();
+        }
+        // 连接在它的第一条消息到期时建立, 与捕获中的连接布局一致
+        std::this_thread::sleep_until(due(sends.front()));
+        int sock = connect_to_server();
+        if (sock < 0) {
+            stats_.failed_messages += messages;
+            return;
+        }
+
+        std::string out;
+        size_t out_offset = 0;
+        std::deque<long long> in_flight;    // 等待响应的消息的入队时间
+        std::string line_head;
+        size_t next = 0;
+        long long answered = 0;
+        char buffer[16384];
+        while (true) {
+            auto now = std::chrono::steady_clock::now();
+            while (next < sends.size() && due(sends[next]) <= now) {
+                record_bucket(stats_.send_lag_us,
+                             std::chrono::duration_cast<std::chrono::microseconds>(now - due(sends[next])).count());
+                for (std::string_view message : sends[next].messages) {
+                    out += message;
+                    in_flight.push_back(now_ns());
+                }
+                next++;
+            }
+            if (next == sends.size() && out_offset == out.size() && in_flight.empty()) {
+                break;
+            }
+            while (out_offset < out.size()) {
+                size_t chunk = out.size() - out_offset;
+                if (config_.seqpacket) {
+                    chunk = std::min(chunk, kSeqpacketRecord);
+                }
+                ssize_t sent = send(sock, out.data() + out_offset, chunk, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (sent <= 0) {
+                    break;
+                }
+                stats_.total_bytes_sent += sent;
+                out_offset += sent;
+            }
+            if (out_offset == out.size()) {
+                out.clear();
+                out_offset = 0;
+            }
+
+            // 等到下一次发送到期, 或者有响应可读, 或者 (全部发出后) 2 秒没有响应
+            pollfd pfd{sock, static_cast<short>(POLLIN | (out.empty() ? 0 : POLLOUT)), 0};
+            auto wait = next < sends.size()
+                ? std::max(std::chrono::nanoseconds(0), due(sends[next]) - std::chrono::steady_clock::now())
+                : std::chrono::nanoseconds(std::chrono::seconds(2));
+            timespec timeout{static_cast<time_t>(wait.count() / 1000000000), static_cast<long>(wait.count() % 1000000000)};
+            int ready = ppoll(&pfd, 1, &timeout, nullptr);
+            if (ready == 0 && next == sends.size()) {
+                break;  // 剩余的响应不再等待
+            }
+            if (ready <= 0 || !(pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            ssize_t received = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                break;
+            }
+            if (received < 0) {
+                continue;
+            }
+            stats_.total_bytes_received += received;
+            std::string_view data(buffer, received);
+            size_t start_of_line = 0;
+            size_t end;
+            while ((end = data.find('\n', start_of_line)) != std::string_view::npos) {
+                line_head.append(data.substr(start_of_line, std::min<size_t>(end - start_of_line, 8)));
+                if (!in_flight.empty()) {
+                    record_latency((now_ns() - in_flight.front()) / 1000);
+                    in_flight.pop_front();
+                    answered++;
+                }
+                if (line_head == "BUSY") {
+                    stats_.busy_replies++;
+                }
+                line_head.clear();
+                start_of_line = end + 1;
+            }
+            if (start_of_line < data.size() && line_head.size() < 8) {
+                line_head.append(data.substr(start_of_line, 8 - line_head.size()));
+            }
+        }
+        stats_.successful_messages += answered;
+        stats_.failed_messages += messages - answered;
+        close(sock);
+    }
+
+    // /proc/net/netstat 中 TcpExt 的计数, 一行名字一行数值
+    static std::map<std::string, long long> read_netstat() {
+        std::map<std::string, long long> counters;
+        std::ifstream file("/proc/net/netstat");
+        std::string names;
+        std::string values;
+        while (std::getline(file, names) && std::getline(file, values)) {
+            if (!names.starts_with("TcpExt:")) continue;
+            std::istringstream name_stream(names);
+            std::istringstream value_stream(values);
+            std::string name;
+            long long value;
+            name_stream >> name;
+            value_stream >> name;
+            while (name_stream >> name && value_stream >> value) {
+                counters[name] = value;
+            }
+        }
+        return counters;
+    }
+
+    // 一次内存采样, 读不到的项为 -1
+    struct MemorySample {
+        long long server_rss_kb = -1;   // /proc/<pid>/status 的 VmRSS
+        long long server_fds = -1;      // /proc/<pid>/fd 的条目数
+        long long slab_kb = -1;         // /proc/meminfo 的 Slab, 全机: socket, file, epoll 项等内核对象
+        long long tcp_mem_pages = -1;   // /proc/net/sockstat 的 TCP mem, 全机: 收发队列占用的页
+    };
+
+    // 空闲连接的内存占用: 分 idle_steps 步打开 idle_connections 个连接, 不发送消息,
+    // 每步后采样服务端 RSS 和内核内存, 用相对开始时的增量算出每个连接的字节数.
+    // 每个源地址 (127.0.0.x) 只用临时端口范围的一部分, 连接数因此可以超过 6 万
+    void run_idle() {
+        rlimit limit{};
+        getrlimit(RLIMIT_NOFILE, &limit);
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        long long total = config_.idle_connections;
+        if (limit.rlim_cur != RLIM_INFINITY && static_cast<long long>(limit.rlim_cur) < total + 64) {
+            total = std::max(0LL, static_cast<long long>(limit.rlim_cur) - 64);
+            Logger::log("RLIMIT_NOFILE is ", limit.rlim_cur, ", opening at most ", total, " connections");
+        }
+        int steps = std::max(1, config_.idle_steps);
+        int threads_count = std::max(1, config_.num_clients);
+        Logger::log("Idle benchmark: ", total, " connections in ", steps, " steps, ", threads_count, " threads");
+        bool multi_source = config_.unix_path.empty() && config_.host.starts_with("127.");
+        long long per_source = ports_per_source();
+        if (config_.unix_path.empty()) {
+            Logger::log("Target: ", config_.host, ":", config_.port);
+        } else {
+            Logger::log("Target: unix:", config_.unix_path, config_.seqpacket ? " (seqpacket)" : "");
+        }
+        if (multi_source) {
+            Logger::log("Source addresses: 127.0.0.1 and up, ", per_source, " connections each");
+        }
+        if (config_.server_pid <= 0) {
+            Logger::log("No --server-pid: only host-wide kernel memory is reported");
+        }
+
+        std::vector<int> fds(total, -1);
+        std::atomic<bool> exhausted{false};
+        std::mutex error_mutex;
+        std::string first_error;
+        MemorySample base = sample_memory();
+        Logger::log("\n=== Idle Connection Memory ===");
+        long long opened = 0;
+        for (int step = 1; step <= steps && !exhausted.load(); ++step) {
+            long long target = total * step / steps;
+            std::vector<std::thread> threads;
+            for (int t = 0; t < threads_count; ++t) {
+                threads.emplace_back([&, t]() {
+                    for (long long n = opened + t; n < target && !exhausted.load(); n += threads_count) {
+                        fds[n] = open_idle_connection(n, multi_source, per_source);
+                        if (fds[n] < 0) {
+                            int error = errno;
+                            std::lock_guard<std::mutex> lock(error_mutex);
+                            if (first_error.empty()) {
+                                first_error = strerror(error);
+                            }
+                            exhausted = true;
+                        }
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            opened = target;
+            long long connected = stats_.successful_connections.load();
+            MemorySample sample = settle(base, connected);
+            print_idle_step(step, steps, connected, base, sample);
+        }
+
+        for (int fd : fds) {
+            if (fd >= 0) close(fd);
+        }
+        Logger::log("Connections - Success: ", stats_.successful_connections.load(),
+                   ", Failed: ", stats_.failed_connections.load());
+        if (!first_error.empty()) {
+            Logger::log("Stopped at the first failed connect: ", first_error);
+        }
+    }
+
+    // 绑定到第 index / per_source 个回环源地址后连接; 端口在 connect 时按完整四元组选择,
+    // 所以每个源地址都有整个临时端口范围可用
+    int open_idle_connection(long long index, bool multi_source, long long per_source) {
+        if (!multi_source) {
+            return connect_to_server();
+        }
+        sockaddr_in source{};
+        source.sin_family = AF_INET;
+        source.sin_addr.s_addr = htonl(static_cast<uint32_t>(0x7F000001 + index / per_source));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(config_.port);
+        int one = 1;
+        int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock < 0 || inet_pton(AF_INET, config_.host.c_str(), &addr.sin_addr) <= 0 ||
+            setsockopt(sock, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one)) < 0 ||
+            bind(sock, (struct sockaddr*)&source, sizeof(source)) < 0 ||
+            connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            int error = errno;
+            if (sock >= 0) close(sock);
+            errno = error;
+            stats_.failed_connections++;
+            return -1;
+        }
+        stats_.successful_connections++;
+        return sock;
+    }
+
+    // 临时端口范围的 3/4, 给同一源地址上的其他连接留出余量
+    static long long ports_per_source() {
+        std::ifstream file("/proc/sys/net/ipv4/ip_local_port_range");
+        long long low = 0;
+        long long high = 0;
+        if (!(file >> low >> high) || high <= low) {
+            return 20000;
+        }
+        return std::max(1000LL, (high - low + 1) * 3 / 4);
+    }
+
+    // 等服务端接受完本步的连接 (最多 10 秒), 再等 idle_settle_ms 让内存稳定, 然后采样
+    MemorySample settle(const MemorySample& base, long long connected) {
+        if (base.server_fds >= 0) {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+            while (count_server_fds() - base.server_fds < connected && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(config_.idle_settle_ms));
+        return sample_memory();
+    }
+
+    void print_idle_step(int step, int steps, long long connected, const MemorySample& base, const MemorySample& now) {
+        auto per_connection = [](long long bytes, long long connections) {
+            return connections > 0 ? bytes / connections : 0;
+        };
+        std::ostringstream line;
+        line << "Step " << step << "/" << steps << ": " << connected << " connections";
+        if (now.server_rss_kb >= 0 && base.server_rss_kb >= 0) {
+            // 按服务端实际持有的连接数摊分, 服务端拒绝或尚未接受的连接不计入
+            long long held = now.server_fds >= 0 ? now.server_fds - base.server_fds : connected;
+            long long rss = (now.server_rss_kb - base.server_rss_kb) * 1024;
+            line << " - server: " << held << " fds, RSS +" << rss / 1024 / 1024 << "MB = "
+                 << per_connection(rss, held) << " B/conn";
+        }
+        if (now.slab_kb >= 0 && base.slab_kb >= 0) {
+            // 回环连接的两端都在本机, 内核对象包括客户端一侧
+            long long slab = (now.slab_kb - base.slab_kb) * 1024;
+            line << " - kernel slab +" << slab / 1024 / 1024 << "MB = "
+                 << per_connection(slab, connected) << " B/conn (both ends)";
+        }
+        if (now.tcp_mem_pages >= 0) {
+            line << " - TCP buffers: " << now.tcp_mem_pages << " pages";
+        }
+        Logger::log(line.str());
+    }
+
+    MemorySample sample_memory() const {
+        MemorySample sample;
+        if (config_.server_pid > 0) {
+            sample.server_rss_kb = read_field("/proc/" + std::to_string(config_.server_pid) + "/status", "VmRSS:");
+            sample.server_fds = count_server_fds();
+        }
+        sample.slab_kb = read_field("/proc/meminfo", "Slab:");
+        // TCP: inuse N orphan N tw N alloc N mem N
+        std::ifstream sockstat("/proc/net/sockstat");
+        std::string line;
+        while (std::getline(sockstat, line)) {
+            if (!line.starts_with("TCP:")) continue;
+            std::istringstream fields(line);
+            std::string name;
+            long long value;
+            while (fields >> name) {
+                if (name == "mem" && fields >> value) {
+                    sample.tcp_mem_pages = value;
+                }
+            }
+        }
+        return sample;
+    }
+
+    long long count_server_fds() const {
+        if (config_.server_pid <= 0) {
+            return -1;
+        }
+        std::string path = "/proc/" + std::to_string(config_.server_pid) + "/fd";
+        DIR* dir = opendir(path.c_str());
+        if (dir == nullptr) {
+            return -1;
+        }
+        long long count = 0;
+        while (dirent* entry = readdir(dir)) {
+            if (entry->d_name[0] != '.') count++;
+        }
+        closedir(dir);
+        return count;
+    }
+
+    // "Name:   12345 kB" 形式的行中的数值
+    static long long read_field(const std::string& path, std::string_view name) {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.starts_with(name)) {
+                return std::atoll(line.c_str() + name.size());
+            }
+        }
+        return -1;
+    }
+
+    std::string make_message(int client_id, int index, std::mt19937& rng, bool& is_get) {
+        std::string message;
+        if (config_.kv_keys > 0) {
+            std::string key = "key:" + std::to_string(rng() % config_.kv_keys);
+            is_get = static_cast<int>(rng() % 100) >= config_.set_percent;
+            if (is_get) {
+                message = "GET " + key;
+            } else {
+                message = "SET " + key + " 0 ";
+                message.append(std::max<size_t>(config_.payload_size, 32), 'v');
+            }
+        } else {
+            message = "Hello from client " + std::to_string(client_id) + 
+                      " message " + std::to_string(index + 1);
+            if (message.size() + 1 < config_.payload_size) {
+                message.append(config_.payload_size - message.size() - 1, 'x');
+            }
+        }
+        message += "\n";
+        return message;
+    }
     
-    void print_results(long long elapsed_ms) {
+    // seqpacket 记录不能超过服务端一次读取的大小 (16KB)
+    bool send_all(int sock, const std::string& message) const {
+        size_t limit = config_.seqpacket ? kSeqpacketRecord : message.size();
+        size_t offset = 0;
+        while (offset < message.size()) {
+            ssize_t sent = send(sock, message.data() + offset, std::min(limit, message.size() - offset), MSG_NOSIGNAL);
+            if (sent <= 0) {
+                return false;
+            }
+            offset += sent;
+        }
+        return true;
+    }
+
+    // 读取直到收到换行, 返回读取的字节数; head 保存响应的前 8 个字节
+    static ssize_t recv_line(int sock, char (&head)[8]) {
+        char buffer[16384];
+        ssize_t total = 0;
+        while (true) {
+            ssize_t received = recv(sock, buffer, sizeof(buffer), 0);
+            if (received <= 0) {
+                return total > 0 ? total : received;
+            }
+            if (total < 8) {
+                std::memcpy(head + total, buffer, std::min<size_t>(8 - total, received));
+            }
+            total += received;
+            if (buffer[received - 1] == '\n') {
+                return total;
+            }
+        }
+    }
+
+    // 按行读取, 缓冲多余的数据; 超时或连接关闭返回 false
+    class LineReader {
+    public:
+        explicit LineReader(int sock) : sock_(sock) {}
+        bool next(std::string& line) {
+            while (true) {
+                size_t end = buffer_.find('\n', start_);
+                if (end != std::string::npos) {
+                    line.assign(buffer_, start_, end - start_);
+                    start_ = end + 1;
+                    return true;
+                }
+                buffer_.erase(0, start_);
+                start_ = 0;
+                char chunk[16384];
+                ssize_t received = recv(sock_, chunk, sizeof(chunk), 0);
+                if (received <= 0) {
+                    return false;
+                }
+                buffer_.append(chunk, received);
+            }
+        }
+    private:
+        int sock_;
+        std::string buffer_;
+        size_t start_ = 0;
+    };
+
+    // 读取 HTTP 响应: 头部缓冲解析, 响应体按 Content-Length 读掉, 不保留
+    class HttpReader {
+    public:
+        explicit HttpReader(int sock) : sock_(sock) {}
+        // 返回状态码, bytes 为整个响应的字节数; 连接关闭或格式错误返回 -1
+        int next(size_t& bytes) {
+            size_t end;
+            while ((end = buffer_.find("\r\n\r\n", start_)) == std::string::npos) {
+                if (!fill()) {
+                    return -1;
+                }
+            }
+            std::string_view head(buffer_.data() + start_, end - start_);
+            if (head.size() < 12 || head.substr(0, 5) != "HTTP/") {
+                return -1;
+            }
+            int status = std::atoi(head.data() + 9);
+            size_t length = 0;
+            size_t at = head.find("\r\nContent-Length: ");
+            if (at != std::string_view::npos) {
+                length = std::strtoull(head.data() + at + 18, nullptr, 10);
+            }
+            bytes = head.size() + 4 + length;
+            start_ = end + 4;
+            size_t buffered = std::min(length, buffer_.size() - start_);
+            start_ += buffered;
+            length -= buffered;
+            // 大响应体直接读掉, 不经过缓冲; 只读到它的结尾, 不越过下一个响应
+            char chunk[65536];
+            while (length > 0) {
+                ssize_t received = recv(sock_, chunk, std::min(length, sizeof(chunk)), 0);
+                if (received <= 0) {
+                    return -1;
+                }
+                length -= received;
+            }
+            return status;
+        }
+    private:
+        bool fill() {
+            buffer_.erase(0, start_);
+            start_ = 0;
+            char chunk[16384];
+            ssize_t received = recv(sock_, chunk, sizeof(chunk), 0);
+            if (received <= 0) {
+                return false;
+            }
+            buffer_.append(chunk, received);
+            return true;
+        }
+
+        int sock_;
+        std::string buffer_;
+        size_t start_ = 0;
+    };
+
+    static long long now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 订阅者先全部订阅, 然后 num_clients 个发布者各发布 messages_per_client 条消息
+    void run_fanout() {
+        Logger::log("Fan-out benchmark: ", config_.fanout_subscribers, " subscribers, ",
+                   config_.num_clients, " publishers x ", config_.messages_per_client, " messages");
+        Logger::log("Target: ", config_.host, ":", config_.port);
+
+        long long expected = static_cast<long long>(config_.num_clients) * config_.messages_per_client;
+        std::atomic<int> ready{0};
+        std::vector<std::thread> subscribers;
+        subscribers.reserve(config_.fanout_subscribers);
+        for (int i = 0; i < config_.fanout_subscribers; ++i) {
+            subscribers.emplace_back([this, &ready, expected]() {
+                run_subscriber(ready, expected);
+            });
+        }
+        while (ready.load() < config_.fanout_subscribers) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        Timer timer;
+        long long start_ns = now_ns();
+        std::vector<std::thread> publishers;
+        publishers.reserve(config_.num_clients);
+        for (int i = 0; i < config_.num_clients; ++i) {
+            publishers.emplace_back([this, i]() {
+                run_publisher(i);
+            });
+        }
+        for (auto& thread : publishers) {
+            thread.join();
+        }
+        for (auto& thread : subscribers) {
+            thread.join();
+        }
+        long long delivery_ms = (stats_.last_delivery_ns.load() - start_ns) / 1000000;
+        print_fanout_results(std::max(0LL, delivery_ms), expected * config_.fanout_subscribers);
+    }
+
+    void run_subscriber(std::atomic<int>& ready, long long expected) {
+        int sock = connect_to_server();
+        if (sock < 0) {
+            ready++;
+            return;
+        }
+        // 消息停止到达 2 秒后结束
+        timeval timeout{2, 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        LineReader reader(sock);
+        std::string line;
+        bool subscribed = send_all(sock, "SUBSCRIBE bench\n") && reader.next(line);
+        ready++;
+        long long received = 0;
+        long long last_ns = 0;
+        while (subscribed && received < expected && reader.next(line)) {
+            // MESSAGE bench <send-ns> <padding>
+            std::string_view rest(line);
+            if (!rest.starts_with("MESSAGE bench ")) continue;
+            rest.remove_prefix(14);
+            long long sent_ns = std::atoll(std::string(rest.substr(0, rest.find(' '))).c_str());
+            last_ns = now_ns();
+            record_latency((last_ns - sent_ns) / 1000);
+            stats_.total_bytes_received += line.size() + 1;
+            received++;
+        }
+        stats_.fanout_received += received;
+        long long prev = stats_.last_delivery_ns.load();
+        while (last_ns > prev && !stats_.last_delivery_ns.compare_exchange_weak(prev, last_ns)) {}
+        close(sock);
+    }
+
+    void run_publisher(int client_id) {
+        int sock = connect_to_server();
+        if (sock < 0) {
+            return;
+        }
+        LineReader reader(sock);
+        std::string line;
+        for (int i = 0; i < config_.messages_per_client; ++i) {
+            std::string message = "PUBLISH bench " + std::to_string(now_ns()) + " from-" + std::to_string(client_id);
+            if (message.size() + 1 < config_.payload_size) {
+                message.append(config_.payload_size - message.size() - 1, 'x');
+            }
+            message += "\n";
+            if (send_all(sock, message) && reader.next(line)) {
+                stats_.successful_messages++;
+                stats_.total_bytes_sent += message.size();
+            } else {
+                stats_.failed_messages++;
+            }
+            if (config_.message_interval_ms > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(config_.message_interval_ms));
+            }
+        }
+        close(sock);
+    }
+
+    void record_latency(long long latency_us) {
+        record_bucket(stats_.latency_us, latency_us);
+    }
+
+    static void record_bucket(std::array<std::atomic<long long>, 40>& buckets, long long value_us) {
+        value_us = std::max(0LL, value_us);
+        buckets[std::min<size_t>(std::bit_width(static_cast<unsigned long long>(value_us)), 39)]++;
+    }
+
+    long long latency_percentile(double fraction) {
+        return percentile(stats_.latency_us, fraction);
+    }
+
+    static long long percentile(const std::array<std::atomic<long long>, 40>& buckets, double fraction) {
+        long long total = 0;
+        for (auto& bucket : buckets) total += bucket.load();
+        long long seen = 0;
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            seen += buckets[i].load();
+            if (total > 0 && seen >= total * fraction) {
+                return i == 0 ? 0 : (1LL << i) - 1; // 桶的上界
+            }
+        }
+        return 0;
+    }
+
+    void print_fanout_results(long long elapsed_ms, long long expected_deliveries) {
+        Logger::log("\n=== Fan-out Benchmark Results ===");
+        Logger::log("Duration: ", elapsed_ms, "ms (first publish to last delivery)");
+        Logger::log("Connections - Success: ", stats_.successful_connections.load(),
+                   ", Failed: ", stats_.failed_connections.load());
+        Logger::log("Published - Success: ", stats_.successful_messages.load(),
+                   ", Failed: ", stats_.failed_messages.load());
+        long long received = stats_.fanout_received.load();
+        Logger::log("Deliveries - Received: ", received, " of ", expected_deliveries, " (",
+                   std::fixed, std::setprecision(2),
+                   expected_deliveries > 0 ? received * 100.0 / expected_deliveries : 0.0, "%)");
+        if (elapsed_ms > 0) {
+            Logger::log("Throughput: ", std::fixed, std::setprecision(2),
+                       received * 1000.0 / elapsed_ms, " deliveries/s");
+        }
+        Logger::log("Latency (us, bucket upper bound) - p50: ", latency_percentile(0.5),
+                   ", p99: ", latency_percentile(0.99), ", p999: ", latency_percentile(0.999));
+    }
+
+    void print_udp_results(long long elapsed_ms) {
+        Logger::log("\n=== UDP Benchmark Results ===");
+        Logger::log("Duration: ", elapsed_ms, "ms");
+        long long sent = stats_.datagrams_sent.load();
+        long long received = stats_.datagrams_received.load();
+        Logger::log("Datagrams - Sent: ", sent, ", Received: ", received, ", Send failures: ",
+                   stats_.failed_messages.load());
+        Logger::log("Loss: ", std::max(0LL, sent - received), " (", std::fixed, std::setprecision(2),
+                   sent > 0 ? std::max(0LL, sent - received) * 100.0 / sent : 0.0, "%)");
+        if (elapsed_ms > 0) {
+            Logger::log("Throughput: ", std::fixed, std::setprecision(2),
+                       received * 1000.0 / elapsed_ms, " replies/s");
+        }
+        Logger::log("Latency (us, bucket upper bound) - p50: ", latency_percentile(0.5),
+                   ", p99: ", latency_percentile(0.99), ", p999: ", latency_percentile(0.999));
+    }
+
+    void print_results(long long elapsed_ms, const char* latency_label = "Round trip per batch") {
         Logger::log("\n=== Benchmark Results ===");
         Logger::log("Duration: ", elapsed_ms, "ms");
         Logger::log("Connections - Success: ", stats_.successful_connections.load(),
@@ -168,6 +1235,15 @@ private:
             Logger::log("Bandwidth - Sent: ", std::fixed, std::setprecision(2),
                        mbps_sent, " Mbps, Received: ", mbps_received, " Mbps");
         }
+        Logger::log(latency_label, " (us, bucket upper bound) - p50: ", latency_percentile(0.5),
+                   ", p99: ", latency_percentile(0.99), ", p999: ", latency_percentile(0.999));
+        if (stats_.busy_replies.load() > 0) {
+            Logger::log("Busy replies (shed by the server): ", stats_.busy_replies.load());
+        }
+        if (stats_.kv_gets.load() > 0) {
+            Logger::log("Cache - GETs: ", stats_.kv_gets.load(), ", hit rate: ", std::fixed, std::setprecision(2),
+                       stats_.kv_hits.load() * 100.0 / stats_.kv_gets.load(), "%");
+        }
     }
     
     Config config_;
@@ -182,10 +1258,37 @@ void print_usage(const char* program_name) {
               << "  -c, --clients NUM      Number of clients (default: 100)\n"
               << "  -m, --messages NUM     Messages per client (default: 10)\n"
               << "  -i, --interval MS      Message interval in ms (default: 100)\n"
+              << "  -s, --size BYTES       Pad each message (or cache value) to BYTES (default: short message)\n"
+              << "  --kv KEYS              Cache workload: GET/SET over KEYS keys (server: --protocol kv)\n"
+              << "  --set-percent P        Share of SETs in the cache workload (default: 10)\n"
+              << "  --fanout SUBS          Pub/sub fan-out: SUBS subscribers, -c publishers (server: --protocol pubsub)\n"
+              << "  --pipeline N           Send N messages back-to-back before reading their replies (default: 1)\n"
+              << "  --unix PATH            Connect over an AF_UNIX stream socket (server: --unix PATH)\n"
+              << "  --seqpacket            Use SOCK_SEQPACKET on that socket (server: --seqpacket)\n"
+              << "  --churn RATE           Open RATE connections/s across -c threads, exchange -m messages on\n"
+              << "                         each and close it; reports connect latency and ListenOverflows\n"
+              << "  --churn-seconds S      Length of the churn run (default: 10)\n"
+              << "  --udp                  One message per datagram; reports loss and latency (server: --udp)\n"
+              << "  --udp-timeout MS       How long a batch waits for its replies before counting them lost (default: 200)\n"
+              << "  --replay FILE          Replay a server --capture FILE: same connections, messages and timing;\n"
+              << "                         expects one reply line per message (echo, kv)\n"
+              << "  --replay-speed X       Scale the captured timing, 2 = twice as fast, 0 = no waiting (default: 1)\n"
+              << "  --idle N               Open N idle connections in steps across -c threads and report memory\n"
+              << "                         per connection; binds 127.0.0.x sources to get past one port range\n"
+              << "  --idle-steps K         Number of steps (default: 10)\n"
+              << "  --idle-settle MS       Wait after each step before sampling (default: 1000)\n"
+              << "  --server-pid PID       Server process to sample RSS and fds from (/proc/PID)\n"
+              << "  --http-get PATH        Each message is an HTTP/1.1 GET of PATH on a keep-alive connection;\n"
+              << "                         --pipeline applies (server: --protocol http, e.g. with --static-dir)\n"
               << "  --help                 Show this help\n\n"
               << "Examples:\n"
               << "  " << program_name << " -c 50 -m 20\n"
-              << "  " << program_name << " -h 192.168.1.100 -p 8080 -c 200\n";
+              << "  " << program_name << " -h 192.168.1.100 -p 8080 -c 200\n"
+              << "  " << program_name << " -c 16 -m 1000 -i 0 -s 262144\n"
+              << "  " << program_name << " --udp -c 8 -m 100000 -i 0 --pipeline 32\n"
+              << "  " << program_name << " --replay traffic.cap --replay-speed 2\n"
+              << "  " << program_name << " --http-get /big.bin -c 8 -m 2000 -i 0\n"
+              << "  " << program_name << " --idle 1000000 --idle-steps 10 -c 32 --server-pid $(pidof cpp-io-learning)\n";
 }
 
 int main(int argc, char* argv[]) {
@@ -208,6 +1311,42 @@ int main(int argc, char* argv[]) {
             if (++i < argc) config.messages_per_client = std::stoi(argv[i]);
         } else if (arg == "--interval" || arg == "-i") {
             if (++i < argc) config.message_interval_ms = std::stoi(argv[i]);
+        } else if (arg == "--size" || arg == "-s") {
+            if (++i < argc) config.payload_size = std::stoull(argv[i]);
+        } else if (arg == "--kv") {
+            if (++i < argc) config.kv_keys = std::stoi(argv[i]);
+        } else if (arg == "--pipeline") {
+            if (++i < argc) config.pipeline_depth = std::stoi(argv[i]);
+        } else if (arg == "--unix") {
+            if (++i < argc) config.unix_path = argv[i];
+        } else if (arg == "--seqpacket") {
+            config.seqpacket = true;
+        } else if (arg == "--churn") {
+            if (++i < argc) config.churn_rate = std::stoi(argv[i]);
+        } else if (arg == "--churn-seconds") {
+            if (++i < argc) config.churn_seconds = std::stoi(argv[i]);
+        } else if (arg == "--udp") {
+            config.udp = true;
+        } else if (arg == "--udp-timeout") {
+            if (++i < argc) config.udp_timeout_ms = std::stoi(argv[i]);
+        } else if (arg == "--replay") {
+            if (++i < argc) config.replay_path = argv[i];
+        } else if (arg == "--replay-speed") {
+            if (++i < argc) config.replay_speed = std::stod(argv[i]);
+        } else if (arg == "--idle") {
+            if (++i < argc) config.idle_connections = std::stoll(argv[i]);
+        } else if (arg == "--idle-steps") {
+            if (++i < argc) config.idle_steps = std::stoi(argv[i]);
+        } else if (arg == "--idle-settle") {
+            if (++i < argc) config.idle_settle_ms = std::stoi(argv[i]);
+        } else if (arg == "--server-pid") {
+            if (++i < argc) config.server_pid = std::stoi(argv[i]);
+        } else if (arg == "--set-percent") {
+            if (++i < argc) config.set_percent = std::stoi(argv[i]);
+        } else if (arg == "--fanout") {
+            if (++i < argc) config.fanout_subscribers = std::stoi(argv[i]);
+        } else if (arg == "--http-get") {
+            if (++i < argc) config.http_get = argv[i];
         }
     }
     